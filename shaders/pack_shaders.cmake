@@ -0,0 +1,36 @@
+# cmake -DENTRIES=<list> -DOUTPUT=<header> -P pack_shaders.cmake
+# Every line of ENTRIES is "<name> <bgfx renderer type> <binary>". The header gets all binaries back
+# to back in SHADER_PACK_DATA and SHADER_PACK_INDEX sorted by name, see src/core/graphic/shader_pack.h.
+# The space sorts before any character of a name, so vs_a comes before vs_a_b like strcmp has it
+file(STRINGS ${ENTRIES} lines)
+list(SORT lines)
+
+# cmake regular expressions have no {n}, sixteen bytes per line are spelled out
+string(REPEAT "0x[0-9a-f][0-9a-f], " 16 row)
+
+set(offset 0)
+set(data "")
+set(index "")
+foreach (line ${lines})
+    string(REGEX MATCH "^([^ ]+) ([^ ]+) (.+)$" fields "${line}")
+    set(name ${CMAKE_MATCH_1})
+    set(renderer ${CMAKE_MATCH_2})
+    set(binary ${CMAKE_MATCH_3})
+
+    file(READ ${binary} hex HEX)
+    string(LENGTH "${hex}" hex_length)
+    math(EXPR size "${hex_length} / 2")
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1, " bytes "${hex}")
+    string(REGEX REPLACE "(${row})" "\\1\n    " bytes "${bytes}")
+    string(REPLACE " \n" "\n" bytes "${bytes}")
+    string(STRIP "${bytes}" bytes)
+
+    string(APPEND data "    // ${name}, ${renderer}\n    ${bytes}\n")
+    string(APPEND index "    { \"${name}\", bgfx::RendererType::${renderer}, ${offset}, ${size} },\n")
+    math(EXPR offset "${offset} + ${size}")
+endforeach ()
+
+file(WRITE ${OUTPUT}
+        "// generated by shaders/pack_shaders.cmake, do not edit\n\n"
+        "static const uint8_t SHADER_PACK_DATA[] = {\n${data}};\n\n"
+        "static const ShaderPackEntry SHADER_PACK_INDEX[] = {\n${index}};\n")
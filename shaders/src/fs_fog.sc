@@ -2,16 +2,29 @@
 #include <bgfx_shader.sh>
 
 SAMPLER2D(s_depth, 0);
-SAMPLER3D(s_noise, 1);
-uniform vec4 u_params[8];
-
-#define u_camera_pos u_params[0].xyz
-#define u_noise_scale u_params[0].w // vec4 0
-#define u_box_min u_params[1].xyz
-#define u_density u_params[1].w // vec4 1
-#define u_box_max u_params[2].xyz // vec4 2
-#define u_color_min u_params[3] // vec4 3
-#define u_color_max u_params[4] // vec4 4
+SAMPLER3D(s_volume0, 1);
+SAMPLER3D(s_volume1, 2);
+SAMPLER3D(s_volume2, 3);
+SAMPLER3D(s_volume3, 4);
+
+// volumes of one pass, sorted front to back on the cpu
+#define MAX_VOLUMES 4
+#define MAX_STEPS 512
+
+uniform vec4 u_fog_params[2];
+uniform vec4 u_fog_volumes[16]; // 4 * MAX_VOLUMES
+
+#define u_camera_pos u_fog_params[0].xyz
+#define u_volume_count u_fog_params[0].w // vec4 0
+#define u_step_size u_fog_params[1].x
+#define u_max_steps u_fog_params[1].y // vec4 1
+
+#define u_box_min(i) u_fog_volumes[4 * (i) + 0].xyz
+#define u_noise_scale(i) u_fog_volumes[4 * (i) + 0].w
+#define u_box_max(i) u_fog_volumes[4 * (i) + 1].xyz
+#define u_density(i) u_fog_volumes[4 * (i) + 1].w
+#define u_color_min(i) u_fog_volumes[4 * (i) + 2]
+#define u_color_max(i) u_fog_volumes[4 * (i) + 3]
 
 vec3 to_screen_space(vec4 frag_coord) {
     return vec3(frag_coord.xy / u_viewRect.zw, frag_coord.z);
@@ -27,8 +40,14 @@ float to_device_depth(float depth)
 }
 
 vec3 screen_to_world_space(vec3 coord) {
+#if BGFX_SHADER_LANGUAGE_GLSL
+    // gl_FragCoord starts at the bottom left, clip space y already points up
+    float clip_y = coord.y * 2.0f - 1.0f;
+#else
+    float clip_y = 1.0f - coord.y * 2.0f;
+#endif // BGFX_SHADER_LANGUAGE_GLSL
     vec4 clip = vec4(coord.x * 2.0f - 1.0f,
-                 1.0f - coord.y * 2.0f,
+                 clip_y,
                  to_device_depth(coord.z),
                  1.0f);
 
@@ -55,8 +74,19 @@ float linear_depth(float depth) {
     return (depth - near) / (far - near);
 }
 
-bool is_in_box(vec3 pos) {
-    return all(u_box_min <= pos) && all(pos <= u_box_max);
+bool is_in_box(vec3 pos, vec3 box_min, vec3 box_max) {
+    return all(box_min <= pos) && all(pos <= box_max);
+}
+
+float sample_volume(int i, vec3 uvw) {
+    // samplers can't be indexed dynamically
+    if (i == 0)
+        return texture3DLod(s_volume0, uvw, 0.0f).x;
+    if (i == 1)
+        return texture3DLod(s_volume1, uvw, 0.0f).x;
+    if (i == 2)
+        return texture3DLod(s_volume2, uvw, 0.0f).x;
+    return texture3DLod(s_volume3, uvw, 0.0f).x;
 }
 
 float random(float x) {
@@ -95,36 +125,55 @@ bool ray_box_intersect(vec3 start, vec3 dir, vec3 b_min, vec3 b_max, out float t
     return tmax >= tmin;
 }
 
-float sample_fog(vec3 current_pos, vec3 backgroud_pos, vec3 camera_pos, vec3 box_extent) {
-    const int max_steps = 100;
-    const float step_size = 0.25f;
+// front to back emission-absorption through all volumes of the pass, returns premultiplied color
+vec4 march_volumes(vec3 camera_pos, vec3 view_dir, float max_dist, float jitter) {
+    // only march the part of the ray that is inside some volume
+    float t_begin = max_dist;
+    float t_end = 0.0f;
+    for (int i = 0; i < MAX_VOLUMES; ++i) {
+        if (float(i) >= u_volume_count)
+            break;
 
-    vec3 view_dir = normalize(current_pos - camera_pos);
-    float max_dist = distance(camera_pos, backgroud_pos);
-    vec3 vsize = view_dir * step_size;
+        float tmin, tmax;
+        if (ray_box_intersect(camera_pos, view_dir, u_box_min(i), u_box_max(i), tmin, tmax)) {
+            t_begin = min(t_begin, max(tmin, 0.0f));
+            t_end = max(t_end, min(tmax, max_dist));
+        }
+    }
 
-    vec3 curr_pos = camera_pos - vsize * random3(current_pos).x;
+    vec3 color = vec3_splat(0.0f);
     float trans = 1.0f;
-    for (int i = 0; i < max_steps; ++i) {
-        curr_pos += vsize;
-
-        if(distance(camera_pos, curr_pos) > max_dist)
+    float t = t_begin + u_step_size * jitter;
+    for (int s = 0; s < MAX_STEPS; ++s) {
+        if (float(s) >= u_max_steps || t > t_end || trans < 0.01f)
             break;
 
-        if(!is_in_box(curr_pos))
-            continue;
+        vec3 curr_pos = camera_pos + view_dir * t;
+        t += u_step_size;
+
+        for (int i = 0; i < MAX_VOLUMES; ++i) {
+            if (float(i) >= u_volume_count)
+                break;
+
+            vec3 box_min = u_box_min(i);
+            vec3 box_max = u_box_max(i);
+            if (!is_in_box(curr_pos, box_min, box_max))
+                continue;
 
-        // sample density here
-        float sample = texture3D(s_noise, (curr_pos - u_box_min) / box_extent * u_noise_scale).x;
+            // sample density here
+            float sample = sample_volume(i, (curr_pos - box_min) / (box_max - box_min) * u_noise_scale(i));
 
-        if (sample < 0.01f)
-            continue;
+            if (sample < 0.01f)
+                continue;
 
-        float curr_trans = exp(-u_density * sample * step_size);
-        trans *= curr_trans;
+            vec4 sample_color = mix(u_color_min(i), u_color_max(i), sample);
+            float alpha = (1.0f - exp(-u_density(i) * sample * u_step_size)) * sample_color.a;
+            color += trans * alpha * sample_color.rgb;
+            trans *= 1.0f - alpha;
+        }
     }
 
-    return 1.0f - trans;
+    return vec4(color, 1.0f - trans);
 }
 
 void main() {
@@ -135,8 +184,7 @@ void main() {
     screen_space.z = scene_depth;
     vec3 backgroud_pos = screen_to_world_space(screen_space);
 
-    vec3 box_extent = u_box_max - u_box_min;
-    float density = sample_fog(current_pos, backgroud_pos, u_camera_pos, box_extent);
-    vec4 color = mix(u_color_min, u_color_max, density);
-    gl_FragColor = vec4(color);
-}
\ No newline at end of file
+    vec3 view_dir = normalize(current_pos - u_camera_pos);
+    float max_dist = distance(u_camera_pos, backgroud_pos);
+    gl_FragColor = march_volumes(u_camera_pos, view_dir, max_dist, random3(current_pos).x);
+}
\ No newline at end of file
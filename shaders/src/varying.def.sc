@@ -1,6 +1,10 @@
-vec3 a_position : POSITION;
+vec4 a_position : POSITION;
 vec3 a_normal : NORMAL;
 vec2 a_texcoord0 : TEXCOORD0;
+vec4 i_data0 : TEXCOORD7;
+vec4 i_data1 : TEXCOORD6;
+vec4 i_data2 : TEXCOORD5;
+vec4 i_data3 : TEXCOORD4;
 
 vec3 v_position : TEXCOORD1;
 vec3 v_normal : NORMAL;
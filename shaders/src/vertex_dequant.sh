@@ -0,0 +1,32 @@
+// see VertexFormat and pack_vertices
+// [0]: aabb center, w: 0 float, 1 compact with 8 bit normals, 2 compact with 16 bit normals
+// [1]: aabb half extent
+uniform vec4 u_vertex_dequant[2];
+
+vec3 oct_decode(vec2 e) {
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(e.yx)) * (step(0.0, e.xy) * 2.0 - 1.0);
+    }
+    return normalize(n);
+}
+
+// model space position and normal from whichever vertex format the mesh was uploaded in
+void dequant_vertex(vec4 packed_position, vec3 packed_normal, out vec3 position, out vec3 normal) {
+    position = packed_position.xyz;
+    normal = packed_normal;
+    float format = u_vertex_dequant[0].w;
+    if (format > 0.5) {
+        position = u_vertex_dequant[0].xyz + packed_position.xyz * u_vertex_dequant[1].xyz;
+        if (format > 1.5) {
+            normal = oct_decode(packed_normal.xy);
+        }
+        else {
+            // two 255 level axes packed into the snorm w
+            float bits = floor(packed_position.w * 32767.0 + 0.5) + 32512.0;
+            float x = floor((bits + 0.5) / 255.0);
+            float y = bits - x * 255.0;
+            normal = oct_decode(vec2(x, y) / 127.0 - 1.0);
+        }
+    }
+}
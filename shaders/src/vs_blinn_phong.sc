@@ -2,11 +2,16 @@ $input a_position, a_normal, a_texcoord0
 $output v_position, v_normal, v_texcoord0
 
 #include <bgfx_shader.sh>
+#include "vertex_dequant.sh"
 
 void main() {
-    gl_Position = mul(u_modelViewProj, vec4(a_position, 1.0));
+    vec3 position;
+    vec3 normal;
+    dequant_vertex(a_position, a_normal, position, normal);
+
+    gl_Position = mul(u_modelViewProj, vec4(position, 1.0));
     v_position = mul(u_invViewProj, gl_Position).xyz;  // world space position
-    v_normal = mul(u_model[0], vec4(a_normal, 0.0)).xyz;  // world space normal (?)
+    v_normal = mul(u_model[0], vec4(normal, 0.0)).xyz;  // world space normal (?)
     v_texcoord0 = a_texcoord0;  // ignore texture transform
 }
 
@@ -0,0 +1,19 @@
+$input a_position, a_normal, a_texcoord0, i_data0, i_data1, i_data2, i_data3
+$output v_position, v_normal, v_texcoord0
+
+#include <bgfx_shader.sh>
+#include "vertex_dequant.sh"
+
+// vs_blinn_phong with the model matrix taken per instance, see Systems::rendering
+void main() {
+    vec3 position;
+    vec3 normal;
+    dequant_vertex(a_position, a_normal, position, normal);
+
+    mat4 model = mtxFromCols(i_data0, i_data1, i_data2, i_data3);
+    vec4 world = mul(model, vec4(position, 1.0));
+    gl_Position = mul(u_viewProj, world);
+    v_position = world.xyz;  // world space position
+    v_normal = mul(model, vec4(normal, 0.0)).xyz;  // world space normal (?)
+    v_texcoord0 = a_texcoord0;  // ignore texture transform
+}
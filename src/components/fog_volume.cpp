@@ -0,0 +1,15 @@
+#include "fog_volume.h"
+#include "core/graphic/volume_texture.h"
+#include <glm/common.hpp>
+#include <cfloat>
+
+float FogVolume::sample(const glm::vec3& pos) const {
+    if (texture == nullptr || !box.contains(pos)) {
+        return 0.0f;
+    }
+
+    // the far faces stay on the last texel, fract would wrap them over to the opposite side
+    glm::vec3 local = glm::min((pos - box.min) / box.extent(), glm::vec3(1.0f - FLT_EPSILON));
+    glm::vec3 uvw   = glm::fract(local * noise_scale);
+    return texture->sample(uvw) / 255.0f;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <memory>
+
+#include "core/graphic/aabb.h"
+
+struct FogVolume {
+    std::shared_ptr<class VolumeTexture> texture;
+
+    // world space box the texture is stretched over
+    AABB box = { glm::vec3(0), glm::vec3(1) };
+
+    // transfer settings, density in [0, 1] is mapped between color_min and color_max
+    glm::vec4 color_min = glm::vec4(0.f, 0.432f, 1.0f, 0.422f);
+    glm::vec4 color_max = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f);
+    float density       = 0.5f;
+    float noise_scale   = 1.0f;
+
+    FogVolume() = default;
+
+    FogVolume(std::shared_ptr<VolumeTexture> texture, const AABB& box)
+        : texture(std::move(texture)),
+          box(box) {}
+
+    // normalized density at a world position, 0 outside the box
+    float sample(const glm::vec3& pos) const;
+};
@@ -6,6 +6,8 @@
 struct RenderComponent {
     std::shared_ptr<class Model> model;
     std::shared_ptr<class Shader> shader;
+    // same shading with the model matrix per instance, lets the renderer batch entities, optional
+    std::shared_ptr<class Shader> instanced_shader;
 
     bgfx::UniformHandle uniform; // move this into Material
 
@@ -8,6 +8,9 @@
 #include "gui.h"
 #include "times.h"
 #include "input.h"
+#include "graphic/model.h"
+#include "graphic/assets.h"
+#include "graphic/render_targets.h"
 
 #define INIT_STATIC_MODULE_EX(name, ...)       \
     if (!(name::init(__VA_ARGS__))) {          \
@@ -18,7 +21,8 @@
 #define INIT_STATIC_MODULE(name) INIT_STATIC_MODULE_EX(name, )
 
 static bool init_sdl2(const AppSetup& setup) {
-    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+    // render nodes may have no display at all, headless only needs events
+    if (SDL_Init(setup.headless ? SDL_INIT_EVENTS : SDL_INIT_VIDEO) != 0) {
         printf("failed to initialize SDL2: %s\n", SDL_GetError());
         return false;
     }
@@ -66,20 +70,26 @@ int Launcher::run(AppBase& app) {
         curr_state = next_state;
     }
 
-    return 0;
+    return app.exit_code;
 }
 
 AppState App::init() {
     AppSetup setup = on_setup();
+    if (quit) {
+        return AppState::Destroy;
+    }
+    modules_initialized = true;
 
     if (!init_sdl2(setup))
         return AppState::Destroy;
 
     INIT_STATIC_MODULE_EX(Screen, setup)
-    INIT_STATIC_MODULE_EX(Gfx, Screen::get_window())
+    INIT_STATIC_MODULE_EX(Gfx, Screen::get_window(), setup.render_thread, setup.present, setup.renderer)
     INIT_STATIC_MODULE(Gui)
     INIT_STATIC_MODULE(Time)
     INIT_STATIC_MODULE(Input)
+    INIT_STATIC_MODULE(Assets)
+    INIT_STATIC_MODULE(RenderTargets)
 
     on_awake();
 
@@ -94,6 +104,12 @@ AppState App::running() {
         return AppState::Cleanup;
     }
 
+    // waiting before input is sampled keeps it fresh for the frame it drives
+    bool late_input = Gfx::present().late_input;
+    if (late_input) {
+        Gfx::limit_frame_rate();
+    }
+    Gfx::begin_frame();
     SDL_Event event;
     Input::new_frame();
     while (SDL_PollEvent(&event)) {
@@ -119,6 +135,11 @@ AppState App::running() {
     on_gui();
     Gui::end_frame();
 
+    // finish models loaded in the background, a few meshes per frame
+    Model::process_async_loads();
+    Assets::collect();
+    RenderTargets::collect();
+
     // update scene
     on_update();
 
@@ -127,7 +148,11 @@ AppState App::running() {
     on_render();
     // render gui
     Gui::render();
+    // with a render thread this only hands the frame over, the next update starts while it renders
     Gfx::render();
+    if (!late_input) {
+        Gfx::limit_frame_rate();
+    }
 
     return AppState::Running;
 }
@@ -138,8 +163,15 @@ AppState App::cleanup() {
 }
 
 AppState App::destroy() {
+    if (!modules_initialized) {
+        return AppState::Default;
+    }
+
     on_quit();
 
+    RenderTargets::quit();
+    Assets::quit();
+    Model::cancel_async_loads();
     Input::quit();
     Time::quit();
     Gui::quit();
@@ -149,6 +181,9 @@ AppState App::destroy() {
     return AppState::Default;
 }
 
-void App::request_quit() {
+void App::request_quit(int code) {
     quit = true;
+    if (code != 0) {
+        exit_code = code;
+    }
 }
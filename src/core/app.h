@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <vector>
 #include "setup.h"
 
 enum class AppState {
@@ -21,6 +22,9 @@ public:
     virtual AppState running() { return AppState::Default; }
     virtual AppState cleanup() { return AppState::Default; }
     virtual AppState destroy() { return AppState::Default; }
+
+    // returned by Launcher::run as the process exit code
+    int exit_code = 0;
 };
 
 class Launcher {
@@ -51,14 +55,22 @@ public:
     virtual bool on_closing() { return true; }
     virtual void on_quit() {}
 
-    void request_quit();
+    // a non-zero exit_code marks the run as failed, a later request can't clear it
+    void request_quit(int code = 0);
 
     bool quit = false;
+    // command line arguments without the program name, set before on_setup
+    std::vector<std::string> args;
+
+private:
+    // false when on_setup quit before anything was initialized, destroy has nothing to undo then
+    bool modules_initialized = false;
 };
 
 #define LAUNCH_APP(name)                         \
     int main(int argc, char** argv) {            \
         setbuf(stdout, 0); /* for debug print */ \
         name app;                                \
+        app.args.assign(argv + 1, argv + argc);  \
         return Launcher().run(app);              \
     }
\ No newline at end of file
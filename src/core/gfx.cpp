@@ -2,54 +2,207 @@
 #include <SDL2/SDL_syswm.h>
 #include <bgfx/bgfx.h>
 #include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cmath>
 #include "window.h"
+#include "screen.h"
 
 enum ViewId : u16 {
     VID_Main = 0,
     // maybe more than one scene view
+    VID_Fog = 30,
     VID_PE = 31,
-    VID_GUI = 32
+    VID_GUI = 32,
+    // headless read-back, after everything that draws into the back-buffer
+    VID_Capture = 33
 };
 
+// frames the jitter is measured over
+#define FRAME_HISTORY_SIZE 120
+
 struct GfxImpl {
     // back-buffer settings
     i32 width;
     i32 height;
     u32 flags;
     bgfx::TextureFormat::Enum format;
+
+    // renders for the calling thread when enabled, see Gfx::init
+    std::thread render_thread;
+    std::atomic<bool> stop_rendering{false};
+
+    // input time of the frame being built and of the one handed to the render thread
+    std::chrono::steady_clock::time_point frame_begin;
+    std::chrono::steady_clock::time_point pending_begin;
+    std::chrono::steady_clock::time_point last_frame_end;
+    GfxFrameStats frame_stats;
+    float frame_history[FRAME_HISTORY_SIZE] = {};
+    u32 frame_history_count                 = 0;
+
+    PresentSettings present;
+    std::chrono::steady_clock::time_point next_frame_due;
+
+    // without a window views render to backbuffer, readback is its cpu readable copy
+    bool headless                      = false;
+    bgfx::FrameBufferHandle backbuffer = BGFX_INVALID_HANDLE;
+    bgfx::TextureHandle readback       = BGFX_INVALID_HANDLE;
+    u32 frame_number                   = 0;
 };
 
 static GfxImpl* s_gfx_impl = nullptr;
 
-bool Gfx::init(Window& window) {
-    assert(s_gfx_impl == nullptr && "gfx is initialized twice");
-    s_gfx_impl = new GfxImpl();
+// calls renderFrame until bgfx is gone after a stop was requested, bgfx has no context
+// yet while init is still running on the api thread
+static void render_thread_loop(GfxImpl* impl) {
+    while (true) {
+        if (bgfx::renderFrame() == bgfx::RenderFrame::NoContext) {
+            if (impl->stop_rendering) {
+                break;
+            }
+            std::this_thread::yield();
+        }
+    }
+}
 
-    SDL_Window* raw_win = window.get_raw();
+static u32 present_flags(const PresentSettings& present) {
+    // nothing to wait for without a display
+    if (s_gfx_impl->headless) {
+        return BGFX_RESET_NONE;
+    }
+    return present.mode == PresentMode::Vsync ? BGFX_RESET_VSYNC : BGFX_RESET_NONE;
+}
+
+static bgfx::RendererType::Enum renderer_type(RendererBackend renderer) {
+    switch (renderer) {
+    case RendererBackend::Noop: return bgfx::RendererType::Noop;
+    case RendererBackend::OpenGL: return bgfx::RendererType::OpenGL;
+    case RendererBackend::Vulkan: return bgfx::RendererType::Vulkan;
+    case RendererBackend::Direct3D11: return bgfx::RendererType::Direct3D11;
+    case RendererBackend::Auto: break;
+    }
+#if defined(_WIN32)
+    return bgfx::RendererType::Direct3D11;
+#else
+    return bgfx::RendererType::Count;
+#endif
+}
+
+// native handles of the window for bgfx
+static bool window_platform_data(Window& window, bgfx::PlatformData& pd) {
     SDL_SysWMinfo wminfo;
     SDL_VERSION(&wminfo.version)
-    if (!SDL_GetWindowWMInfo(raw_win, &wminfo)) {
+    if (!SDL_GetWindowWMInfo(window.get_raw(), &wminfo)) {
         printf("failed to get window wminfo: %s\n", SDL_GetError());
         return false;
     }
 
-    i32 width  = window.draw_width();
-    i32 height = window.draw_height();
+    switch (wminfo.subsystem) {
+#if defined(SDL_VIDEO_DRIVER_WINDOWS)
+    case SDL_SYSWM_WINDOWS:
+        pd.nwh = wminfo.info.win.window;
+        return true;
+#endif
+#if defined(SDL_VIDEO_DRIVER_X11)
+    case SDL_SYSWM_X11:
+        pd.ndt = wminfo.info.x11.display;
+        pd.nwh = (void*)(uintptr_t)wminfo.info.x11.window;
+        return true;
+#endif
+#if defined(SDL_VIDEO_DRIVER_COCOA)
+    case SDL_SYSWM_COCOA:
+        pd.nwh = wminfo.info.cocoa.window;
+        return true;
+#endif
+    default:
+        printf("unsupported window system: %d\n", (int)wminfo.subsystem);
+        return false;
+    }
+}
 
-    // init bgfx
+static void destroy_backbuffer(GfxImpl& impl) {
+    if (bgfx::isValid(impl.backbuffer)) {
+        bgfx::destroy(impl.backbuffer);
+        impl.backbuffer = BGFX_INVALID_HANDLE;
+    }
+    if (bgfx::isValid(impl.readback)) {
+        bgfx::destroy(impl.readback);
+        impl.readback = BGFX_INVALID_HANDLE;
+    }
+}
+
+// headless stand-in for the window's back-buffer at impl's size, views that draw to the back-buffer
+// are pointed at it
+static void create_backbuffer(GfxImpl& impl) {
+    destroy_backbuffer(impl);
+    u16 width                       = (u16)std::max(impl.width, 1);
+    u16 height                      = (u16)std::max(impl.height, 1);
+    bgfx::TextureHandle textures[2] = {
+        bgfx::createTexture2D(width, height, false, 1, bgfx::TextureFormat::RGBA8, BGFX_TEXTURE_RT),
+        bgfx::createTexture2D(width, height, false, 1, bgfx::TextureFormat::D24S8, BGFX_TEXTURE_RT_WRITE_ONLY),
+    };
+    impl.backbuffer = bgfx::createFrameBuffer(2, textures, true);
+
+    // the noop renderer has neither
+    const u64 read_caps = BGFX_CAPS_TEXTURE_BLIT | BGFX_CAPS_TEXTURE_READ_BACK;
+    if ((bgfx::getCaps()->supported & read_caps) == read_caps) {
+        impl.readback = bgfx::createTexture2D(width, height, false, 1, bgfx::TextureFormat::RGBA8, BGFX_TEXTURE_BLIT_DST | BGFX_TEXTURE_READ_BACK);
+    }
+
+    for (u16 view : { VID_Main, VID_PE, VID_GUI }) {
+        bgfx::setViewFrameBuffer(view, impl.backbuffer);
+    }
+    bgfx::setViewRect(VID_Main, 0, 0, width, height);
+}
+
+static void stop_render_thread() {
+    s_gfx_impl->stop_rendering = true;
+    if (s_gfx_impl->render_thread.joinable()) {
+        s_gfx_impl->render_thread.join();
+    }
+}
+
+bool Gfx::init(Window& window, bool render_thread, const PresentSettings& present, RendererBackend renderer) {
+    assert(s_gfx_impl == nullptr && "gfx is initialized twice");
+    s_gfx_impl           = new GfxImpl();
+    s_gfx_impl->present  = present;
+    s_gfx_impl->headless = !window.is_valid();
+
+    // init bgfx, without a window handle it renders headless and only to framebuffers
     bgfx::PlatformData pd;
     memset(&pd, 0, sizeof(pd));
-    pd.ndt = nullptr;
-    pd.nwh = wminfo.info.win.window;
+    if (!s_gfx_impl->headless && !window_platform_data(window, pd)) {
+        delete s_gfx_impl;
+        s_gfx_impl = nullptr;
+        return false;
+    }
+
+    glm::ivec2 size = s_gfx_impl->headless ? Screen::draw_size() : window.draw_size();
+    i32 width       = size.x;
+    i32 height      = size.y;
+
+    if (render_thread) {
+        // calling renderFrame before init keeps bgfx from creating a render thread and makes the
+        // thread calling init the api thread. Ours has to run already since init waits for the renderer
+        bgfx::renderFrame();
+        s_gfx_impl->render_thread = std::thread(render_thread_loop, s_gfx_impl);
+    }
+    s_gfx_impl->frame_stats.render_thread = render_thread;
 
     bgfx::Init init;
-    init.type              = bgfx::RendererType::Direct3D11;
+    init.type              = renderer_type(renderer);
     init.resolution.width  = width;
     init.resolution.height = height;
-    init.resolution.reset  = BGFX_RESET_VSYNC;
+    init.resolution.reset  = present_flags(present);
     init.platformData      = pd;
-    if (!bgfx::init(init))
+    if (!bgfx::init(init)) {
+        stop_render_thread();
+        delete s_gfx_impl;
+        s_gfx_impl = nullptr;
         return false;
+    }
 
     s_gfx_impl->width  = width;
     s_gfx_impl->height = height;
@@ -58,11 +211,22 @@ bool Gfx::init(Window& window) {
 
     bgfx::setViewRect(VID_Main, 0, 0, width, height);
     bgfx::setViewClear(VID_Main, BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, 0x000000ff, 1.0f, 0);
+    if (s_gfx_impl->headless) {
+        create_backbuffer(*s_gfx_impl);
+    }
     return true;
 }
 
 void Gfx::quit() {
+    if (s_gfx_impl == nullptr) {
+        return;
+    }
+
+    // the render thread keeps going until shutdown has gone through it
+    s_gfx_impl->stop_rendering = true;
+    destroy_backbuffer(*s_gfx_impl);
     bgfx::shutdown();
+    stop_render_thread();
     delete s_gfx_impl;
     s_gfx_impl = nullptr;
 }
@@ -75,22 +239,134 @@ u16 Gfx::pe_view() {
     return VID_PE;
 }
 
+u16 Gfx::fog_view() {
+    return VID_Fog;
+}
+
 u16 Gfx::gui_view() {
     return VID_GUI;
 }
 
 void Gfx::before_render(i32 width, i32 height) {
-    // check if we need to resize bgfx back-buffer
-    if (width != s_gfx_impl->width || height != s_gfx_impl->height) {
+    // headless there is no bgfx back-buffer to reset, only our stand-in
+    if (s_gfx_impl->headless) {
+        if (width != s_gfx_impl->width || height != s_gfx_impl->height) {
+            s_gfx_impl->width  = width;
+            s_gfx_impl->height = height;
+            create_backbuffer(*s_gfx_impl);
+        }
+        return;
+    }
+    // check if we need to resize bgfx back-buffer or switch vsync
+    u32 flags = (s_gfx_impl->flags & ~BGFX_RESET_VSYNC) | present_flags(s_gfx_impl->present);
+    if (width != s_gfx_impl->width || height != s_gfx_impl->height || flags != s_gfx_impl->flags) {
         s_gfx_impl->width  = width;
         s_gfx_impl->height = height;
+        s_gfx_impl->flags  = flags;
         bgfx::reset((u32)s_gfx_impl->width, (u32)s_gfx_impl->height, s_gfx_impl->flags, s_gfx_impl->format);
         // set view rect to cover the whole back-buffer, user can change this later
         bgfx::setViewRect(VID_Main, 0, 0, (u16)width, (u16)height);
     }
 }
 
+void Gfx::begin_frame() {
+    s_gfx_impl->frame_begin = std::chrono::steady_clock::now();
+}
+
 void Gfx::render() {
     bgfx::touch(VID_Main);
-    bgfx::frame();
+    s_gfx_impl->frame_number = bgfx::frame();
+
+    // with a render thread frame() returns once the previous frame is rendered, without one once this one is
+    GfxImpl& impl        = *s_gfx_impl;
+    auto now             = std::chrono::steady_clock::now();
+    auto rendered_begin  = impl.frame_stats.render_thread ? impl.pending_begin : impl.frame_begin;
+    impl.pending_begin   = impl.frame_begin;
+    GfxFrameStats& stats = impl.frame_stats;
+    const float smooth   = 0.1f;
+    if (rendered_begin.time_since_epoch().count() != 0) {
+        stats.last_latency_ms = std::chrono::duration<float, std::milli>(now - rendered_begin).count();
+        stats.latency_ms += (stats.last_latency_ms - stats.latency_ms) * smooth;
+    }
+    if (impl.last_frame_end.time_since_epoch().count() != 0) {
+        stats.last_frame_ms = std::chrono::duration<float, std::milli>(now - impl.last_frame_end).count();
+        stats.frame_ms += (stats.last_frame_ms - stats.frame_ms) * smooth;
+
+        impl.frame_history[impl.frame_history_count++ % FRAME_HISTORY_SIZE] = stats.last_frame_ms;
+        u32 count  = std::min<u32>(impl.frame_history_count, FRAME_HISTORY_SIZE);
+        float mean = 0, variance = 0;
+        for (u32 i = 0; i < count; ++i) {
+            mean += impl.frame_history[i];
+        }
+        mean /= count;
+        for (u32 i = 0; i < count; ++i) {
+            variance += (impl.frame_history[i] - mean) * (impl.frame_history[i] - mean);
+        }
+        stats.jitter_ms = std::sqrt(variance / count);
+    }
+    impl.last_frame_end = now;
+}
+
+void Gfx::set_present(const PresentSettings& present) {
+    s_gfx_impl->present = present;
+}
+
+const PresentSettings& Gfx::present() {
+    return s_gfx_impl->present;
+}
+
+void Gfx::limit_frame_rate() {
+    using clock                 = std::chrono::steady_clock;
+    GfxImpl& impl               = *s_gfx_impl;
+    impl.frame_stats.limiter_ms = 0;
+    if (impl.present.mode != PresentMode::Capped || impl.present.fps_cap == 0) {
+        impl.next_frame_due = {};
+        return;
+    }
+
+    auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / impl.present.fps_cap));
+    auto spin   = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float, std::milli>(impl.present.spin_ms));
+    auto start  = clock::now();
+    // the first frame and frames too far behind to catch up start a new schedule
+    if (impl.next_frame_due.time_since_epoch().count() == 0 || start - impl.next_frame_due > period) {
+        impl.next_frame_due = start;
+    }
+
+    auto due = impl.next_frame_due;
+    if (due - start > spin) {
+        std::this_thread::sleep_for(due - start - spin);
+    }
+    while (clock::now() < due) {
+        std::this_thread::yield();
+    }
+    // due times advance by whole periods, so an early or late wake-up doesn't drift the schedule
+    impl.next_frame_due         = due + period;
+    impl.frame_stats.limiter_ms = std::chrono::duration<float, std::milli>(clock::now() - start).count();
+}
+
+const GfxFrameStats& Gfx::frame_stats() {
+    return s_gfx_impl->frame_stats;
+}
+
+u32 Gfx::frame_number() {
+    return s_gfx_impl->frame_number;
+}
+
+bool Gfx::headless() {
+    return s_gfx_impl->headless;
+}
+
+bgfx::FrameBufferHandle Gfx::backbuffer() {
+    return s_gfx_impl->backbuffer;
+}
+
+u32 Gfx::read_backbuffer(std::vector<u8>& pixels) {
+    GfxImpl& impl = *s_gfx_impl;
+    if (!bgfx::isValid(impl.readback)) {
+        return 0;
+    }
+    pixels.resize(size_t(std::max(impl.width, 1)) * std::max(impl.height, 1) * 4);
+    // blits run in view order, the capture view comes after every view drawing into the back-buffer
+    bgfx::blit(VID_Capture, impl.readback, 0, 0, bgfx::getTexture(impl.backbuffer, 0));
+    return bgfx::readTexture(impl.readback, pixels.data());
 }
@@ -1,15 +1,53 @@
 #pragma once
 #include "types.h"
+#include "setup.h"
+#include <bgfx/bgfx.h>
+#include <vector>
 
 class Window;
 
+struct GfxFrameStats {
+    bool render_thread    = false;
+    float frame_ms        = 0; // between consecutive Gfx::render calls, smoothed
+    float latency_ms      = 0; // from Gfx::begin_frame until bgfx finished rendering that frame, smoothed
+    float last_frame_ms   = 0;
+    float last_latency_ms = 0;
+    float jitter_ms       = 0; // standard deviation of the recent frames' frame_ms
+    float limiter_ms      = 0; // last frame's wait in limit_frame_rate, slept and spun
+};
+
 class Gfx {
 public:
-    static bool init(Window& window);
+    // with render_thread bgfx renders on a thread of its own and Gfx::render only hands the frame over,
+    // so the next frame's update overlaps rendering. Memory given to bgfx by reference must then stay
+    // valid until bgfx releases it, which happens on the render thread.
+    // An invalid window renders headless, see backbuffer
+    static bool init(Window& window, bool render_thread = false, const PresentSettings& present = {}, RendererBackend renderer = RendererBackend::Auto);
     static void quit();
+    // marks the moment input for the next frame is sampled, latency is measured from here
+    static void begin_frame();
     static void before_render(i32 width, i32 height);
     static void render();
+    // vsync changes reset the back-buffer in the next before_render
+    static void set_present(const PresentSettings& present);
+    static const PresentSettings& present();
+    // with PresentMode::Capped waits until the next frame is due, sleeping first and spinning the last
+    // PresentSettings::spin_ms. Frames that fall more than a period behind don't try to catch up
+    static void limit_frame_rate();
+    static const GfxFrameStats& frame_stats();
+    // returned by bgfx::frame in the last render
+    static u32 frame_number();
+    static bool headless();
+    // headless: the rgba8 and depth framebuffer main, pe and gui views render to instead of a window,
+    // recreated when before_render changes its size. Invalid with a window
+    static bgfx::FrameBufferHandle backbuffer();
+    // headless: copies the back-buffer as this frame leaves it into pixels, rgba8 rows in the order of
+    // bgfx::Caps::originBottomLeft. pixels is filled once frame_number reaches the returned frame and
+    // must stay alive and unresized until then. Returns 0 when the renderer can't read textures back
+    static u32 read_backbuffer(std::vector<u8>& pixels);
     static u16 main_view();
     static u16 pe_view();
+    // offscreen fog at reduced resolution, before pe_view composites it
+    static u16 fog_view();
     static u16 gui_view();
 };
\ No newline at end of file
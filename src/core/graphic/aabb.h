@@ -0,0 +1,30 @@
+#pragma once
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/common.hpp>
+
+
+struct AABB {
+    glm::vec3 min, max;
+
+    glm::vec3 center() const { return (min + max) * .5f; }
+    glm::vec3 extent() const { return max - min; }
+    float surface_area() const {
+        const glm::vec3 e = extent();
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+    bool contains(const glm::vec3& p) const {
+        return p.x >= min.x && p.y >= min.y && p.z >= min.z
+            && p.x <= max.x && p.y <= max.y && p.z <= max.z;
+    }
+    AABB merged(const AABB& other) const { return {glm::min(min, other.min), glm::max(max, other.max)}; }
+    // bounds of the transformed box, Arvo's method
+    AABB transformed(const glm::mat4& m) const {
+        const glm::vec3 c = glm::vec3(m * glm::vec4(center(), 1.0f));
+        const glm::vec3 e = extent() * .5f;
+        const glm::vec3 r = glm::abs(glm::vec3(m[0])) * e.x + glm::abs(glm::vec3(m[1])) * e.y + glm::abs(glm::vec3(m[2])) * e.z;
+        return {c - r, c + r};
+    }
+};
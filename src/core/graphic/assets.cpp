@@ -0,0 +1,175 @@
+#include "assets.h"
+
+#include <filesystem>
+#include <unordered_map>
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+
+template<typename T>
+struct AssetEntry {
+    std::shared_ptr<T> asset;
+    u64 bytes = 0;      // shaders don't change size, models are sized once they finished loading
+    u64 last_used = 0;  // collect() calls
+};
+
+struct AssetsImpl {
+    std::unordered_map<std::string, AssetEntry<Model>> models;
+    std::unordered_map<std::string, AssetEntry<Shader>> shaders;
+    u64 memory_budget = 0;
+    u64 frame = 0;
+    AssetStats stats;
+};
+
+static AssetsImpl* s_assets_impl = nullptr;
+
+
+// the same file reached through different relative paths must share one entry
+static std::string canonical_path(const std::string& path) {
+    std::error_code error;
+    auto canonical = std::filesystem::weakly_canonical(path, error);
+    return error ? path : canonical.generic_string();
+}
+
+
+// only options changing the loaded result are part of the key
+static std::string model_key(const std::string& filename, const ModelLoadOptions& options) {
+    std::string key = canonical_path(filename);
+    key += '|';
+    key += char('0' + u8(options.vertex_format));
+    key += options.optimize_meshes ? 'o' : '-';
+    key += options.generate_lods ? 'l' : '-';
+    key += options.merge_meshes ? 'm' : '-';
+    key += options.keep_cpu_geometry ? 'c' : '-';
+    key += options.build_bvh ? 'b' : '-';
+    key += options.build_occluders ? 'u' : '-';
+    return key;
+}
+
+
+bool Assets::init(u64 memory_budget) {
+    assert(s_assets_impl == nullptr && "assets is initialized twice");
+    s_assets_impl = new AssetsImpl();
+    s_assets_impl->memory_budget = memory_budget;
+    return true;
+}
+
+
+void Assets::quit() {
+    if(s_assets_impl == nullptr)
+        return;
+
+    // anything still referenced elsewhere is released by its last owner
+    delete s_assets_impl;
+    s_assets_impl = nullptr;
+}
+
+
+std::shared_ptr<Model> Assets::model(const std::string& filename, const ModelLoadOptions& options) {
+    auto& impl = *s_assets_impl;
+    const auto [it, inserted] = impl.models.try_emplace(model_key(filename, options));
+    auto& entry = it->second;
+    entry.last_used = impl.frame;
+    if(!inserted) {
+        ++impl.stats.hits;
+        return entry.asset;
+    }
+
+    ++impl.stats.misses;
+    entry.asset = Model::load_async(filename, options);
+    return entry.asset;
+}
+
+
+std::shared_ptr<Shader> Assets::shader(const std::string& vs_name, const std::string& fs_name) {
+    auto& impl = *s_assets_impl;
+    const auto [it, inserted] = impl.shaders.try_emplace(vs_name + '|' + fs_name);
+    auto& entry = it->second;
+    entry.last_used = impl.frame;
+    if(!inserted) {
+        ++impl.stats.hits;
+        return entry.asset;
+    }
+
+    ++impl.stats.misses;
+    entry.asset = std::make_shared<Shader>(vs_name, fs_name);
+    entry.bytes = entry.asset->size_bytes();
+    return entry.asset;
+}
+
+
+void Assets::collect() {
+    auto& impl = *s_assets_impl;
+    ++impl.frame;
+
+    struct Candidate {
+        u64 last_used;
+        u64 bytes;
+        bool is_model;
+        std::string key;
+    };
+    std::vector<Candidate> unused;
+
+    AssetStats& stats = impl.stats;
+    stats.resident_bytes = 0;
+    stats.unused_bytes = 0;
+
+    for(auto it = impl.models.begin(); it != impl.models.end();) {
+        auto& entry = it->second;
+        if(entry.asset->state == ModelState::Failed) {
+            // a later request retries
+            it = impl.models.erase(it);
+            continue;
+        }
+        if(entry.asset->is_ready())
+            entry.bytes = entry.asset->gpu_bytes();
+        stats.resident_bytes += entry.bytes;
+        // loading models are kept, dropping them would only restart the load on the next request
+        if(entry.asset.use_count() == 1 && entry.asset->is_ready()) {
+            stats.unused_bytes += entry.bytes;
+            unused.push_back({entry.last_used, entry.bytes, true, it->first});
+        }
+        ++it;
+    }
+    for(auto& [key, entry] : impl.shaders) {
+        stats.resident_bytes += entry.bytes;
+        if(entry.asset.use_count() == 1) {
+            stats.unused_bytes += entry.bytes;
+            unused.push_back({entry.last_used, entry.bytes, false, key});
+        }
+    }
+
+    if(stats.resident_bytes > impl.memory_budget) {
+        std::sort(unused.begin(), unused.end(), [](const Candidate& a, const Candidate& b) { return a.last_used < b.last_used; });
+        for(const auto& candidate : unused) {
+            if(stats.resident_bytes <= impl.memory_budget)
+                break;
+            if(candidate.is_model)
+                impl.models.erase(candidate.key);
+            else
+                impl.shaders.erase(candidate.key);
+            stats.resident_bytes -= candidate.bytes;
+            stats.unused_bytes -= candidate.bytes;
+            ++stats.evictions;
+        }
+    }
+
+    stats.model_count = u32(impl.models.size());
+    stats.shader_count = u32(impl.shaders.size());
+}
+
+
+u64 Assets::memory_budget() {
+    return s_assets_impl->memory_budget;
+}
+
+
+void Assets::set_memory_budget(u64 bytes) {
+    s_assets_impl->memory_budget = bytes;
+}
+
+
+const AssetStats& Assets::stats() {
+    return s_assets_impl->stats;
+}
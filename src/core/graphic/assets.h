@@ -0,0 +1,43 @@
+#pragma once
+
+#include "../types.h"
+#include "model.h"
+#include "shader.h"
+
+#include <string>
+#include <memory>
+
+
+struct AssetStats {
+    u64 hits = 0;
+    u64 misses = 0;
+    u64 evictions = 0;
+    u64 resident_bytes = 0;     // gpu memory of every asset the manager holds
+    u64 unused_bytes = 0;       // part of resident_bytes nobody but the manager references
+    u32 model_count = 0;
+    u32 shader_count = 0;
+};
+
+
+// Shares models by canonical path and load options and shaders by name, so an asset used by several
+// entities is read and uploaded once. A request for an asset that is still loading returns the
+// loading instance. Assets nobody else references stay resident until the memory budget is
+// exceeded, then the least recently requested ones are dropped first.
+// Call from the thread driving bgfx, like the loads themselves.
+class Assets {
+public:
+    static bool init(u64 memory_budget = 256ull << 20);
+    static void quit();
+
+    // loads asynchronously on a miss, check Model::is_ready
+    static std::shared_ptr<Model> model(const std::string& filename, const ModelLoadOptions& options = {});
+    // names of packed shaders, see Shader
+    static std::shared_ptr<Shader> shader(const std::string& vs_name, const std::string& fs_name);
+
+    // once per frame, evicts unused assets while over budget and forgets failed loads
+    static void collect();
+
+    static u64 memory_budget();
+    static void set_memory_budget(u64 bytes);
+    static const AssetStats& stats();
+};
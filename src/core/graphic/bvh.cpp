@@ -0,0 +1,439 @@
+#include "bvh.h"
+#include "model.h"
+#include "../thread_pool.h"
+
+#include <glm/geometric.hpp>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <cassert>
+
+
+#define BVH_BIN_COUNT 16
+#define BVH_MAX_LEAF_SIZE 8
+#define BVH_TRAVERSAL_COST 1.0f    // relative to one triangle test
+#define BVH_STACK_SIZE 256
+// ranges this deep become leaves whatever their size, traversal keeps at most one entry per level
+#define BVH_MAX_DEPTH BVH_STACK_SIZE
+
+
+struct BuildPrim {
+    glm::vec3 min;
+    glm::vec3 max;
+    glm::vec3 centroid;
+    u32 index;      // into the unordered triangle list
+};
+
+
+static AABB empty_aabb() {
+    return {glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX)};
+}
+
+
+static u32 bin_of(float centroid, float min, float scale) {
+    return std::min(u32((centroid - min) * scale), u32(BVH_BIN_COUNT - 1));
+}
+
+
+// bounds of prims[begin, end) and the partition point for its children, end when it should be a leaf
+static u32 sah_split(BuildPrim* prims, u32 begin, u32 end, AABB& bounds) {
+    bounds = empty_aabb();
+    AABB centroid_bounds = empty_aabb();
+    for(u32 i = begin; i < end; ++i) {
+        bounds.min = glm::min(bounds.min, prims[i].min);
+        bounds.max = glm::max(bounds.max, prims[i].max);
+        centroid_bounds.min = glm::min(centroid_bounds.min, prims[i].centroid);
+        centroid_bounds.max = glm::max(centroid_bounds.max, prims[i].centroid);
+    }
+
+    const u32 count = end - begin;
+    if(count <= 2)
+        return end;
+
+    // all three axes are binned in one pass over the prims
+    float scale[3];
+    AABB bins[3][BVH_BIN_COUNT];
+    u32 bin_counts[3][BVH_BIN_COUNT] = {};
+    for(u32 axis = 0; axis < 3; ++axis) {
+        const float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+        scale[axis] = extent > 0 ? BVH_BIN_COUNT / extent : 0.0f;
+        for(auto& bin : bins[axis])
+            bin = empty_aabb();
+    }
+    for(u32 i = begin; i < end; ++i) {
+        for(u32 axis = 0; axis < 3; ++axis) {
+            const u32 b = bin_of(prims[i].centroid[axis], centroid_bounds.min[axis], scale[axis]);
+            bins[axis][b].min = glm::min(bins[axis][b].min, prims[i].min);
+            bins[axis][b].max = glm::max(bins[axis][b].max, prims[i].max);
+            ++bin_counts[axis][b];
+        }
+    }
+
+    float best_cost = FLT_MAX;
+    u32 best_axis = 0, best_bin = 0;
+    for(u32 axis = 0; axis < 3; ++axis) {
+        if(scale[axis] == 0.0f)
+            continue;
+
+        // sweep from the right for the cost of everything right of each plane
+        float right_cost[BVH_BIN_COUNT];
+        AABB right = empty_aabb();
+        u32 right_count = 0;
+        for(u32 b = BVH_BIN_COUNT - 1; b > 0; --b) {
+            right = right.merged(bins[axis][b]);
+            right_count += bin_counts[axis][b];
+            right_cost[b] = right_count ? right.surface_area() * float(right_count) : 0.0f;
+        }
+
+        AABB left = empty_aabb();
+        u32 left_count = 0;
+        for(u32 b = 0; b + 1 < BVH_BIN_COUNT; ++b) {
+            left = left.merged(bins[axis][b]);
+            left_count += bin_counts[axis][b];
+            if(left_count == 0 || left_count == count)
+                continue;
+            const float cost = left.surface_area() * float(left_count) + right_cost[b + 1];
+            if(cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = b;
+            }
+        }
+    }
+
+    const float area = bounds.surface_area();
+    const float leaf_cost = area * float(count);
+    if(best_cost == FLT_MAX || BVH_TRAVERSAL_COST * area + best_cost >= leaf_cost) {
+        if(count <= BVH_MAX_LEAF_SIZE)
+            return end;
+        if(best_cost == FLT_MAX) {
+            // coincident centroids, any split is as good as another
+            return begin + count / 2;
+        }
+    }
+
+    const auto mid = std::partition(prims + begin, prims + end, [&](const BuildPrim& prim) {
+        return bin_of(prim.centroid[best_axis], centroid_bounds.min[best_axis], scale[best_axis]) <= best_bin;
+    });
+    return u32(mid - prims);
+}
+
+
+// depth first into nodes, child indices relative to the start of nodes
+static void build_subtree(BuildPrim* prims, u32 begin, u32 end, u32 depth, std::vector<BvhNode>& nodes) {
+    AABB bounds;
+    const u32 mid = sah_split(prims, begin, end, bounds);
+    const u32 node = u32(nodes.size());
+    nodes.push_back(BvhNode{bounds.min, begin, bounds.max, end - begin});
+    if(mid == end || depth >= BVH_MAX_DEPTH)
+        return;
+
+    nodes[node].count = 0;
+    build_subtree(prims, begin, mid, depth + 1, nodes);
+    nodes[node].first = u32(nodes.size());
+    build_subtree(prims, mid, end, depth + 1, nodes);
+}
+
+
+// the top of the tree, split serially until the ranges are small enough to hand out as tasks
+struct TopNode {
+    AABB bounds;
+    i32 left = -1;
+    i32 right = -1;
+    i32 task = -1;
+};
+
+struct BuildTask {
+    u32 begin, end;
+    u32 depth;
+    std::vector<BvhNode> nodes;
+};
+
+
+static i32 split_top(BuildPrim* prims, u32 begin, u32 end, u32 depth, u32 task_size, std::vector<TopNode>& top, std::vector<BuildTask>& tasks) {
+    const i32 index = i32(top.size());
+    top.emplace_back();
+    if(end - begin <= task_size) {
+        top[index].task = i32(tasks.size());
+        tasks.push_back(BuildTask{begin, end, depth, {}});
+        return index;
+    }
+
+    AABB bounds;
+    const u32 mid = sah_split(prims, begin, end, bounds);
+    top[index].bounds = bounds;
+    if(mid == end || depth >= BVH_MAX_DEPTH) {
+        top[index].task = i32(tasks.size());
+        tasks.push_back(BuildTask{begin, end, depth, {}});
+        return index;
+    }
+
+    const i32 left = split_top(prims, begin, mid, depth + 1, task_size, top, tasks);
+    const i32 right = split_top(prims, mid, end, depth + 1, task_size, top, tasks);
+    top[index].left = left;
+    top[index].right = right;
+    return index;
+}
+
+
+static void emit_top(const std::vector<TopNode>& top, i32 index, std::vector<BuildTask>& tasks, std::vector<BvhNode>& nodes) {
+    const auto& node = top[index];
+    if(node.task >= 0) {
+        const u32 offset = u32(nodes.size());
+        for(auto built : tasks[node.task].nodes) {
+            if(built.count == 0)
+                built.first += offset;
+            nodes.push_back(built);
+        }
+        tasks[node.task].nodes = {};
+        return;
+    }
+
+    const u32 parent = u32(nodes.size());
+    nodes.push_back(BvhNode{node.bounds.min, 0, node.bounds.max, 0});
+    emit_top(top, node.left, tasks, nodes);
+    nodes[parent].first = u32(nodes.size());
+    emit_top(top, node.right, tasks, nodes);
+}
+
+
+Bvh Bvh::build(const std::vector<BvhMeshInput>& meshes, ThreadPool* pool) {
+    const auto start_time = std::chrono::steady_clock::now();
+    const auto for_each = [&](u32 count, const std::function<void(u32)>& fn) {
+        if(pool) {
+            pool->parallel_for(count, fn);
+        }
+        else {
+            for(u32 i = 0; i < count; ++i)
+                fn(i);
+        }
+    };
+
+    std::vector<u32> first_triangle(meshes.size() + 1, 0);
+    for(size_t m = 0; m < meshes.size(); ++m)
+        first_triangle[m + 1] = first_triangle[m] + meshes[m].index_count / 3;
+    const u32 triangle_count = first_triangle.back();
+
+    Bvh result;
+    if(triangle_count == 0)
+        return result;
+
+    std::vector<BvhTriangle> unordered(triangle_count);
+    std::vector<BuildPrim> prims(triangle_count);
+    for_each(u32(meshes.size()), [&](u32 m) {
+        const auto& mesh = meshes[m];
+        const auto index = [&](u32 i) {
+            return mesh.index_size == 4 ? static_cast<const u32*>(mesh.indices)[i] : u32(static_cast<const u16*>(mesh.indices)[i]);
+        };
+        for(u32 t = 0; t < mesh.index_count / 3; ++t) {
+            const glm::vec3 a = mesh.vertices[index(t * 3)].position;
+            const glm::vec3 b = mesh.vertices[index(t * 3 + 1)].position;
+            const glm::vec3 c = mesh.vertices[index(t * 3 + 2)].position;
+            const u32 i = first_triangle[m] + t;
+            unordered[i] = BvhTriangle{a, b - a, c - a, m, t, 0};
+            const glm::vec3 min = glm::min(a, glm::min(b, c));
+            const glm::vec3 max = glm::max(a, glm::max(b, c));
+            prims[i] = BuildPrim{min, max, (min + max) * 0.5f, i};
+        }
+    });
+
+    // enough tasks to balance uneven subtrees across the threads
+    const u32 thread_count = pool ? pool->worker_count() + 1 : 1;
+    const u32 task_size = thread_count > 1 ? std::max(triangle_count / (thread_count * 8), 4096u) : triangle_count;
+    std::vector<TopNode> top;
+    std::vector<BuildTask> tasks;
+    split_top(prims.data(), 0, triangle_count, 0, task_size, top, tasks);
+    for_each(u32(tasks.size()), [&](u32 i) {
+        tasks[i].nodes.reserve(size_t(tasks[i].end - tasks[i].begin) / 2);
+        build_subtree(prims.data(), tasks[i].begin, tasks[i].end, tasks[i].depth, tasks[i].nodes);
+    });
+
+    result.nodes.reserve(size_t(triangle_count) / 2);
+    emit_top(top, 0, tasks, result.nodes);
+    result.nodes.shrink_to_fit();
+
+    result.triangles.resize(triangle_count);
+    for_each((triangle_count + 65535) / 65536, [&](u32 chunk) {
+        const u32 end = std::min(triangle_count, (chunk + 1) * 65536);
+        for(u32 i = chunk * 65536; i < end; ++i)
+            result.triangles[i] = unordered[prims[i].index];
+    });
+
+    result.build_time = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+    return result;
+}
+
+
+void RayPacket::push(const Ray& ray) {
+    for(u32 axis = 0; axis < 3; ++axis) {
+        origin[axis][count] = ray.origin[axis];
+        direction[axis][count] = ray.direction[axis];
+    }
+    t_max[count] = ray.t_max;
+    ++count;
+}
+
+
+// entry distance into the node, FLT_MAX when the ray misses it before t_max
+static float intersect_node(const BvhNode& node, const glm::vec3& origin, const glm::vec3& inv_dir, float t_max) {
+    const glm::vec3 t0 = (node.min - origin) * inv_dir;
+    const glm::vec3 t1 = (node.max - origin) * inv_dir;
+    const glm::vec3 near = glm::min(t0, t1);
+    const glm::vec3 far = glm::max(t0, t1);
+    const float enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+    const float exit = std::min(std::min(far.x, far.y), std::min(far.z, t_max));
+    return enter <= exit ? enter : FLT_MAX;
+}
+
+
+// two sided, the models have inconsistent winding
+static bool intersect_triangle(const BvhTriangle& tri, const glm::vec3& origin, const glm::vec3& dir, float& t, float& u, float& v) {
+    const glm::vec3 p = glm::cross(dir, tri.e2);
+    const float det = glm::dot(tri.e1, p);
+    if(std::abs(det) < 1e-12f)
+        return false;
+    const float inv_det = 1.0f / det;
+    const glm::vec3 s = origin - tri.v0;
+    u = glm::dot(s, p) * inv_det;
+    if(u < 0.0f || u > 1.0f)
+        return false;
+    const glm::vec3 q = glm::cross(s, tri.e1);
+    v = glm::dot(dir, q) * inv_det;
+    if(v < 0.0f || u + v > 1.0f)
+        return false;
+    t = glm::dot(tri.e2, q) * inv_det;
+    return t > 0.0f;
+}
+
+
+static glm::vec3 inverse_direction(const glm::vec3& dir) {
+    // a zero component becomes a huge slope instead of inf, so 0 * inf can't produce nan
+    const auto inv = [](float d) { return 1.0f / (std::abs(d) > 1e-20f ? d : std::copysign(1e-20f, d)); };
+    return {inv(dir.x), inv(dir.y), inv(dir.z)};
+}
+
+
+bool Bvh::intersect(const Ray& ray, RayHit& hit) const {
+    if(nodes.empty())
+        return false;
+
+    const glm::vec3 inv_dir = inverse_direction(ray.direction);
+    float t_max = std::min(ray.t_max, hit.t);
+    if(intersect_node(nodes[0], ray.origin, inv_dir, t_max) == FLT_MAX)
+        return false;
+
+    bool found = false;
+    u32 stack[BVH_STACK_SIZE];
+    u32 stack_size = 0;
+    u32 current = 0;
+    while(true) {
+        const auto& node = nodes[current];
+        if(node.count > 0) {
+            for(u32 i = node.first; i < node.first + node.count; ++i) {
+                float t, u, v;
+                if(intersect_triangle(triangles[i], ray.origin, ray.direction, t, u, v) && t < t_max) {
+                    t_max = t;
+                    hit = RayHit{t, triangles[i].mesh, triangles[i].triangle, u, v};
+                    found = true;
+                }
+            }
+        }
+        else {
+            // nearer child first, the other one waits on the stack
+            u32 near = current + 1, far = node.first;
+            float t_near = intersect_node(nodes[near], ray.origin, inv_dir, t_max);
+            float t_far = intersect_node(nodes[far], ray.origin, inv_dir, t_max);
+            if(t_far < t_near) {
+                std::swap(near, far);
+                std::swap(t_near, t_far);
+            }
+            if(t_near != FLT_MAX) {
+                if(t_far != FLT_MAX) {
+                    assert(stack_size < BVH_STACK_SIZE && "bvh deeper than BVH_MAX_DEPTH");
+                    stack[stack_size++] = far;
+                }
+                current = near;
+                continue;
+            }
+        }
+
+        if(stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+    return found;
+}
+
+
+void Bvh::intersect(const RayPacket& packet, RayHit* hits) const {
+    if(nodes.empty() || packet.count == 0)
+        return;
+
+    glm::vec3 origin[BVH_PACKET_SIZE], dir[BVH_PACKET_SIZE], inv_dir[BVH_PACKET_SIZE];
+    float t_max[BVH_PACKET_SIZE];
+    for(u32 r = 0; r < packet.count; ++r) {
+        origin[r] = {packet.origin[0][r], packet.origin[1][r], packet.origin[2][r]};
+        dir[r] = {packet.direction[0][r], packet.direction[1][r], packet.direction[2][r]};
+        inv_dir[r] = inverse_direction(dir[r]);
+        t_max[r] = std::min(packet.t_max[r], hits[r].t);
+    }
+
+    // first ray entering the node, rays before first_active already missed its parent
+    const auto first_hit = [&](const BvhNode& node, u32 first_active) {
+        for(u32 r = first_active; r < packet.count; ++r)
+            if(intersect_node(node, origin[r], inv_dir[r], t_max[r]) != FLT_MAX)
+                return r;
+        return packet.count;
+    };
+
+    struct Entry {
+        u32 node;
+        u32 first_active;
+    };
+    Entry stack[BVH_STACK_SIZE];
+    u32 stack_size = 0;
+    Entry current{0, first_hit(nodes[0], 0)};
+    if(current.first_active == packet.count)
+        return;
+
+    while(true) {
+        const auto& node = nodes[current.node];
+        if(node.count > 0) {
+            for(u32 i = node.first; i < node.first + node.count; ++i) {
+                const auto& tri = triangles[i];
+                for(u32 r = current.first_active; r < packet.count; ++r) {
+                    float t, u, v;
+                    if(intersect_triangle(tri, origin[r], dir[r], t, u, v) && t < t_max[r]) {
+                        t_max[r] = t;
+                        hits[r] = RayHit{t, tri.mesh, tri.triangle, u, v};
+                    }
+                }
+            }
+        }
+        else {
+            // the packet is coherent, the child the first active ray reaches first goes first
+            u32 near = current.node + 1, far = node.first;
+            const glm::vec3 offset = (nodes[far].min + nodes[far].max) - (nodes[near].min + nodes[near].max);
+            if(glm::dot(offset, dir[current.first_active]) < 0.0f)
+                std::swap(near, far);
+            const u32 near_first = first_hit(nodes[near], current.first_active);
+            const u32 far_first = first_hit(nodes[far], current.first_active);
+            if(near_first < packet.count) {
+                if(far_first < packet.count) {
+                    assert(stack_size < BVH_STACK_SIZE && "bvh deeper than BVH_MAX_DEPTH");
+                    stack[stack_size++] = Entry{far, far_first};
+                }
+                current = Entry{near, near_first};
+                continue;
+            }
+            if(far_first < packet.count) {
+                current = Entry{far, far_first};
+                continue;
+            }
+        }
+
+        if(stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "../types.h"
+#include "aabb.h"
+
+#include <glm/vec3.hpp>
+
+#include <vector>
+#include <cfloat>
+
+
+class ThreadPool;
+struct Vertex;
+
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;    // needn't be normalized, t is measured in its length
+    float t_max = FLT_MAX;
+};
+
+
+struct RayHit {
+    float t = FLT_MAX;
+    u32 mesh = UINT32_MAX;      // index into the meshes the bvh was built from
+    u32 triangle = UINT32_MAX;  // within that mesh
+    float u = 0, v = 0;         // barycentric weights of the triangle's second and third corner
+
+    bool hit() const { return mesh != UINT32_MAX; }
+};
+
+
+#define BVH_PACKET_SIZE 16
+
+// up to BVH_PACKET_SIZE coherent rays as structure of arrays, best when they share an origin
+struct RayPacket {
+    float origin[3][BVH_PACKET_SIZE];
+    float direction[3][BVH_PACKET_SIZE];
+    float t_max[BVH_PACKET_SIZE];
+    u32 count = 0;
+
+    void push(const Ray& ray);
+};
+
+
+// geometry to build over, only the first index_count indices are used (the full detail level)
+struct BvhMeshInput {
+    const Vertex* vertices;
+    const void* indices;
+    u32 index_size;     // 2 or 4
+    u32 index_count;
+};
+
+
+// 32 bytes, nodes are stored depth first so a left child always follows its parent
+struct BvhNode {
+    glm::vec3 min;
+    u32 first;  // leaves: first triangle, interior nodes: right child
+    glm::vec3 max;
+    u32 count;  // triangles in a leaf, 0 for interior nodes
+};
+
+
+// precomputed for Moller-Trumbore, triangles are reordered so every leaf is one contiguous run
+struct BvhTriangle {
+    glm::vec3 v0;
+    glm::vec3 e1;   // v1 - v0
+    glm::vec3 e2;   // v2 - v0
+    u32 mesh;
+    u32 triangle;
+    u32 _pad0;
+};
+
+
+// Bounding volume hierarchy over triangles, split by the surface area heuristic with binning.
+// The top levels are split on the calling thread, the subtrees below are built in parallel.
+class Bvh final {
+public:
+    // null pool builds on the calling thread
+    static Bvh build(const std::vector<BvhMeshInput>& meshes, ThreadPool* pool);
+
+    // closest hit closer than ray.t_max and hit.t, returns whether hit was updated
+    bool intersect(const Ray& ray, RayHit& hit) const;
+    // closest hit for each ray of the packet, hits has packet.count entries
+    void intersect(const RayPacket& packet, RayHit* hits) const;
+
+    AABB bounds() const { return nodes.empty() ? AABB{} : AABB{nodes[0].min, nodes[0].max}; }
+    u32 node_count() const { return u32(nodes.size()); }
+    u32 triangle_count() const { return u32(triangles.size()); }
+    u64 size_bytes() const { return nodes.size() * sizeof(BvhNode) + triangles.size() * sizeof(BvhTriangle); }
+    float build_ms() const { return build_time; }
+
+private:
+    std::vector<BvhNode> nodes;
+    std::vector<BvhTriangle> triangles;
+    float build_time = 0;
+};
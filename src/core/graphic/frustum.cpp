@@ -0,0 +1,160 @@
+#include "frustum.h"
+
+#include <glm/geometric.hpp>
+#include <glm/matrix.hpp>
+
+#include <cmath>
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+    #define FRUSTUM_CULL_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define FRUSTUM_CULL_SSE 1
+#endif
+
+
+Frustum Frustum::from_matrix(const glm::mat4& m) {
+    // Gribb-Hartmann, glm is column major so rows are gathered across columns
+    const auto row = [&](int i) { return glm::vec4{m[0][i], m[1][i], m[2][i], m[3][i]}; };
+
+    Frustum f;
+    f.planes[Left]   = row(3) + row(0);
+    f.planes[Right]  = row(3) - row(0);
+    f.planes[Bottom] = row(3) + row(1);
+    f.planes[Top]    = row(3) - row(1);
+    f.planes[Near]   = row(2);
+    f.planes[Far]    = row(3) - row(2);
+
+    for(auto& plane : f.planes)
+        plane /= glm::length(glm::vec3(plane));
+
+    return f;
+}
+
+
+bool Frustum::intersects(const AABB& box) const {
+    for(const auto& plane : planes) {
+        // corner of the box furthest along the plane normal
+        const glm::vec3 p{
+            plane.x >= 0 ? box.max.x : box.min.x,
+            plane.y >= 0 ? box.max.y : box.min.y,
+            plane.z >= 0 ? box.max.z : box.min.z,
+        };
+        if(glm::dot(glm::vec3(plane), p) + plane.w < 0)
+            return false;
+    }
+    return true;
+}
+
+
+void AabbSoA::push_back(const AABB& box) {
+    if(count % BATCH == 0) {
+        // a negative extent pulls the box behind every plane
+        for(auto* v : {&center_x, &center_y, &center_z})
+            v->resize(v->size() + BATCH, 0.0f);
+        for(auto* v : {&extent_x, &extent_y, &extent_z})
+            v->resize(v->size() + BATCH, -1e30f);
+    }
+
+    const glm::vec3 c = box.center();
+    const glm::vec3 e = box.extent() * 0.5f;
+    center_x[count] = c.x;
+    center_y[count] = c.y;
+    center_z[count] = c.z;
+    extent_x[count] = e.x;
+    extent_y[count] = e.y;
+    extent_z[count] = e.z;
+    ++count;
+}
+
+
+void AabbSoA::clear() {
+    for(auto* v : {&center_x, &center_y, &center_z, &extent_x, &extent_y, &extent_z})
+        v->clear();
+    count = 0;
+}
+
+
+u32 cull_boxes(const Frustum& frustum, const glm::mat4& model, const AabbSoA& boxes, std::vector<u32>& visible) {
+    // bring the planes to the boxes instead of every box to the planes, dot(p, M * x) = dot(transpose(M) * p, x),
+    // scaling the normal scales the distance and the projected extent alike so the test needs no normalization
+    const glm::mat4 to_model = glm::transpose(model);
+    glm::vec4 planes[Frustum::PlaneCount];
+    for(int i = 0; i < Frustum::PlaneCount; ++i)
+        planes[i] = to_model * frustum.planes[i];
+
+    // every lane writes its index and only visible lanes advance, padding is never visible
+    const size_t padded = boxes.center_x.size();
+    visible.resize(padded);
+    u32 n = 0;
+
+#if defined(FRUSTUM_CULL_AVX)
+    for(size_t i = 0; i < padded; i += 8) {
+        const __m256 cx = _mm256_loadu_ps(&boxes.center_x[i]);
+        const __m256 cy = _mm256_loadu_ps(&boxes.center_y[i]);
+        const __m256 cz = _mm256_loadu_ps(&boxes.center_z[i]);
+        const __m256 ex = _mm256_loadu_ps(&boxes.extent_x[i]);
+        const __m256 ey = _mm256_loadu_ps(&boxes.extent_y[i]);
+        const __m256 ez = _mm256_loadu_ps(&boxes.extent_z[i]);
+
+        __m256 outside = _mm256_setzero_ps();
+        for(const auto& p : planes) {
+            // signed distance of the center plus the box's radius along the normal
+            __m256 d = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(p.x), cx), _mm256_set1_ps(p.w));
+            d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(p.y), cy));
+            d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(p.z), cz));
+            d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(std::fabs(p.x)), ex));
+            d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(std::fabs(p.y)), ey));
+            d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(std::fabs(p.z)), ez));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_LT_OQ));
+        }
+
+        const u32 mask = ~(u32)_mm256_movemask_ps(outside);
+        for(u32 j = 0; j < 8; ++j) {
+            visible[n] = u32(i + j);
+            n += (mask >> j) & 1;
+        }
+    }
+#elif defined(FRUSTUM_CULL_SSE)
+    for(size_t i = 0; i < padded; i += 4) {
+        const __m128 cx = _mm_loadu_ps(&boxes.center_x[i]);
+        const __m128 cy = _mm_loadu_ps(&boxes.center_y[i]);
+        const __m128 cz = _mm_loadu_ps(&boxes.center_z[i]);
+        const __m128 ex = _mm_loadu_ps(&boxes.extent_x[i]);
+        const __m128 ey = _mm_loadu_ps(&boxes.extent_y[i]);
+        const __m128 ez = _mm_loadu_ps(&boxes.extent_z[i]);
+
+        __m128 outside = _mm_setzero_ps();
+        for(const auto& p : planes) {
+            __m128 d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.x), cx), _mm_set1_ps(p.w));
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(p.y), cy));
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(p.z), cz));
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(std::fabs(p.x)), ex));
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(std::fabs(p.y)), ey));
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(std::fabs(p.z)), ez));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(d, _mm_setzero_ps()));
+        }
+
+        const u32 mask = ~(u32)_mm_movemask_ps(outside);
+        for(u32 j = 0; j < 4; ++j) {
+            visible[n] = u32(i + j);
+            n += (mask >> j) & 1;
+        }
+    }
+#else
+    for(size_t i = 0; i < padded; ++i) {
+        bool inside = true;
+        for(const auto& p : planes) {
+            const float d = p.x * boxes.center_x[i] + p.y * boxes.center_y[i] + p.z * boxes.center_z[i] + p.w
+                          + std::fabs(p.x) * boxes.extent_x[i] + std::fabs(p.y) * boxes.extent_y[i] + std::fabs(p.z) * boxes.extent_z[i];
+            inside = inside && d >= 0.0f;
+        }
+        visible[n] = u32(i);
+        n += inside ? 1 : 0;
+    }
+#endif
+
+    visible.resize(n);
+    return n;
+}
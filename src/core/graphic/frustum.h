@@ -0,0 +1,42 @@
+#pragma once
+
+#include "../types.h"
+#include "aabb.h"
+
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <vector>
+#include <cstddef>
+
+
+// world space view frustum, planes point inwards: dot(plane.xyz, p) + plane.w >= 0 means inside
+struct Frustum {
+    enum Plane { Left, Right, Bottom, Top, Near, Far, PlaneCount };
+
+    glm::vec4 planes[PlaneCount];
+
+    // expects a left-handed, zero-to-one depth projection (see Camera::perspective)
+    static Frustum from_matrix(const glm::mat4& view_proj);
+
+    // conservative: may report boxes near frustum corners as visible
+    bool intersects(const AABB& box) const;
+};
+
+
+// boxes as center and half extent per axis in separate arrays so planes are tested against
+// a batch at once, padded to a multiple of BATCH with boxes that are outside every frustum
+struct AabbSoA {
+    static constexpr size_t BATCH = 8;
+
+    std::vector<float> center_x, center_y, center_z;
+    std::vector<float> extent_x, extent_y, extent_z;
+    u32 count = 0;
+
+    void push_back(const AABB& box);
+    void clear();
+};
+
+// writes the indices of boxes that intersect the frustum to `visible` and returns how many,
+// `model` takes the boxes to the frustum's space. Uses AVX when compiled with it, SSE otherwise
+u32 cull_boxes(const Frustum& frustum, const glm::mat4& model, const AabbSoA& boxes, std::vector<u32>& visible);
@@ -0,0 +1,35 @@
+#include "image_writer.h"
+
+#include <fstream>
+#include <vector>
+
+
+bool write_tga(const std::string& filename, u32 width, u32 height, const u8* rgba, bool bottom_up) {
+    if(width == 0 || height == 0 || width > 0xffff || height > 0xffff)
+        return false;
+    std::ofstream file(filename, std::ios::binary);
+    if(!file)
+        return false;
+
+    u8 header[18] = {};
+    header[2] = 2;  // uncompressed true color
+    header[12] = u8(width);
+    header[13] = u8(width >> 8);
+    header[14] = u8(height);
+    header[15] = u8(height >> 8);
+    header[16] = 24;
+    header[17] = bottom_up ? 0 : 0x20;  // origin at the top left
+    file.write((const char*)header, sizeof(header));
+
+    std::vector<u8> row(size_t(width) * 3);
+    for(u32 y = 0; y < height; ++y) {
+        const u8* src = rgba + size_t(y) * width * 4;
+        for(u32 x = 0; x < width; ++x) {
+            row[x * 3 + 0] = src[x * 4 + 2];
+            row[x * 3 + 1] = src[x * 4 + 1];
+            row[x * 3 + 2] = src[x * 4 + 0];
+        }
+        file.write((const char*)row.data(), row.size());
+    }
+    return bool(file);
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "../types.h"
+
+#include <string>
+
+
+// Uncompressed 24 bit TGA from tightly packed rgba8 rows, alpha is dropped. Rows go top to bottom
+// unless bottom_up. Returns false when the file can't be written.
+bool write_tga(const std::string& filename, u32 width, u32 height, const u8* rgba, bool bottom_up = false);
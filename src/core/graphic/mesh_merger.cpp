@@ -0,0 +1,148 @@
+#include "mesh_merger.h"
+#include "model.h"
+#include <algorithm>
+#include <unordered_map>
+#include <cstring>
+
+
+// spreads the low 10 bits of v so two zero bits follow every bit
+static u32 spread_bits(u32 v) {
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+
+static u32 morton_code(const glm::vec3& p, const AABB& bounds) {
+    const auto extent = glm::max(bounds.extent(), glm::vec3(1e-6f));
+    const auto cell = glm::clamp((p - bounds.min) / extent, glm::vec3(0.0f), glm::vec3(1.0f)) * 1023.0f;
+    return (spread_bits(u32(cell.x)) << 2) | (spread_bits(u32(cell.y)) << 1) | spread_bits(u32(cell.z));
+}
+
+
+struct DiffuseKey {
+    u32 bits[4];
+
+    bool operator==(const DiffuseKey& other) const { return std::memcmp(bits, other.bits, sizeof(bits)) == 0; }
+};
+
+struct DiffuseKeyHash {
+    size_t operator()(const DiffuseKey& key) const {
+        u64 hash = 14695981039346656037ull;
+        for(const auto bits : key.bits)
+            hash = (hash ^ bits) * 1099511628211ull;
+        return size_t(hash);
+    }
+};
+
+
+static MeshData merge_batch(std::vector<MeshData>& meshes, const std::vector<u32>& batch) {
+    if(batch.size() == 1)
+        return std::move(meshes[batch[0]]);
+
+    MeshData result;
+    result.diffuse = meshes[batch[0]].diffuse;
+    result.aabb = meshes[batch[0]].aabb;
+
+    size_t vertex_count = 0, index_count = 0;
+    u32 lod_count = 1;
+    for(const auto i : batch) {
+        vertex_count += meshes[i].vertices.size();
+        index_count += meshes[i].indices.size();
+        lod_count = std::max(lod_count, u32(std::max<size_t>(meshes[i].lods.size(), 1)));
+    }
+    result.vertices.reserve(vertex_count);
+    result.indices.reserve(index_count);
+    result.lods.resize(lod_count);
+
+    // vertex offset of every mesh in the batch
+    std::vector<u32> base;
+    base.reserve(batch.size());
+    for(const auto i : batch) {
+        base.push_back(u32(result.vertices.size()));
+        result.vertices.insert(result.vertices.end(), meshes[i].vertices.begin(), meshes[i].vertices.end());
+        result.aabb = result.aabb.merged(meshes[i].aabb);
+    }
+
+    for(u32 lod = 0; lod < lod_count; ++lod) {
+        auto& range = result.lods[lod];
+        range.index_offset = u32(result.indices.size());
+        range.error = 0.0f;
+        for(size_t b = 0; b < batch.size(); ++b) {
+            const auto& mesh = meshes[batch[b]];
+            MeshLod source{0, u32(mesh.indices.size()), 0.0f};
+            if(!mesh.lods.empty())
+                source = mesh.lods[std::min<size_t>(lod, mesh.lods.size() - 1)];
+
+            const auto* first = mesh.indices.data() + source.index_offset;
+            for(u32 k = 0; k < source.index_count; ++k)
+                result.indices.push_back(first[k] + base[b]);
+            range.error = std::max(range.error, source.error);
+        }
+        range.index_count = u32(result.indices.size()) - range.index_offset;
+    }
+
+    for(const auto i : batch)
+        meshes[i] = MeshData();
+    return result;
+}
+
+
+std::vector<MeshData> merge_meshes(std::vector<MeshData>&& meshes, size_t max_vertices) {
+    if(meshes.size() < 2)
+        return std::move(meshes);
+
+    AABB bounds = meshes[0].aabb;
+    for(const auto& mesh : meshes)
+        bounds = bounds.merged(mesh.aabb);
+
+    // materials in order of first use, so the output doesn't depend on hashing
+    std::unordered_map<DiffuseKey, u32, DiffuseKeyHash> material_lookup;
+    std::vector<u32> material(meshes.size());
+    for(size_t i = 0; i < meshes.size(); ++i) {
+        DiffuseKey key;
+        std::memcpy(key.bits, &meshes[i].diffuse, sizeof(key.bits));
+        material[i] = material_lookup.try_emplace(key, u32(material_lookup.size())).first->second;
+    }
+
+    // grouped by material, then along the curve
+    std::vector<u64> order(meshes.size());
+    for(size_t i = 0; i < meshes.size(); ++i)
+        order[i] = u64(material[i]) << 32 | morton_code(meshes[i].aabb.center(), bounds);
+    std::vector<u32> sorted(meshes.size());
+    for(u32 i = 0; i < sorted.size(); ++i)
+        sorted[i] = i;
+    std::stable_sort(sorted.begin(), sorted.end(), [&](u32 a, u32 b) { return order[a] < order[b]; });
+
+    std::vector<MeshData> result;
+    std::vector<u32> batch;
+    size_t batch_vertices = 0;
+    const auto flush = [&]() {
+        if(!batch.empty())
+            result.emplace_back(merge_batch(meshes, batch));
+        batch.clear();
+        batch_vertices = 0;
+    };
+
+    for(size_t s = 0; s < sorted.size(); ++s) {
+        const auto i = sorted[s];
+        if(s > 0 && material[i] != material[sorted[s - 1]])
+            flush();
+
+        const auto vertex_count = meshes[i].vertices.size();
+        if(vertex_count > max_vertices) {
+            result.emplace_back(std::move(meshes[i]));
+            continue;
+        }
+        if(batch_vertices + vertex_count > max_vertices)
+            flush();
+        batch.push_back(i);
+        batch_vertices += vertex_count;
+    }
+    flush();
+
+    return result;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "../types.h"
+
+#include <vector>
+#include <cstddef>
+
+
+// Concatenates static meshes with the same material into batches of at most max_vertices,
+// so they draw with one call each. Vertices are already in model space, only indices are rebased.
+// Meshes are ordered along a morton curve first so every batch stays spatially compact.
+// Levels of detail are merged level by level, meshes with fewer levels repeat their coarsest one.
+// Meshes larger than max_vertices pass through untouched.
+std::vector<struct MeshData> merge_meshes(std::vector<struct MeshData>&& meshes, size_t max_vertices = UINT16_MAX + 1);
@@ -0,0 +1,283 @@
+#include "mesh_optimizer.h"
+#include "model.h"
+#include <glm/geometric.hpp>
+#include <algorithm>
+#include <cmath>
+
+
+// fifo cache, a vertex is cached while fewer than cache_size misses happened since it was loaded
+struct FifoCache {
+    std::vector<u64> loaded_at;
+    u64 time;
+    u32 size;
+
+    FifoCache(size_t vertex_count, u32 cache_size) : loaded_at(vertex_count, 0), time(u64(cache_size) + 1), size(cache_size) {}
+
+    u32 access(u32 vertex) {
+        if(time - loaded_at[vertex] < size)
+            return 0;
+        loaded_at[vertex] = ++time;
+        return 1;
+    }
+
+    void reset() { time += u64(size) + 1; }
+};
+
+
+VertexCacheStats analyze_vertex_cache(const std::vector<u32>& indices, size_t vertex_count, u32 cache_size) {
+    VertexCacheStats result;
+    result.triangle_count = indices.size() / 3;
+    result.vertex_count = vertex_count;
+
+    FifoCache cache(vertex_count, cache_size);
+    for(const auto index : indices)
+        result.miss_count += cache.access(index);
+    return result;
+}
+
+
+#define FORSYTH_CACHE_SIZE 32
+#define FORSYTH_MAX_VALENCE 32
+
+struct ForsythScores {
+    float cache[FORSYTH_CACHE_SIZE];
+    float valence[FORSYTH_MAX_VALENCE + 1];
+
+    ForsythScores() {
+        for(u32 i = 0; i < FORSYTH_CACHE_SIZE; ++i) {
+            // the last triangle's vertices score a fixed amount so its neighbours aren't preferred over fanning out
+            cache[i] = i < 3 ? 0.75f : std::pow(1.0f - float(i - 3) / float(FORSYTH_CACHE_SIZE - 3), 1.5f);
+        }
+        valence[0] = 0;
+        for(u32 i = 1; i <= FORSYTH_MAX_VALENCE; ++i) {
+            // boosts vertices with few remaining triangles so they get finished off
+            valence[i] = 2.0f / std::sqrt(float(i));
+        }
+    }
+
+    float vertex(i32 cache_position, u32 active_triangles) const {
+        if(active_triangles == 0)
+            return -1.0f;
+        const float from_cache = cache_position >= 0 ? cache[cache_position] : 0.0f;
+        return from_cache + valence[std::min<u32>(active_triangles, FORSYTH_MAX_VALENCE)];
+    }
+};
+
+
+void optimize_vertex_cache(std::vector<u32>& indices, size_t vertex_count) {
+    static const ForsythScores scores;
+    const size_t triangle_count = indices.size() / 3;
+    if(triangle_count == 0)
+        return;
+
+    // triangles using each vertex, the first `active` of every list are not emitted yet
+    std::vector<u32> offsets(vertex_count + 1, 0);
+    for(const auto index : indices)
+        ++offsets[index + 1];
+    for(size_t v = 0; v < vertex_count; ++v)
+        offsets[v + 1] += offsets[v];
+    std::vector<u32> adjacency(indices.size());
+    std::vector<u32> active(vertex_count, 0);
+    for(size_t i = 0; i < indices.size(); ++i) {
+        const auto v = indices[i];
+        adjacency[offsets[v] + active[v]++] = u32(i / 3);
+    }
+
+    std::vector<i32> cache_position(vertex_count, -1);
+    std::vector<float> vertex_score(vertex_count);
+    for(size_t v = 0; v < vertex_count; ++v)
+        vertex_score[v] = scores.vertex(-1, active[v]);
+
+    std::vector<float> triangle_score(triangle_count);
+    std::vector<u8> emitted(triangle_count, 0);
+    u32 best = 0;
+    for(size_t t = 0; t < triangle_count; ++t) {
+        triangle_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+        if(triangle_score[t] > triangle_score[best])
+            best = u32(t);
+    }
+
+    std::vector<u32> result;
+    result.reserve(indices.size());
+    std::vector<u32> cache, next_cache;
+    cache.reserve(FORSYTH_CACHE_SIZE + 3);
+    next_cache.reserve(FORSYTH_CACHE_SIZE + 3);
+    size_t dead_end_cursor = 0;
+
+    while(true) {
+        const u32* tri = &indices[size_t(best) * 3];
+        emitted[best] = 1;
+        result.insert(result.end(), tri, tri + 3);
+
+        for(u32 k = 0; k < 3; ++k) {
+            const auto v = tri[k];
+            u32* list = &adjacency[offsets[v]];
+            const auto it = std::find(list, list + active[v], best);
+            std::swap(*it, list[--active[v]]);
+        }
+
+        // the triangle's vertices move to the front, everything else shifts back
+        next_cache.assign(tri, tri + 3);
+        for(const auto v : cache)
+            if(v != tri[0] && v != tri[1] && v != tri[2])
+                next_cache.push_back(v);
+
+        for(size_t i = 0; i < next_cache.size(); ++i) {
+            const auto v = next_cache[i];
+            cache_position[v] = i < FORSYTH_CACHE_SIZE ? i32(i) : -1;
+            vertex_score[v] = scores.vertex(cache_position[v], active[v]);
+        }
+
+        // only triangles touching the cache changed score
+        float best_score = -1.0f;
+        bool found = false;
+        for(const auto v : next_cache) {
+            for(u32 i = 0; i < active[v]; ++i) {
+                const auto t = adjacency[offsets[v] + i];
+                const u32* corners = &indices[size_t(t) * 3];
+                triangle_score[t] = vertex_score[corners[0]] + vertex_score[corners[1]] + vertex_score[corners[2]];
+                if(triangle_score[t] > best_score) {
+                    best_score = triangle_score[t];
+                    best = t;
+                    found = true;
+                }
+            }
+        }
+
+        if(next_cache.size() > FORSYTH_CACHE_SIZE)
+            next_cache.resize(FORSYTH_CACHE_SIZE);
+        std::swap(cache, next_cache);
+
+        if(!found) {
+            // dead end, continue with the next triangle in input order
+            while(dead_end_cursor < triangle_count && emitted[dead_end_cursor])
+                ++dead_end_cursor;
+            if(dead_end_cursor == triangle_count)
+                break;
+            best = u32(dead_end_cursor);
+        }
+    }
+
+    indices = std::move(result);
+}
+
+
+struct OverdrawCluster {
+    size_t first_triangle;
+    size_t triangle_count;
+    float sort_key;
+};
+
+void optimize_overdraw(std::vector<u32>& indices, const std::vector<Vertex>& vertices, float threshold) {
+    const size_t triangle_count = indices.size() / 3;
+    if(triangle_count == 0)
+        return;
+    const u32 cache_size = 16;
+
+    // hard boundaries where the cache restarted anyway: all three vertices missed
+    std::vector<size_t> hard;
+    {
+        FifoCache cache(vertices.size(), cache_size);
+        for(size_t t = 0; t < triangle_count; ++t) {
+            const u32 misses = cache.access(indices[t * 3]) + cache.access(indices[t * 3 + 1]) + cache.access(indices[t * 3 + 2]);
+            if(t == 0 || misses == 3)
+                hard.push_back(t);
+        }
+        hard.push_back(triangle_count);
+    }
+
+    // soft boundaries wherever restarting the cache costs less than threshold times the cluster's acmr
+    std::vector<OverdrawCluster> clusters;
+    FifoCache cache(vertices.size(), cache_size);
+    const auto access = [&](size_t t) {
+        return cache.access(indices[t * 3]) + cache.access(indices[t * 3 + 1]) + cache.access(indices[t * 3 + 2]);
+    };
+    for(size_t h = 0; h + 1 < hard.size(); ++h) {
+        const size_t begin = hard[h], end = hard[h + 1];
+
+        cache.reset();
+        u64 cluster_misses = 0;
+        for(size_t t = begin; t < end; ++t)
+            cluster_misses += access(t);
+        const float cluster_acmr = float(cluster_misses) / float(end - begin);
+
+        cache.reset();
+        size_t start = begin;
+        u64 misses = 0;
+        for(size_t t = begin; t < end; ++t) {
+            misses += access(t);
+            if(t + 1 < end && float(misses) <= threshold * cluster_acmr * float(t + 1 - start)) {
+                clusters.push_back({start, t + 1 - start, 0.0f});
+                start = t + 1;
+                misses = 0;
+                cache.reset();
+            }
+        }
+        clusters.push_back({start, end - start, 0.0f});
+    }
+
+    // area weighted centroid and normal of every cluster
+    std::vector<glm::vec3> centroids(clusters.size()), normals(clusters.size());
+    glm::vec3 mesh_centroid(0.0f);
+    float mesh_area = 0.0f;
+    for(size_t c = 0; c < clusters.size(); ++c) {
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for(size_t t = clusters[c].first_triangle; t < clusters[c].first_triangle + clusters[c].triangle_count; ++t) {
+            const auto& a = vertices[indices[t * 3]].position;
+            const auto& b = vertices[indices[t * 3 + 1]].position;
+            const auto& d = vertices[indices[t * 3 + 2]].position;
+            const auto n = glm::cross(b - a, d - a);
+            const float triangle_area = glm::length(n);
+            centroid += (a + b + d) * (triangle_area / 3.0f);
+            normal += n;
+            area += triangle_area;
+        }
+        mesh_centroid += centroid;
+        mesh_area += area;
+        centroids[c] = area > 0 ? centroid / area : centroid;
+        normals[c] = normal;
+    }
+    if(mesh_area > 0)
+        mesh_centroid /= mesh_area;
+
+    for(size_t c = 0; c < clusters.size(); ++c) {
+        const float length = glm::length(normals[c]);
+        clusters[c].sort_key = length > 0 ? glm::dot(centroids[c] - mesh_centroid, normals[c] / length) : 0.0f;
+    }
+    std::stable_sort(clusters.begin(), clusters.end(), [](const OverdrawCluster& a, const OverdrawCluster& b) {
+        return a.sort_key > b.sort_key;
+    });
+
+    std::vector<u32> result;
+    result.reserve(indices.size());
+    for(const auto& cluster : clusters) {
+        const auto* first = &indices[cluster.first_triangle * 3];
+        result.insert(result.end(), first, first + cluster.triangle_count * 3);
+    }
+    indices = std::move(result);
+}
+
+
+void optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<u32>& indices) {
+    std::vector<u32> remap(vertices.size(), UINT32_MAX);
+    u32 next = 0;
+    for(auto& index : indices) {
+        if(remap[index] == UINT32_MAX)
+            remap[index] = next++;
+        index = remap[index];
+    }
+
+    std::vector<Vertex> result(next);
+    for(size_t v = 0; v < vertices.size(); ++v)
+        if(remap[v] != UINT32_MAX)
+            result[remap[v]] = vertices[v];
+    vertices = std::move(result);
+}
+
+
+void optimize_mesh(MeshData& mesh) {
+    optimize_vertex_cache(mesh.indices, mesh.vertices.size());
+    optimize_overdraw(mesh.indices, mesh.vertices);
+    optimize_vertex_fetch(mesh.vertices, mesh.indices);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "../types.h"
+
+#include <vector>
+#include <cstddef>
+
+
+// post-transform vertex cache behaviour of an index buffer, simulated as a fifo on the cpu
+struct VertexCacheStats {
+    u64 triangle_count = 0;
+    u64 vertex_count = 0;
+    u64 miss_count = 0;
+
+    // average cache miss ratio, transformed vertices per triangle, 0.5 is ideal for grids, 3 the worst
+    float acmr() const { return triangle_count ? float(miss_count) / float(triangle_count) : 0.0f; }
+    // average transform to vertex ratio, 1 is ideal
+    float atvr() const { return vertex_count ? float(miss_count) / float(vertex_count) : 0.0f; }
+
+    VertexCacheStats& operator+=(const VertexCacheStats& other) {
+        triangle_count += other.triangle_count;
+        vertex_count += other.vertex_count;
+        miss_count += other.miss_count;
+        return *this;
+    }
+};
+
+VertexCacheStats analyze_vertex_cache(const std::vector<u32>& indices, size_t vertex_count, u32 cache_size = 16);
+
+
+// reorders triangles for vertex cache locality, Tom Forsyth's linear speed algorithm
+void optimize_vertex_cache(std::vector<u32>& indices, size_t vertex_count);
+
+// splits a cache optimized index buffer into clusters that cost at most `threshold` times
+// their original acmr, then orders the clusters so outward facing ones come first,
+// which roughly draws front to back from any viewpoint
+void optimize_overdraw(std::vector<u32>& indices, const std::vector<struct Vertex>& vertices, float threshold = 1.05f);
+
+// reorders vertices by first use so vertex fetches stay sequential, drops unused vertices
+void optimize_vertex_fetch(std::vector<struct Vertex>& vertices, std::vector<u32>& indices);
+
+// all of the above in order
+void optimize_mesh(struct MeshData& mesh);
@@ -0,0 +1,338 @@
+#include "mesh_simplifier.h"
+#include "mesh_optimizer.h"
+#include "model.h"
+#include <glm/geometric.hpp>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+
+// how far a level may deviate from the previous one, relative to the mesh diagonal
+#define LOD_MAX_ERROR 0.02f
+// a level has to drop at least this share of the previous level's triangles to be kept
+#define LOD_MIN_REDUCTION 0.2f
+
+
+// sum of squared distances to a set of weighted planes
+struct Quadric {
+    double a00 = 0, a11 = 0, a22 = 0, a01 = 0, a02 = 0, a12 = 0;
+    double b0 = 0, b1 = 0, b2 = 0;
+    double c = 0;
+    double weight = 0;
+
+    static Quadric plane(const glm::vec3& n, float d, float weight) {
+        Quadric q;
+        const double w = weight;
+        q.a00 = w * n.x * n.x;
+        q.a11 = w * n.y * n.y;
+        q.a22 = w * n.z * n.z;
+        q.a01 = w * n.x * n.y;
+        q.a02 = w * n.x * n.z;
+        q.a12 = w * n.y * n.z;
+        q.b0 = w * n.x * d;
+        q.b1 = w * n.y * d;
+        q.b2 = w * n.z * d;
+        q.c = w * d * d;
+        q.weight = w;
+        return q;
+    }
+
+    Quadric& operator+=(const Quadric& o) {
+        a00 += o.a00; a11 += o.a11; a22 += o.a22;
+        a01 += o.a01; a02 += o.a02; a12 += o.a12;
+        b0 += o.b0; b1 += o.b1; b2 += o.b2;
+        c += o.c;
+        weight += o.weight;
+        return *this;
+    }
+
+    // mean squared distance of p to the planes
+    double error(const glm::vec3& p) const {
+        const double x = p.x, y = p.y, z = p.z;
+        const double e = a00 * x * x + a11 * y * y + a22 * z * z
+                       + 2 * (a01 * x * y + a02 * x * z + a12 * y * z)
+                       + 2 * (b0 * x + b1 * y + b2 * z)
+                       + c;
+        return weight > 0 ? std::max(e, 0.0) / weight : 0.0;
+    }
+};
+
+
+struct PositionKey {
+    size_t operator()(const glm::vec3& p) const {
+        u32 words[3];
+        std::memcpy(words, &p, sizeof(words));
+        return size_t((words[0] * 73856093u) ^ (words[1] * 19349663u) ^ (words[2] * 83492791u));
+    }
+};
+
+struct PositionEqual {
+    bool operator()(const glm::vec3& a, const glm::vec3& b) const { return std::memcmp(&a, &b, sizeof(glm::vec3)) == 0; }
+};
+
+
+struct EdgeCollapse {
+    u32 from, to;   // positions
+    float cost;     // squared error
+};
+
+
+static u64 edge_key(u32 a, u32 b) {
+    return a < b ? (u64(a) << 32) | b : (u64(b) << 32) | a;
+}
+
+
+std::vector<u32> simplify_mesh(const std::vector<u32>& indices,
+                               const std::vector<Vertex>& vertices,
+                               size_t target_index_count,
+                               float max_error,
+                               float* result_error) {
+    // welded vertices that only differ in attributes share a position
+    std::vector<u32> position_of(vertices.size());
+    std::vector<glm::vec3> positions;
+    {
+        std::unordered_map<glm::vec3, u32, PositionKey, PositionEqual> lookup;
+        lookup.reserve(vertices.size());
+        for(size_t v = 0; v < vertices.size(); ++v) {
+            const auto [it, inserted] = lookup.try_emplace(vertices[v].position, u32(positions.size()));
+            if(inserted)
+                positions.push_back(vertices[v].position);
+            position_of[v] = it->second;
+        }
+    }
+    const size_t position_count = positions.size();
+
+    // vertices of every position, to pick attributes after a collapse
+    std::vector<u32> wedge_offsets(position_count + 1, 0);
+    for(size_t v = 0; v < vertices.size(); ++v)
+        ++wedge_offsets[position_of[v] + 1];
+    for(size_t p = 0; p < position_count; ++p)
+        wedge_offsets[p + 1] += wedge_offsets[p];
+    std::vector<u32> wedges(vertices.size());
+    {
+        std::vector<u32> fill(wedge_offsets.begin(), wedge_offsets.end() - 1);
+        for(size_t v = 0; v < vertices.size(); ++v)
+            wedges[fill[position_of[v]]++] = u32(v);
+    }
+
+    const auto is_degenerate = [&](const u32* tri) {
+        const auto a = position_of[tri[0]], b = position_of[tri[1]], c = position_of[tri[2]];
+        return a == b || b == c || a == c;
+    };
+
+    std::vector<u32> result;
+    result.reserve(indices.size());
+    for(size_t i = 0; i + 2 < indices.size(); i += 3)
+        if(!is_degenerate(&indices[i]))
+            result.insert(result.end(), &indices[i], &indices[i] + 3);
+
+    const auto triangle_normal = [&](u32 a, u32 b, u32 c) {
+        return glm::cross(positions[b] - positions[a], positions[c] - positions[a]);
+    };
+
+    // edges and their triangle count, sorted by key
+    std::vector<u64> edges;
+    const auto collect_edges = [&]() {
+        edges.clear();
+        for(size_t i = 0; i < result.size(); i += 3) {
+            const auto a = position_of[result[i]], b = position_of[result[i + 1]], c = position_of[result[i + 2]];
+            edges.push_back(edge_key(a, b));
+            edges.push_back(edge_key(b, c));
+            edges.push_back(edge_key(c, a));
+        }
+        std::sort(edges.begin(), edges.end());
+    };
+    const auto is_border_edge = [&](u64 key) {
+        const auto range = std::equal_range(edges.begin(), edges.end(), key);
+        return range.second - range.first == 1;
+    };
+
+    // plane quadrics weighted by area, border edges get a perpendicular plane so they stay put
+    std::vector<Quadric> quadrics(position_count);
+    collect_edges();
+    for(size_t i = 0; i < result.size(); i += 3) {
+        const u32 tri[3] = {position_of[result[i]], position_of[result[i + 1]], position_of[result[i + 2]]};
+        const auto n = triangle_normal(tri[0], tri[1], tri[2]);
+        const float length = glm::length(n);
+        if(length == 0)
+            continue;
+        const auto unit = n / length;
+        const auto q = Quadric::plane(unit, -glm::dot(unit, positions[tri[0]]), length * .5f);
+        for(const auto p : tri)
+            quadrics[p] += q;
+
+        for(u32 k = 0; k < 3; ++k) {
+            const auto a = tri[k], b = tri[(k + 1) % 3];
+            if(!is_border_edge(edge_key(a, b)))
+                continue;
+            const auto edge = positions[b] - positions[a];
+            const auto border_normal = glm::cross(edge, unit);
+            const float border_length = glm::length(border_normal);
+            if(border_length == 0)
+                continue;
+            const auto border_unit = border_normal / border_length;
+            const auto border = Quadric::plane(border_unit, -glm::dot(border_unit, positions[a]), 10.0f * glm::dot(edge, edge));
+            quadrics[a] += border;
+            quadrics[b] += border;
+        }
+    }
+
+    const double max_cost = double(max_error) * double(max_error);
+    double worst = 0;
+
+    std::vector<u8> on_border(position_count), locked(position_count);
+    std::vector<u32> collapse_to(position_count);
+    std::vector<u32> adjacency_offsets(position_count + 1), adjacency;
+    std::vector<u32> vertex_remap(vertices.size());
+    std::vector<EdgeCollapse> candidates;
+
+    while(result.size() > target_index_count) {
+        collect_edges();
+        std::fill(on_border.begin(), on_border.end(), 0);
+        for(size_t i = 0; i < edges.size();) {
+            size_t j = i + 1;
+            while(j < edges.size() && edges[j] == edges[i])
+                ++j;
+            if(j - i == 1) {
+                on_border[edges[i] >> 32] = 1;
+                on_border[edges[i] & 0xffffffffu] = 1;
+            }
+            i = j;
+        }
+
+        // cheaper direction of every edge, border vertices only slide along their border
+        candidates.clear();
+        for(size_t i = 0; i < edges.size();) {
+            size_t j = i + 1;
+            while(j < edges.size() && edges[j] == edges[i])
+                ++j;
+            const bool border_edge = j - i == 1;
+            const auto a = u32(edges[i] >> 32), b = u32(edges[i] & 0xffffffffu);
+            const double ab = on_border[a] && !border_edge ? INFINITY : quadrics[a].error(positions[b]) + quadrics[b].error(positions[b]);
+            const double ba = on_border[b] && !border_edge ? INFINITY : quadrics[a].error(positions[a]) + quadrics[b].error(positions[a]);
+            const double cost = std::min(ab, ba);
+            if(cost <= max_cost)
+                candidates.push_back(ab <= ba ? EdgeCollapse{a, b, float(cost)} : EdgeCollapse{b, a, float(cost)});
+            i = j;
+        }
+        if(candidates.empty())
+            break;
+        std::sort(candidates.begin(), candidates.end(), [](const EdgeCollapse& l, const EdgeCollapse& r) { return l.cost < r.cost; });
+
+        // triangles around every position
+        std::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0);
+        for(const auto v : result)
+            ++adjacency_offsets[position_of[v] + 1];
+        for(size_t p = 0; p < position_count; ++p)
+            adjacency_offsets[p + 1] += adjacency_offsets[p];
+        adjacency.resize(result.size());
+        {
+            std::vector<u32> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+            for(size_t i = 0; i < result.size(); ++i)
+                adjacency[fill[position_of[result[i]]]++] = u32(i / 3);
+        }
+
+        // independent collapses: a collapse locks the whole one-ring it changes
+        std::fill(locked.begin(), locked.end(), 0);
+        for(size_t p = 0; p < position_count; ++p)
+            collapse_to[p] = u32(p);
+        const size_t triangles_to_remove = (result.size() - target_index_count) / 3;
+        size_t removed = 0;
+        for(const auto& collapse : candidates) {
+            if(removed >= triangles_to_remove)
+                break;
+            if(locked[collapse.from] || locked[collapse.to])
+                continue;
+
+            // reject collapses that flip a remaining triangle
+            bool flips = false;
+            u32 shared = 0;
+            for(u32 i = adjacency_offsets[collapse.from]; i < adjacency_offsets[collapse.from + 1] && !flips; ++i) {
+                const u32* tri = &result[size_t(adjacency[i]) * 3];
+                u32 p[3] = {position_of[tri[0]], position_of[tri[1]], position_of[tri[2]]};
+                if(p[0] == collapse.to || p[1] == collapse.to || p[2] == collapse.to) {
+                    ++shared;
+                    continue;
+                }
+                const auto before = triangle_normal(p[0], p[1], p[2]);
+                for(auto& q : p)
+                    q = q == collapse.from ? collapse.to : q;
+                const auto after = triangle_normal(p[0], p[1], p[2]);
+                flips = glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after);
+            }
+            if(flips)
+                continue;
+
+            collapse_to[collapse.from] = collapse.to;
+            for(u32 i = adjacency_offsets[collapse.from]; i < adjacency_offsets[collapse.from + 1]; ++i) {
+                const u32* tri = &result[size_t(adjacency[i]) * 3];
+                for(u32 k = 0; k < 3; ++k)
+                    locked[position_of[tri[k]]] = 1;
+            }
+            removed += shared;
+            worst = std::max(worst, double(collapse.cost));
+        }
+        if(removed == 0)
+            break;
+
+        // attributes follow the target vertex with the closest normal
+        for(size_t v = 0; v < vertices.size(); ++v) {
+            vertex_remap[v] = u32(v);
+            const auto from = position_of[v];
+            const auto to = collapse_to[from];
+            if(to == from)
+                continue;
+            float best = -2.0f;
+            for(u32 w = wedge_offsets[to]; w < wedge_offsets[to + 1]; ++w) {
+                const float similarity = glm::dot(vertices[v].normal, vertices[wedges[w]].normal);
+                if(similarity > best) {
+                    best = similarity;
+                    vertex_remap[v] = wedges[w];
+                }
+            }
+        }
+        for(size_t p = 0; p < position_count; ++p)
+            if(collapse_to[p] != p)
+                quadrics[collapse_to[p]] += quadrics[p];
+
+        size_t write = 0;
+        for(size_t i = 0; i < result.size(); i += 3) {
+            const u32 tri[3] = {vertex_remap[result[i]], vertex_remap[result[i + 1]], vertex_remap[result[i + 2]]};
+            if(is_degenerate(tri))
+                continue;
+            result[write++] = tri[0];
+            result[write++] = tri[1];
+            result[write++] = tri[2];
+        }
+        result.resize(write);
+    }
+
+    if(result_error)
+        *result_error = float(std::sqrt(worst));
+    return result;
+}
+
+
+void generate_lods(MeshData& mesh) {
+    mesh.lods.clear();
+    mesh.lods.push_back(MeshLod{0, u32(mesh.indices.size()), 0.0f});
+
+    const float max_error = glm::length(mesh.aabb.extent()) * LOD_MAX_ERROR;
+    std::vector<u32> previous(mesh.indices);
+    float error = 0;
+    for(u32 lod = 1; lod < MAX_MESH_LODS; ++lod) {
+        const size_t target = previous.size() / 6 * 3;
+        float lod_error = 0;
+        auto simplified = simplify_mesh(previous, mesh.vertices, target, max_error, &lod_error);
+        if(simplified.empty() || float(simplified.size()) > float(previous.size()) * (1.0f - LOD_MIN_REDUCTION))
+            break;
+
+        optimize_vertex_cache(simplified, mesh.vertices.size());
+        // errors of consecutive levels add up in the worst case
+        error += lod_error;
+        mesh.lods.push_back(MeshLod{u32(mesh.indices.size()), u32(simplified.size()), error});
+        mesh.indices.insert(mesh.indices.end(), simplified.begin(), simplified.end());
+        previous = std::move(simplified);
+    }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "../types.h"
+
+#include <vector>
+#include <cstddef>
+
+
+// Quadric error edge collapse (Garland & Heckbert) that only rewrites indices, so every level
+// shares the vertex buffer. Vertices at one position collapse together, their attributes follow
+// the vertex with the most similar normal at the target. Borders are kept in place by extra planes.
+// Stops at target_index_count or before a collapse would move the surface by more than max_error,
+// result_error receives the largest error introduced, both in model units.
+std::vector<u32> simplify_mesh(const std::vector<u32>& indices,
+                               const std::vector<struct Vertex>& vertices,
+                               size_t target_index_count,
+                               float max_error,
+                               float* result_error = nullptr);
+
+// appends up to MAX_MESH_LODS - 1 simplified levels to mesh.indices and describes all levels in mesh.lods
+void generate_lods(struct MeshData& mesh);
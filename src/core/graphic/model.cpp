@@ -1,42 +1,83 @@
 #include "model.h"
 #include "binary_reader.h"
+#include "model_cache.h"
+#include "obj_loader.h"
+#include "mesh_simplifier.h"
+#include "mesh_merger.h"
+#include "occlusion.h"
+#include "../thread_pool.h"
 #include <glm/gtc/type_ptr.hpp>
 #include <filesystem>
 #include <stdexcept>
 #include <fstream>
+#include <unordered_map>
+#include <cstring>
+#include <chrono>
+#include <future>
+#include <algorithm>
+#include <functional>
+#include <atomic>
+#include <cassert>
+#include <cstdio>
 
-// todo: add support for .obj
-//#include <tinyobjloader/tiny_obj_loader.h>
 #include <OpenFBX/ofbx.h>
 
-bgfx::VertexLayout Vertex::get_layout() {
+bgfx::VertexLayout Vertex::get_layout(VertexFormat format) {
     bgfx::VertexLayout layout;
-    layout.begin()
-          .add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float)
-          .add(bgfx::Attrib::Normal, 3, bgfx::AttribType::Float)
-          .add(bgfx::Attrib::TexCoord0, 2, bgfx::AttribType::Float)
-          .end();
+    switch(format) {
+    case VertexFormat::Float:
+        layout.begin()
+              .add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float)
+              .add(bgfx::Attrib::Normal, 3, bgfx::AttribType::Float)
+              .add(bgfx::Attrib::TexCoord0, 2, bgfx::AttribType::Float)
+              .end();
+        break;
+    case VertexFormat::Compact8:
+        // the normal is packed into position.w
+        layout.begin()
+              .add(bgfx::Attrib::Position, 4, bgfx::AttribType::Int16, true)
+              .add(bgfx::Attrib::TexCoord0, 2, bgfx::AttribType::Half)
+              .end();
+        break;
+    case VertexFormat::Compact16:
+        layout.begin()
+              .add(bgfx::Attrib::Position, 4, bgfx::AttribType::Int16, true)
+              .add(bgfx::Attrib::Normal, 2, bgfx::AttribType::Int16, true)
+              .add(bgfx::Attrib::TexCoord0, 2, bgfx::AttribType::Half)
+              .end();
+        break;
+    }
     return layout;
 }
 
-Model::Model(Model&& other) noexcept : vertices(std::move(other.vertices)),
-                                       indices(std::move(other.indices)),
-                                       vbh(other.vbh),
+Model::Model(Model&& other) noexcept : vbh(other.vbh),
                                        ibh(other.ibh),
                                        mdt(std::move(other.mdt)),
-                                       aabb(std::move(other.aabb)) {
+                                       mesh_bounds(std::move(other.mesh_bounds)),
+                                       mesh_diffuse(std::move(other.mesh_diffuse)),
+                                       cpu_meshes(std::move(other.cpu_meshes)),
+                                       bvh(std::move(other.bvh)),
+                                       occluders(std::move(other.occluders)),
+                                       aabb(std::move(other.aabb)),
+                                       stats(other.stats),
+                                       state(other.state) {
     other.vbh = BGFX_INVALID_HANDLE;
     other.ibh = BGFX_INVALID_HANDLE;
 }
 
 Model& Model::operator=(Model&& other) noexcept {
     using std::swap;
-    swap(vertices, other.vertices);
-    swap(indices, other.indices);
     swap(vbh, other.vbh);
     swap(ibh, other.ibh);
     swap(mdt, other.mdt);
+    swap(mesh_bounds, other.mesh_bounds);
+    swap(mesh_diffuse, other.mesh_diffuse);
+    swap(cpu_meshes, other.cpu_meshes);
+    swap(bvh, other.bvh);
+    swap(occluders, other.occluders);
     swap(aabb, other.aabb);
+    swap(stats, other.stats);
+    swap(state, other.state);
     return *this;
 }
 
@@ -47,6 +88,157 @@ Model::~Model() {
         bgfx::destroy(vbh);
     ibh = BGFX_INVALID_HANDLE;
     vbh = BGFX_INVALID_HANDLE;
+
+    for(auto& m : mdt) {
+        if(bgfx::isValid(m.ibh))
+            bgfx::destroy(m.ibh);
+        if(bgfx::isValid(m.vbh))
+            bgfx::destroy(m.vbh);
+    }
+    mdt.clear();
+}
+
+
+// bitwise identity, so welding never merges vertices that differ in any attribute
+struct VertexHash {
+    size_t operator()(const Vertex& v) const {
+        static_assert(sizeof(Vertex) == 8 * sizeof(u32), "Vertex must not contain padding");
+        u32 words[8];
+        std::memcpy(words, &v, sizeof(words));
+        u64 h = 14695981039346656037ull;
+        for(auto w : words) {
+            h ^= w;
+            h *= 1099511628211ull;
+        }
+        return size_t(h ^ (h >> 32));
+    }
+};
+
+struct VertexEqual {
+    bool operator()(const Vertex& a, const Vertex& b) const {
+        return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+    }
+};
+
+
+// for renderers without 32 bit index support, cut a mesh into pieces of at most 65536 vertices
+// only the full detail level survives the split
+std::vector<MeshData> split_for_index16(const MeshData& mesh) {
+    std::vector<MeshData> parts;
+    std::vector<u32> remap(mesh.vertices.size(), UINT32_MAX);
+    std::vector<u32> touched;
+
+    const size_t index_count = mesh.lods.empty() ? mesh.indices.size() : mesh.lods[0].index_count;
+    MeshData part;
+    for(size_t tri = 0; tri + 2 < index_count; tri += 3) {
+        // start a new part if this triangle could overflow the current one
+        if(part.vertices.size() + 3 > UINT16_MAX + 1) {
+            for(auto v : touched)
+                remap[v] = UINT32_MAX;
+            touched.clear();
+            parts.emplace_back(std::move(part));
+            part = MeshData();
+        }
+
+        for(size_t corner = 0; corner < 3; ++corner) {
+            const u32 src = mesh.indices[tri + corner];
+            if(remap[src] == UINT32_MAX) {
+                remap[src] = u32(part.vertices.size());
+                touched.push_back(src);
+                const auto& position = mesh.vertices[src].position;
+                if(part.vertices.empty()) {
+                    part.aabb = {position, position};
+                }
+                else {
+                    part.aabb.min = glm::min(part.aabb.min, position);
+                    part.aabb.max = glm::max(part.aabb.max, position);
+                }
+                part.vertices.push_back(mesh.vertices[src]);
+            }
+            part.indices.push_back(remap[src]);
+        }
+        part.diffuse = mesh.diffuse;
+    }
+    if(!part.indices.empty())
+        parts.emplace_back(std::move(part));
+
+    return parts;
+}
+
+
+// bytes bgfx references without a copy and hasn't released yet
+static std::atomic<u64> s_referenced_bytes{0};
+
+struct RefKeepAlive {
+    std::shared_ptr<const void> owner;
+    u32 size;
+};
+
+// hands `data` to bgfx without copying, `owner` keeps it alive until bgfx is done with it
+const bgfx::Memory* ref_shared(std::shared_ptr<const void> owner, const void* data, u32 size) {
+    s_referenced_bytes += size;
+    auto* keep_alive = new RefKeepAlive{std::move(owner), size};
+    return bgfx::makeRef(data, size, [](void*, void* user) {
+        auto* keep = static_cast<RefKeepAlive*>(user);
+        s_referenced_bytes -= keep->size;
+        delete keep;
+    }, keep_alive);
+}
+
+
+// compact formats need half float attributes, fall back to float without them
+VertexFormat supported_vertex_format(VertexFormat format) {
+    if(format != VertexFormat::Float && !(bgfx::getCaps()->supported & BGFX_CAPS_VERTEX_ATTRIB_HALF))
+        return VertexFormat::Float;
+    return format;
+}
+
+
+// float vertices are referenced through owner, compact ones are packed into bgfx memory
+static void upload_vertices(MeshDataTuple& mesh, ModelLoadStats& stats, std::shared_ptr<const void> owner,
+                            const Vertex* vertices, u32 count, const AABB& aabb, VertexFormat format) {
+    if(format == VertexFormat::Float) {
+        mesh.vbh = bgfx::createVertexBuffer(ref_shared(std::move(owner), vertices, u32(sizeof(Vertex) * count)), Vertex::get_layout());
+    }
+    else {
+        const bgfx::Memory* mem = bgfx::alloc(count * vertex_stride(format));
+        const float error = pack_vertices(vertices, count, aabb, format, mem->data, mesh.dequant);
+        stats.max_position_error = std::max(stats.max_position_error, error);
+        mesh.vbh = bgfx::createVertexBuffer(mem, Vertex::get_layout(format));
+    }
+    stats.vertex_bytes += u64(count) * vertex_stride(format);
+}
+
+
+static MeshDataTuple upload_mesh(const std::shared_ptr<const MeshData>& data, VertexFormat format, ModelLoadStats& stats) {
+    const MeshData& mesh = *data;
+    // todo remove transform field from MeshDataTuple
+    MeshDataTuple result{BGFX_INVALID_HANDLE, BGFX_INVALID_HANDLE, mesh.diffuse, glm::mat4(1.0f)};
+    upload_vertices(result, stats, data, mesh.vertices.data(), u32(mesh.vertices.size()), mesh.aabb, format);
+    result.aabb = mesh.aabb;
+    if(mesh.lods.empty()) {
+        result.lod_count = 1;
+        result.lods[0] = MeshLod{0, u32(mesh.indices.size()), 0.0f};
+    }
+    else {
+        result.lod_count = u32(std::min<size_t>(mesh.lods.size(), MAX_MESH_LODS));
+        std::copy(mesh.lods.begin(), mesh.lods.begin() + result.lod_count, result.lods);
+    }
+
+    if(mesh.needs_index32()) {
+        result.ibh = bgfx::createIndexBuffer(ref_shared(data, mesh.indices.data(), u32(sizeof(u32) * mesh.indices.size())), BGFX_BUFFER_INDEX32);
+        stats.index_bytes += sizeof(u32) * mesh.indices.size();
+    }
+    else {
+        const bgfx::Memory* mem = bgfx::alloc(u32(sizeof(u16) * mesh.indices.size()));
+        auto* dst = reinterpret_cast<u16*>(mem->data);
+        for(size_t i = 0; i < mesh.indices.size(); ++i)
+            dst[i] = u16(mesh.indices[i]);
+        result.ibh = bgfx::createIndexBuffer(mem);
+        stats.index_bytes += sizeof(u16) * mesh.indices.size();
+    }
+
+    return result;
 }
 
 
@@ -68,125 +260,602 @@ auto load_fbx_model(const std::string& filename) {
 }
 
 
-std::optional<Model> Model::load_from_file(const std::string& filename) {
-    //std::vector<Vertex> vertices;
-    //std::vector<u16> indices;
-    //bgfx::VertexBufferHandle vbh = BGFX_INVALID_HANDLE;
-    //bgfx::IndexBufferHandle ibh = BGFX_INVALID_HANDLE;
+// buckets the triangles of a mesh by their material with a counting sort, every material
+// gets a contiguous index range that becomes its own mesh with only the vertices it uses
+std::vector<std::pair<u32, MeshData>> split_by_material(const MeshData& mesh, const int* triangle_materials, u32 material_count) {
+    const size_t triangle_count = mesh.indices.size() / 3;
+    const auto material_of = [&](size_t tri) { return u32(std::clamp(triangle_materials[tri], 0, int(material_count) - 1)); };
 
-    std::vector<MeshDataTuple> mdt;
-    std::pair<AABB, bool> aabb_hasvalue;
+    std::vector<u32> offsets(material_count + 1, 0);
+    for(size_t tri = 0; tri < triangle_count; ++tri)
+        ++offsets[material_of(tri) + 1];
+    for(u32 mat = 0; mat < material_count; ++mat)
+        offsets[mat + 1] += offsets[mat];
 
-    const auto fbx_scene = load_fbx_model(filename);
-    if(!fbx_scene) {
-        return std::nullopt;
+    // stable, triangles keep their order within a material
+    std::vector<u32> sorted(triangle_count);
+    std::vector<u32> cursor(offsets.begin(), offsets.end() - 1);
+    for(size_t tri = 0; tri < triangle_count; ++tri)
+        sorted[cursor[material_of(tri)]++] = u32(tri);
+
+    std::vector<std::pair<u32, MeshData>> result;
+    std::vector<u32> remap(mesh.vertices.size(), UINT32_MAX);
+    for(u32 mat = 0; mat < material_count; ++mat) {
+        if(offsets[mat] == offsets[mat + 1])
+            continue;
+
+        MeshData part;
+        part.indices.reserve(size_t(offsets[mat + 1] - offsets[mat]) * 3);
+        for(u32 i = offsets[mat]; i < offsets[mat + 1]; ++i) {
+            for(u32 k = 0; k < 3; ++k) {
+                const auto v = mesh.indices[size_t(sorted[i]) * 3 + k];
+                if(remap[v] == UINT32_MAX) {
+                    remap[v] = u32(part.vertices.size());
+                    part.vertices.push_back(mesh.vertices[v]);
+                }
+                part.indices.push_back(remap[v]);
+            }
+        }
+        // vertices on material borders are duplicated into every part using them
+        for(u32 i = offsets[mat]; i < offsets[mat + 1]; ++i)
+            for(u32 k = 0; k < 3; ++k)
+                remap[mesh.indices[size_t(sorted[i]) * 3 + k]] = UINT32_MAX;
+
+        part.aabb = {part.vertices[0].position, part.vertices[0].position};
+        for(const auto& vertex : part.vertices)
+            part.aabb = part.aabb.merged({vertex.position, vertex.position});
+        result.emplace_back(mat, std::move(part));
     }
+    return result;
+}
 
-    for(auto mesh_idx = 0; mesh_idx < fbx_scene->getMeshCount(); ++mesh_idx) {
-        const auto* mesh = fbx_scene->getMesh(mesh_idx);
-        const auto* geometry = mesh->getGeometry();
 
-        std::vector<Vertex> vertices;
-        std::vector<u16> indices;
+// multi material meshes come out as one mesh per material
+void process_fbx_mesh(const ofbx::Mesh* mesh, std::vector<MeshData>& meshes, ModelLoadStats& stats) {
+    const auto* geometry = mesh->getGeometry();
 
-        auto matrix = mesh->getGlobalTransform();
-        glm::mat4 trans;
+    MeshData result;
 
-        //for(auto row = 0; row < 4; ++row)
-        //    for(auto col = 0; col < 4; ++col)
-        //        trans[col][row] = matrix.m[row+col*4];
+    auto matrix = mesh->getGlobalTransform();
+    glm::mat4 trans;
 
-        for(auto i = 0; i < 16; ++i)
-            trans[i / 4][i % 4] = matrix.m[i];
+    //for(auto row = 0; row < 4; ++row)
+    //    for(auto col = 0; col < 4; ++col)
+    //        trans[col][row] = matrix.m[row+col*4];
 
-        // pre-multiplying model matrix
-        // init scale = 100, don't know why
-        trans *= .01;
-        trans[3][3] = 1;
+    for(auto i = 0; i < 16; ++i)
+        trans[i / 4][i % 4] = matrix.m[i];
 
-        // for now, VertexCount == IndexCount because of default triangulation
-        for(auto face_idx = 0; face_idx < geometry->getIndexCount(); ++face_idx) {
-            const auto vert_idx = [=]() {
-                const auto idx = geometry->getFaceIndices()[face_idx];
-                return idx < 0 ? -idx - 1 : idx;
-            }();
+    // pre-multiplying model matrix
+    // init scale = 100, don't know why
+    trans *= .01;
+    trans[3][3] = 1;
 
-            glm::vec3 position = trans * glm::vec4{
-                geometry->getVertices()[vert_idx].x,
-                geometry->getVertices()[vert_idx].y,
-                geometry->getVertices()[vert_idx].z,
-                1.0f
-            };
+    // default triangulation emits one corner per index, identical corners are welded here
+    const auto corner_count = geometry->getIndexCount();
+    std::unordered_map<Vertex, u32, VertexHash, VertexEqual> lookup;
+    lookup.reserve(corner_count);
+    result.indices.reserve(corner_count);
+
+    for(auto face_idx = 0; face_idx < corner_count; ++face_idx) {
+        const auto vert_idx = [=]() {
+            const auto idx = geometry->getFaceIndices()[face_idx];
+            return idx < 0 ? -idx - 1 : idx;
+        }();
+
+        glm::vec3 position = trans * glm::vec4{
+            geometry->getVertices()[vert_idx].x,
+            geometry->getVertices()[vert_idx].y,
+            geometry->getVertices()[vert_idx].z,
+            1.0f
+        };
+
+        if(face_idx > 0) {
+            result.aabb.min = glm::min(position, result.aabb.min);
+            result.aabb.max = glm::max(position, result.aabb.max);
+        }
+        else {
+            result.aabb.min = position;
+            result.aabb.max = position;
+        }
+
+        auto vertex = Vertex{
+            position,
+            {
+                geometry->getNormals()[face_idx].x,
+                geometry->getNormals()[face_idx].y,
+                geometry->getNormals()[face_idx].z,
+            },
+            // todo: handle models that don't specify uvs
+            geometry->getUVs(0)
+                ? glm::vec2{geometry->getUVs(0)[face_idx].x, geometry->getUVs(0)[face_idx].y}
+                : glm::vec2{0, 0}
+        };
+
+        const auto [it, inserted] = lookup.try_emplace(vertex, u32(result.vertices.size()));
+        if(inserted)
+            result.vertices.emplace_back(vertex);
+        result.indices.push_back(it->second);
+    }
+
+    // todo: other material params
+    const auto mesh_mat_cnt = mesh->getMaterialCount();
+    const auto diffuse_of = [&](int mat_id) {
+        const auto color = mesh->getMaterial(mat_id)->getDiffuseColor();
+        return glm::vec4{color.r, color.g, color.b, 1};
+    };
+    if(mesh_mat_cnt == 0) {
+        result.diffuse = {.9, .6, .8, 1};
+    }
+    else if(mesh_mat_cnt == 1 || !geometry->getMaterials()) {
+        result.diffuse = diffuse_of(0);
+    }
+    else {
+        stats.multi_material_mesh_count += 1;
+        const auto sort_start = std::chrono::steady_clock::now();
+        auto parts = split_by_material(result, geometry->getMaterials(), u32(mesh_mat_cnt));
+        for(auto& [mat_id, part] : parts) {
+            part.diffuse = diffuse_of(int(mat_id));
+            meshes.emplace_back(std::move(part));
+        }
+        stats.material_ms += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - sort_start).count();
+        return;
+    }
+
+    meshes.emplace_back(std::move(result));
+}
+
+
+void append_mesh(std::vector<MeshDataTuple>& mdt, ModelLoadStats& stats, const std::shared_ptr<const MeshData>& data, VertexFormat format) {
+    stats.mesh_count += 1;
+    stats.vertex_count += data->vertices.size();
+    stats.index_count += data->indices.size();
+
+    if(!data->needs_index32()) {
+        mdt.emplace_back(upload_mesh(data, format, stats));
+    }
+    else if(bgfx::getCaps()->supported & BGFX_CAPS_INDEX32) {
+        stats.index32_mesh_count += 1;
+        mdt.emplace_back(upload_mesh(data, format, stats));
+    }
+    else {
+        for(auto& part : split_for_index16(*data))
+            mdt.emplace_back(upload_mesh(std::make_shared<const MeshData>(std::move(part)), format, stats));
+    }
+}
 
-            if(aabb_hasvalue.second) {
-                aabb_hasvalue.first.min = glm::min(position, aabb_hasvalue.first.min);
-                aabb_hasvalue.first.max = glm::max(position, aabb_hasvalue.first.max);
-            }
-            else {
-                aabb_hasvalue.first.min = position;
-                aabb_hasvalue.first.max = position;
-                aabb_hasvalue.second = true;
-            }
 
-            auto vertex = Vertex{
-                position,
-                {
-                    geometry->getNormals()[face_idx].x,
-                    geometry->getNormals()[face_idx].y,
-                    geometry->getNormals()[face_idx].z,
-                },
-                // todo: handle models that don't specify uvs
-                geometry->getUVs(0)
-                    ? glm::vec2{geometry->getUVs(0)[face_idx].x, geometry->getUVs(0)[face_idx].y}
-                    : glm::vec2{0, 0}
-            };
-
-            vertices.emplace_back(vertex);
-            indices.push_back(indices.size());
-        }
-
-        // todo: use ref
-        const auto layout = Vertex::get_layout();
-        auto vbh = bgfx::createVertexBuffer(bgfx::copy(vertices.data(), sizeof(Vertex) * vertices.size()), layout);
-        auto ibh = bgfx::createIndexBuffer(bgfx::copy(indices.data(), sizeof(u16) * indices.size()));
-
-        // todo: other material params
-        glm::vec4 diffuse;
-        const auto mesh_mat_cnt = mesh->getMaterialCount();
-        if(mesh_mat_cnt == 0)
-            diffuse = {.9, .6, .8, 1};
-        else if(mesh_mat_cnt == 1) {
-            const auto color = mesh->getMaterial(0)->getDiffuseColor();
-            diffuse = {color.r, color.g, color.b, 1};
+u64 cpu_geometry_bytes(const MeshData& mesh) {
+    return mesh.vertices.capacity() * sizeof(Vertex) + mesh.indices.capacity() * sizeof(u32);
+}
+
+
+// everything about a model file that can be done without touching bgfx
+struct PreparedModel {
+    std::shared_ptr<ModelCache> cache;  // meshes come from the mapped cache when set
+    std::vector<MeshData> meshes;       // otherwise from here
+    AABB aabb{};
+    ModelLoadStats stats;
+    VertexFormat vertex_format = VertexFormat::Float;
+    bool keep_cpu_geometry = false;
+    std::shared_ptr<const Bvh> bvh;
+    std::shared_ptr<const OccluderMesh> occluders;
+
+    u32 mesh_count() const { return cache ? cache->header().mesh_count : u32(meshes.size()); }
+
+    u64 mesh_bytes(u32 i) const {
+        if(cache) {
+            const auto& mesh = cache->mesh(i);
+            return u64(mesh.vertex_count) * sizeof(Vertex) + u64(mesh.index_count) * mesh.index_size;
+        }
+        return meshes[i].vertices.size() * sizeof(Vertex) + meshes[i].indices.size() * sizeof(u32);
+    }
+};
+
+
+// meshes are moved out of prepared, bgfx references them until the upload is done and they
+// are freed afterwards unless the model keeps its cpu geometry
+void upload_prepared_mesh(PreparedModel& prepared, u32 i, Model& model) {
+    const auto format = supported_vertex_format(prepared.vertex_format);
+    model.stats.vertex_format = format;
+    model.mesh_diffuse.push_back(prepared.cache ? prepared.cache->mesh(i).diffuse : prepared.meshes[i].diffuse);
+    if(!prepared.cache) {
+        auto data = std::make_shared<const MeshData>(std::move(prepared.meshes[i]));
+        prepared.meshes[i] = MeshData();
+        append_mesh(model.mdt, model.stats, data, format);
+        if(prepared.keep_cpu_geometry) {
+            model.stats.cpu_bytes += cpu_geometry_bytes(*data);
+            model.cpu_meshes.emplace_back(std::move(data));
         }
         else {
-            assert(geometry->getMaterials());
-            // todo: handle multiple materials
-            //const auto face_num = geometry->getIndexCount();
-            //const auto len_mat_array = face_num / 3;
-            //const auto mat_id = geometry->getMaterials()[vert_idx / 3];
-            const auto mat_id = 0;
-            const auto color = mesh->getMaterial(mat_id)->getDiffuseColor();
-            diffuse = {color.r, color.g, color.b, 1};
+            model.stats.freed_cpu_bytes += cpu_geometry_bytes(*data);
         }
+        return;
+    }
+
+    const auto& cache = prepared.cache;
+    const auto& mesh = cache->mesh(i);
+    const auto* vertices = cache->data() + mesh.vertex_offset;
+    const auto* indices = cache->data() + mesh.index_offset;
+
+    // the cache is mapped, consumers of cpu geometry get their own copy
+    const auto copy_mesh = [&]() {
+        auto data = std::make_shared<MeshData>();
+        data->vertices.assign(reinterpret_cast<const Vertex*>(vertices), reinterpret_cast<const Vertex*>(vertices) + mesh.vertex_count);
+        if(mesh.index_size == 4)
+            data->indices.assign(reinterpret_cast<const u32*>(indices), reinterpret_cast<const u32*>(indices) + mesh.index_count);
+        else
+            data->indices.assign(reinterpret_cast<const u16*>(indices), reinterpret_cast<const u16*>(indices) + mesh.index_count);
+        data->diffuse = mesh.diffuse;
+        data->aabb = mesh.aabb;
+        data->lods.assign(mesh.lods, mesh.lods + mesh.lod_count);
+        return data;
+    };
+    const u64 mapped_bytes = prepared.mesh_bytes(i);
+    if(prepared.keep_cpu_geometry) {
+        auto data = copy_mesh();
+        model.stats.cpu_bytes += cpu_geometry_bytes(*data);
+        model.cpu_meshes.emplace_back(std::move(data));
+    }
 
-        // todo remove transform field from MeshDataTuple
-        mdt.emplace_back(MeshDataTuple{vbh, ibh, diffuse, glm::mat4(1.0f)});
+    if(mesh.index_size == 4 && !(bgfx::getCaps()->supported & BGFX_CAPS_INDEX32)) {
+        // rare slow path, go through the same splitting as a fresh load
+        append_mesh(model.mdt, model.stats, copy_mesh(), format);
+        model.stats.freed_cpu_bytes += mapped_bytes;
+        return;
     }
 
+    MeshDataTuple result{BGFX_INVALID_HANDLE, BGFX_INVALID_HANDLE, mesh.diffuse, glm::mat4(1.0f)};
+    result.aabb = mesh.aabb;
+    result.lod_count = mesh.lod_count;
+    std::copy(mesh.lods, mesh.lods + mesh.lod_count, result.lods);
+    if(format == VertexFormat::Float) {
+        result.vbh = bgfx::createVertexBuffer(ref_shared(cache, vertices, u32(sizeof(Vertex) * mesh.vertex_count)), Vertex::get_layout());
+        model.stats.vertex_bytes += u64(mesh.vertex_count) * sizeof(Vertex);
+    }
+    else {
+        upload_vertices(result, model.stats, cache, reinterpret_cast<const Vertex*>(vertices), mesh.vertex_count, mesh.aabb, format);
+    }
+    result.ibh = bgfx::createIndexBuffer(ref_shared(cache, indices, mesh.index_size * mesh.index_count),
+                                         mesh.index_size == 4 ? BGFX_BUFFER_INDEX32 : BGFX_BUFFER_NONE);
+    model.stats.index_bytes += u64(mesh.index_size) * mesh.index_count;
+    // the mapping goes away with the last reference
+    model.stats.freed_cpu_bytes += mapped_bytes;
+    model.mdt.emplace_back(result);
+
+    model.stats.mesh_count += 1;
+    model.stats.vertex_count += mesh.vertex_count;
+    model.stats.index_count += mesh.index_count;
+    model.stats.index32_mesh_count += mesh.index_size == 4 ? 1 : 0;
+}
+
+
+void finish_model(Model& model, const PreparedModel& prepared, const std::string& filename, std::chrono::steady_clock::time_point start_time) {
+    model.aabb = prepared.aabb;
+    model.mesh_bounds.clear();
+    for(const auto& m : model.mdt)
+        model.mesh_bounds.push_back(m.aabb);
+    model.stats.corner_count = prepared.stats.corner_count;
+    model.stats.process_ms = prepared.stats.process_ms;
+    model.stats.optimize_ms = prepared.stats.optimize_ms;
+    model.stats.vertex_cache_before = prepared.stats.vertex_cache_before;
+    model.stats.vertex_cache_after = prepared.stats.vertex_cache_after;
+    model.stats.lod_ms = prepared.stats.lod_ms;
+    model.stats.merge_ms = prepared.stats.merge_ms;
+    model.stats.source_mesh_count = prepared.stats.source_mesh_count;
+    model.stats.multi_material_mesh_count = prepared.stats.multi_material_mesh_count;
+    model.stats.material_ms = prepared.stats.material_ms;
+    std::copy(std::begin(prepared.stats.lod_triangle_count), std::end(prepared.stats.lod_triangle_count), model.stats.lod_triangle_count);
+    model.stats.thread_count = prepared.stats.thread_count;
+    model.bvh = prepared.bvh;
+    model.stats.bvh_ms = prepared.stats.bvh_ms;
+    model.stats.bvh_bytes = prepared.bvh ? prepared.bvh->size_bytes() : 0;
+    model.occluders = prepared.occluders;
+    model.stats.occluder_ms = prepared.stats.occluder_ms;
+    model.stats.from_cache = prepared.stats.from_cache;
+    model.stats.load_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+
+    const auto& stats = model.stats;
+    if(stats.from_cache) {
+        printf("loaded %s from cache: %u meshes, %llu vertices, %.1f ms\n",
+               filename.c_str(),
+               stats.mesh_count,
+               (unsigned long long)stats.vertex_count,
+               stats.load_ms);
+    }
+    else {
+        printf("loaded %s: %u meshes, %llu corners welded to %llu vertices (%.1f%%), %u meshes with 32 bit indices, %.1f ms (%.1f ms processing on %u threads)\n",
+               filename.c_str(),
+               stats.mesh_count,
+               (unsigned long long)stats.corner_count,
+               (unsigned long long)stats.vertex_count,
+               stats.corner_count ? 100.0 * stats.vertex_count / stats.corner_count : 0.0,
+               stats.index32_mesh_count,
+               stats.load_ms,
+               stats.process_ms,
+               stats.thread_count);
+    }
+    printf("vertex cache: acmr %.3f -> %.3f, atvr %.3f -> %.3f (%.1f ms optimizing)\n",
+           stats.vertex_cache_before.acmr(),
+           stats.vertex_cache_after.acmr(),
+           stats.vertex_cache_before.atvr(),
+           stats.vertex_cache_after.atvr(),
+           stats.optimize_ms);
+    printf("lod triangles: %llu / %llu / %llu / %llu (%.1f ms simplifying)\n",
+           (unsigned long long)stats.lod_triangle_count[0],
+           (unsigned long long)stats.lod_triangle_count[1],
+           (unsigned long long)stats.lod_triangle_count[2],
+           (unsigned long long)stats.lod_triangle_count[3],
+           stats.lod_ms);
+    printf("draw calls: %u meshes merged into %u (%.1f ms merging)\n",
+           stats.source_mesh_count,
+           stats.mesh_count,
+           stats.merge_ms);
+    if(model.bvh) {
+        printf("bvh: %u nodes over %u triangles, %.1f MB, %.1f ms\n",
+               model.bvh->node_count(),
+               model.bvh->triangle_count(),
+               stats.bvh_bytes / (1024.0 * 1024.0),
+               stats.bvh_ms);
+    }
+    if(model.occluders) {
+        printf("occluders: %u triangles of at least %g, %.1f ms\n",
+               model.occluders->triangle_count(),
+               model.occluders->min_area,
+               stats.occluder_ms);
+    }
+    printf("cpu geometry: %.1f MB kept, %.1f MB freed after upload\n",
+           stats.cpu_bytes / (1024.0 * 1024.0),
+           stats.freed_cpu_bytes / (1024.0 * 1024.0));
+    if(stats.multi_material_mesh_count) {
+        printf("%u meshes with several materials split into material ranges (%.1f ms summed over threads)\n",
+               stats.multi_material_mesh_count,
+               stats.material_ms);
+    }
+    if(stats.vertex_format != VertexFormat::Float) {
+        printf("vertices stored as %s: %.1f MB instead of %.1f MB, max position error %g\n",
+               vertex_format_name(stats.vertex_format),
+               stats.vertex_bytes / (1024.0 * 1024.0),
+               stats.vertex_count * sizeof(Vertex) / (1024.0 * 1024.0),
+               stats.max_position_error);
+    }
+}
+
+
+// the full detail level of every mesh, in upload order
+std::vector<BvhMeshInput> full_detail_meshes(const PreparedModel& prepared) {
+    std::vector<BvhMeshInput> inputs;
+    inputs.reserve(prepared.mesh_count());
+    for(u32 i = 0; i < prepared.mesh_count(); ++i) {
+        if(prepared.cache) {
+            const auto& mesh = prepared.cache->mesh(i);
+            const u8* indices = prepared.cache->data() + mesh.index_offset + u64(mesh.lods[0].index_offset) * mesh.index_size;
+            inputs.push_back({reinterpret_cast<const Vertex*>(prepared.cache->data() + mesh.vertex_offset), indices, mesh.index_size, mesh.lods[0].index_count});
+        }
+        else {
+            const auto& mesh = prepared.meshes[i];
+            const MeshLod full = mesh.lods.empty() ? MeshLod{0, u32(mesh.indices.size()), 0.0f} : mesh.lods[0];
+            inputs.push_back({mesh.vertices.data(), mesh.indices.data() + full.index_offset, 4, full.index_count});
+        }
+    }
+    return inputs;
+}
+
+
+void build_model_bvh(PreparedModel& prepared, ThreadPool* pool) {
+    auto bvh = std::make_shared<Bvh>(Bvh::build(full_detail_meshes(prepared), pool));
+    prepared.stats.bvh_ms = bvh->build_ms();
+    prepared.bvh = std::move(bvh);
+}
+
+
+void build_model_occluders(PreparedModel& prepared) {
+    const auto start = std::chrono::steady_clock::now();
+    prepared.occluders = std::make_shared<OccluderMesh>(build_occluders(full_detail_meshes(prepared)));
+    prepared.stats.occluder_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// safe to call from any thread
+std::optional<PreparedModel> prepare_model(const std::string& filename, const ModelLoadOptions& options) {
+    PreparedModel result;
+    result.vertex_format = options.vertex_format;
+    result.keep_cpu_geometry = options.keep_cpu_geometry;
+
+    u64 source_size = 0;
+    const u64 source_hash = ModelCache::hash_file(filename, &source_size);
+    if(source_size == 0)
+        return std::nullopt;
+
+    // a null pool processes on the calling thread
+    std::unique_ptr<ThreadPool> local_pool;
+    ThreadPool* pool = nullptr;
+    u32 thread_count = 1;
+    if(options.thread_count == 0) {
+        pool = &ThreadPool::shared();
+        thread_count = pool->worker_count() + 1;
+    }
+    else if(options.thread_count > 1) {
+        local_pool = std::make_unique<ThreadPool>(options.thread_count - 1);
+        pool = local_pool.get();
+        thread_count = options.thread_count;
+    }
+
+    const auto cache_path = ModelCache::path_for(filename);
+    const u32 cache_flags = (options.optimize_meshes ? MODEL_CACHE_FLAG_OPTIMIZED : 0)
+                          | (options.generate_lods ? MODEL_CACHE_FLAG_LODS : 0)
+                          | (options.merge_meshes ? MODEL_CACHE_FLAG_MERGED : 0);
+    result.cache = options.use_cache ? ModelCache::open(cache_path, source_hash, source_size, cache_flags) : nullptr;
+    if(result.cache) {
+        result.aabb = result.cache->header().aabb;
+        result.stats.corner_count = result.cache->header().corner_count;
+        result.stats.vertex_cache_before = result.cache->header().vertex_cache_before;
+        result.stats.vertex_cache_after = result.cache->header().vertex_cache_after;
+        result.stats.source_mesh_count = result.cache->header().source_mesh_count;
+        for(u32 i = 0; i < result.cache->header().mesh_count; ++i) {
+            const auto& mesh = result.cache->mesh(i);
+            for(u32 lod = 0; lod < mesh.lod_count; ++lod)
+                result.stats.lod_triangle_count[lod] += mesh.lods[lod].index_count / 3;
+        }
+        result.stats.from_cache = true;
+        if(options.build_bvh)
+            build_model_bvh(result, pool);
+        if(options.build_occluders)
+            build_model_occluders(result);
+        return result;
+    }
+
+    std::pair<AABB, bool> aabb_hasvalue;
+    const auto add_mesh = [&](MeshData&& data) {
+        if(data.indices.empty())
+            return;
+
+        if(aabb_hasvalue.second) {
+            aabb_hasvalue.first = aabb_hasvalue.first.merged(data.aabb);
+        }
+        else {
+            aabb_hasvalue.first = data.aabb;
+            aabb_hasvalue.second = true;
+        }
+        result.meshes.emplace_back(std::move(data));
+    };
+
+    auto process_start = std::chrono::steady_clock::now();
+    if(std::filesystem::path(filename).extension() == ".obj") {
+        auto obj = load_obj(filename, pool);
+        if(!obj)
+            return std::nullopt;
+
+        result.stats.corner_count = obj->corner_count;
+        for(auto& data : obj->meshes)
+            add_mesh(std::move(data));
+    }
+    else {
+        const auto fbx_scene = load_fbx_model(filename);
+        if(!fbx_scene) {
+            return std::nullopt;
+        }
+        process_start = std::chrono::steady_clock::now();
+
+        // every mesh converts into its own slot, so the result doesn't depend on scheduling
+        const auto mesh_count = u32(std::max(fbx_scene->getMeshCount(), 0));
+        std::vector<std::vector<MeshData>> processed(mesh_count);
+        std::vector<ModelLoadStats> process_stats(mesh_count);
+        const auto process = [&](u32 mesh_idx) {
+            process_fbx_mesh(fbx_scene->getMesh(int(mesh_idx)), processed[mesh_idx], process_stats[mesh_idx]);
+        };
+        if(pool) {
+            pool->parallel_for(mesh_count, process);
+        }
+        else {
+            for(u32 mesh_idx = 0; mesh_idx < mesh_count; ++mesh_idx)
+                process(mesh_idx);
+        }
+
+        // reduce per mesh results in source order
+        result.meshes.reserve(mesh_count);
+        for(u32 mesh_idx = 0; mesh_idx < mesh_count; ++mesh_idx) {
+            if(!processed[mesh_idx].empty())
+                result.stats.corner_count += fbx_scene->getMesh(int(mesh_idx))->getGeometry()->getIndexCount();
+            for(auto& data : processed[mesh_idx])
+                add_mesh(std::move(data));
+            result.stats.multi_material_mesh_count += process_stats[mesh_idx].multi_material_mesh_count;
+            result.stats.material_ms += process_stats[mesh_idx].material_ms;
+        }
+    }
+    result.aabb = aabb_hasvalue.first;
+
+    // index order from the exporters ignores the post-transform cache, every mesh is optimized on its own
+    std::vector<VertexCacheStats> before(result.meshes.size()), after(result.meshes.size());
+    const auto optimize = [&](u32 mesh_idx) {
+        auto& mesh = result.meshes[mesh_idx];
+        before[mesh_idx] = analyze_vertex_cache(mesh.indices, mesh.vertices.size());
+        if(options.optimize_meshes)
+            optimize_mesh(mesh);
+        after[mesh_idx] = analyze_vertex_cache(mesh.indices, mesh.vertices.size());
+    };
+    const auto for_each_mesh = [&](const std::function<void(u32)>& fn) {
+        if(pool) {
+            pool->parallel_for(u32(result.meshes.size()), fn);
+        }
+        else {
+            for(u32 mesh_idx = 0; mesh_idx < result.meshes.size(); ++mesh_idx)
+                fn(mesh_idx);
+        }
+    };
+    const auto optimize_start = std::chrono::steady_clock::now();
+    for_each_mesh(optimize);
+    for(size_t i = 0; i < result.meshes.size(); ++i) {
+        result.stats.vertex_cache_before += before[i];
+        result.stats.vertex_cache_after += after[i];
+    }
+
+    // simplified levels share the optimized vertices
+    const auto lod_start = std::chrono::steady_clock::now();
+    if(options.generate_lods)
+        for_each_mesh([&](u32 mesh_idx) { generate_lods(result.meshes[mesh_idx]); });
+    for(const auto& mesh : result.meshes) {
+        for(size_t lod = 0; lod < mesh.lods.size(); ++lod)
+            result.stats.lod_triangle_count[lod] += mesh.lods[lod].index_count / 3;
+        if(mesh.lods.empty())
+            result.stats.lod_triangle_count[0] += mesh.indices.size() / 3;
+    }
+
+
+    // tiny meshes cost a draw call each, after this there is roughly one per material
+    const auto merge_start = std::chrono::steady_clock::now();
+    result.stats.source_mesh_count = u32(result.meshes.size());
+    if(options.merge_meshes)
+        result.meshes = merge_meshes(std::move(result.meshes));
+
+    const auto end_time = std::chrono::steady_clock::now();
+    result.stats.optimize_ms = std::chrono::duration<float, std::milli>(lod_start - optimize_start).count();
+    result.stats.lod_ms = std::chrono::duration<float, std::milli>(merge_start - lod_start).count();
+    result.stats.merge_ms = std::chrono::duration<float, std::milli>(end_time - merge_start).count();
+    result.stats.process_ms = std::chrono::duration<float, std::milli>(end_time - process_start).count();
+    result.stats.thread_count = thread_count;
+
+    if(options.build_bvh)
+        build_model_bvh(result, pool);
+    if(options.build_occluders)
+        build_model_occluders(result);
+
+    if(options.use_cache) {
+        ModelCacheHeader header{};
+        header.source_hash = source_hash;
+        header.source_size = source_size;
+        header.flags = cache_flags;
+        header.aabb = result.aabb;
+        header.corner_count = result.stats.corner_count;
+        header.vertex_cache_before = result.stats.vertex_cache_before;
+        header.vertex_cache_after = result.stats.vertex_cache_after;
+        header.source_mesh_count = result.stats.source_mesh_count;
+        if(!ModelCache::write(cache_path, header, result.meshes))
+            printf("failed to write model cache %s\n", cache_path.c_str());
+    }
+
+    return result;
+}
+
+
+std::optional<Model> Model::load_from_file(const std::string& filename, const ModelLoadOptions& options) {
+    const auto start_time = std::chrono::steady_clock::now();
+
+    auto prepared = prepare_model(filename, options);
+    if(!prepared)
+        return std::nullopt;
+
+    // gpu resources are only created on this thread
     Model result;
-    //result.vertices = std::move(vertices);
-    //result.indices = std::move(indices);
-    //result.vbh = vbh;
-    //result.ibh = ibh;
-    result.mdt = std::move(mdt);
-    result.aabb = std::move(aabb_hasvalue.first);
+    for(u32 i = 0; i < prepared->mesh_count(); ++i)
+        upload_prepared_mesh(*prepared, i, result);
+    finish_model(result, *prepared, filename, start_time);
 
     return result;
 }
 
-std::shared_ptr<Model> Model::load_from_file_shared(const std::string& filename) {
-    std::optional<Model> result = load_from_file(filename);
+std::shared_ptr<Model> Model::load_from_file_shared(const std::string& filename, const ModelLoadOptions& options) {
+    std::optional<Model> result = load_from_file(filename, options);
     if(result.has_value()) {
         return std::make_shared<Model>(std::move(result.value()));
     }
@@ -194,3 +863,84 @@ std::shared_ptr<Model> Model::load_from_file_shared(const std::string& filename)
         return nullptr;
     }
 }
+
+
+struct AsyncLoad {
+    std::weak_ptr<Model> model;   // loads of models nobody holds anymore are dropped
+    std::string filename;
+    std::future<std::optional<PreparedModel>> pending;
+    std::optional<PreparedModel> prepared;
+    u32 next_mesh = 0;
+    std::chrono::steady_clock::time_point start_time;
+};
+
+// only touched from the thread driving bgfx
+static std::vector<std::unique_ptr<AsyncLoad>> s_async_loads;
+
+
+std::shared_ptr<Model> Model::load_async(const std::string& filename, const ModelLoadOptions& options) {
+    auto model = std::make_shared<Model>();
+    model->state = ModelState::Loading;
+
+    auto load = std::make_unique<AsyncLoad>();
+    load->model = model;
+    load->filename = filename;
+    load->start_time = std::chrono::steady_clock::now();
+    load->pending = ThreadPool::shared().submit([filename, options]() { return prepare_model(filename, options); });
+    s_async_loads.emplace_back(std::move(load));
+
+    return model;
+}
+
+void Model::process_async_loads(u64 byte_budget) {
+    u64 spent = 0;
+    for(auto it = s_async_loads.begin(); it != s_async_loads.end();) {
+        auto& load = **it;
+        const auto model = load.model.lock();
+        if(!model) {
+            it = s_async_loads.erase(it);
+            continue;
+        }
+
+        if(!load.prepared) {
+            if(load.pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                ++it;
+                continue;
+            }
+            load.prepared = load.pending.get();
+            if(!load.prepared) {
+                printf("failed to load %s\n", load.filename.c_str());
+                model->state = ModelState::Failed;
+                it = s_async_loads.erase(it);
+                continue;
+            }
+            // known before the first mesh is on the gpu
+            model->aabb = load.prepared->aabb;
+        }
+
+        // at least one mesh per frame so large meshes can't stall a load
+        auto& prepared = *load.prepared;
+        while(load.next_mesh < prepared.mesh_count() && (spent == 0 || spent < byte_budget)) {
+            spent += std::max<u64>(prepared.mesh_bytes(load.next_mesh), 1);
+            upload_prepared_mesh(prepared, load.next_mesh++, *model);
+        }
+
+        if(load.next_mesh == prepared.mesh_count()) {
+            finish_model(*model, prepared, load.filename, load.start_time);
+            model->state = ModelState::Ready;
+            it = s_async_loads.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void Model::cancel_async_loads() {
+    s_async_loads.clear();
+}
+
+
+u64 Model::referenced_bytes() {
+    return s_referenced_bytes.load();
+}
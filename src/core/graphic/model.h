@@ -1,6 +1,12 @@
 #pragma once
 
 #include "../types.h"
+#include "aabb.h"
+#include "vertex_format.h"
+#include "mesh_optimizer.h"
+#include "bvh.h"
+#include "occlusion.h"
+#include "frustum.h"
 
 #include <bgfx/bgfx.h>
 #include <glm/vec2.hpp>
@@ -14,6 +20,16 @@
 #include <memory>
 
 
+#define MAX_MESH_LODS 4
+
+// one level of detail, a range of the mesh's index buffer over the shared vertices
+struct MeshLod {
+    u32 index_offset;
+    u32 index_count;
+    float error;    // worst distance from the full detail surface in model units
+};
+
+
 // not a component
 // dirty code
 struct MeshDataTuple {
@@ -22,6 +38,13 @@ struct MeshDataTuple {
     glm::vec4 diffuse;
 
     glm::mat4 transform;
+
+    // u_vertex_dequant, all zero for float vertices, see pack_vertices
+    glm::vec4 dequant[2]{};
+
+    AABB aabb{};
+    u32 lod_count = 0;
+    MeshLod lods[MAX_MESH_LODS]{};
 };
 
 
@@ -30,16 +53,76 @@ struct Vertex {
     glm::vec3 normal;
     glm::vec2 uv;
 
-    static bgfx::VertexLayout get_layout();
+    static bgfx::VertexLayout get_layout(VertexFormat format = VertexFormat::Float);
+};
+
+
+// cpu side geometry of one mesh, welded and indexed, before it is uploaded
+struct MeshData {
+    std::vector<Vertex> vertices;
+    std::vector<u32> indices;
+    glm::vec4 diffuse;
+    AABB aabb{};
+    // indices holds every level back to back, empty means one level using all indices
+    std::vector<MeshLod> lods;
+
+    // 16 bit indices whenever the vertex count allows it
+    bool needs_index32() const { return vertices.size() > UINT16_MAX + 1; }
+};
+
+
+struct ModelLoadOptions {
+    u32 thread_count = 0;   // threads processing meshes, 0 uses the shared pool
+    bool use_cache = true;  // read and write the binary model cache
+    VertexFormat vertex_format = VertexFormat::Float;
+    bool optimize_meshes = true;    // vertex cache, overdraw and vertex fetch order
+    bool generate_lods = true;      // simplified levels of detail for every mesh
+    bool merge_meshes = true;       // batch meshes sharing a material into one draw
+    bool keep_cpu_geometry = false; // for analysis, see Model::cpu_meshes
+    bool build_bvh = true;          // ray queries, see Model::bvh
+    bool build_occluders = true;    // software occlusion culling, see Model::occluders
 };
 
 
-struct AABB {
-    glm::vec3 min, max;
+struct ModelLoadStats {
+    u32 mesh_count = 0;
+    u32 source_mesh_count = 0;  // before merging, one draw call each
+    u64 corner_count = 0;   // triangle corners in the source file
+    u64 vertex_count = 0;   // unique vertices after welding
+    u64 index_count = 0;
+    u32 index32_mesh_count = 0;
+    float load_ms = 0;
+    float process_ms = 0;   // part of load_ms spent converting meshes
+    float optimize_ms = 0;  // part of process_ms
+    VertexCacheStats vertex_cache_before;
+    VertexCacheStats vertex_cache_after;
+    float lod_ms = 0;       // part of process_ms
+    u64 lod_triangle_count[MAX_MESH_LODS] = {};
+    float merge_ms = 0;     // part of process_ms
+    u32 multi_material_mesh_count = 0;  // split into one mesh per material range
+    float material_ms = 0;  // bucketing triangles by material, summed over threads
+    u32 thread_count = 0;
+    bool from_cache = false;
+    VertexFormat vertex_format = VertexFormat::Float;
+    u64 vertex_bytes = 0;           // on the gpu, vertex_count * sizeof(Vertex) for float vertices
+    u64 index_bytes = 0;            // on the gpu
+    u64 cpu_bytes = 0;              // geometry kept in Model::cpu_meshes
+    u64 freed_cpu_bytes = 0;        // geometry dropped once bgfx was done uploading it
+    float bvh_ms = 0;               // part of load_ms
+    u64 bvh_bytes = 0;
+    float occluder_ms = 0;          // part of load_ms
+    float max_position_error = 0;   // introduced by quantization
 };
 
 
-// todo: load from asset manager
+enum class ModelState {
+    Loading,    // meshes are being processed or uploaded, mdt is incomplete
+    Ready,
+    Failed,
+};
+
+
+// shared instances come from Assets::model
 class Model final {
 public:
     Model() = default;
@@ -49,12 +132,20 @@ public:
     Model& operator=(Model&& other) noexcept;
     ~Model();
 
-    static std::optional<Model> load_from_file(const std::string& filename);
-    static std::shared_ptr<Model> load_from_file_shared(const std::string& filename);
+    static std::optional<Model> load_from_file(const std::string& filename, const ModelLoadOptions& options = {});
+    static std::shared_ptr<Model> load_from_file_shared(const std::string& filename, const ModelLoadOptions& options = {});
 
-private:
-    std::vector<Vertex> vertices;
-    std::vector<u16> indices;
+    // returns at once, the file is processed on the shared thread pool and
+    // uploaded over the next frames by process_async_loads
+    static std::shared_ptr<Model> load_async(const std::string& filename, const ModelLoadOptions& options = {});
+    // call once per frame on the bgfx thread, uploads roughly byte_budget of geometry
+    static void process_async_loads(u64 byte_budget = 8 << 20);
+    static void cancel_async_loads();
+    // geometry of every model handed to bgfx by reference that bgfx hasn't released yet
+    static u64 referenced_bytes();
+
+    bool is_ready() const { return state == ModelState::Ready; }
+    u64 gpu_bytes() const { return stats.vertex_bytes + stats.index_bytes; }
 
     // todo: move to MeshRenderer component
 public:
@@ -62,5 +153,18 @@ public:
     bgfx::IndexBufferHandle ibh = BGFX_INVALID_HANDLE;
 
     std::vector<MeshDataTuple> mdt;
-    AABB aabb;
+    // model space bounds of mdt in the same order, filled once the model is ready
+    AabbSoA mesh_bounds;
+    // diffuse of every mesh in load order, indexed by RayHit::mesh
+    std::vector<glm::vec4> mesh_diffuse;
+    // processed geometry in model space, only with ModelLoadOptions::keep_cpu_geometry,
+    // meshes are in load order, mdt can hold more entries where meshes had to be split
+    std::vector<std::shared_ptr<const MeshData>> cpu_meshes;
+    // full detail triangles in model space, RayHit::mesh indexes meshes in load order like cpu_meshes
+    std::shared_ptr<const Bvh> bvh;
+    // the largest full detail triangles in model space, rasterized by Systems::rendering to cull what they hide
+    std::shared_ptr<const OccluderMesh> occluders;
+    AABB aabb{};
+    ModelLoadStats stats;
+    ModelState state = ModelState::Ready;
 };
@@ -0,0 +1,149 @@
+#include "model_cache.h"
+
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <cstdio>
+
+
+static_assert(sizeof(ModelCacheHeader) % 16 == 0, "cache header must keep blobs aligned");
+static_assert(sizeof(ModelCacheMesh) % 16 == 0, "cache mesh table must keep blobs aligned");
+
+
+u64 ModelCache::hash_file(const std::string& path, u64* size) {
+    MappedFile source(path.c_str());
+    if(size)
+        *size = source.size();
+    if(!source.is_valid())
+        return 0;
+
+    // 64 bit multiply-xorshift over 8 byte words, tail folded in bytewise
+    const u64 k = 0x9e3779b97f4a7c15ull;
+    u64 h = k ^ source.size();
+    const size_t words = source.size() / 8;
+    for(size_t i = 0; i < words; ++i) {
+        u64 w;
+        std::memcpy(&w, source.data() + i * 8, 8);
+        h = (h ^ w) * k;
+        h ^= h >> 29;
+    }
+    for(size_t i = words * 8; i < source.size(); ++i)
+        h = (h ^ source.data()[i]) * k;
+
+    return h ^ (h >> 32);
+}
+
+
+std::shared_ptr<ModelCache> ModelCache::open(const std::string& cache_path, u64 source_hash, u64 source_size, u32 flags) {
+    auto result = std::make_shared<ModelCache>();
+    result->file = MappedFile(cache_path.c_str());
+    if(!result->file.is_valid() || result->file.size() < sizeof(ModelCacheHeader))
+        return nullptr;
+
+    const auto& header = result->header();
+    if(header.magic != MODEL_CACHE_MAGIC || header.version != MODEL_CACHE_VERSION
+       || header.source_hash != source_hash || header.source_size != source_size || header.flags != flags)
+        return nullptr;
+
+    const u64 file_size = result->file.size();
+    if(sizeof(ModelCacheHeader) + u64(header.mesh_count) * sizeof(ModelCacheMesh) > file_size)
+        return nullptr;
+
+    for(u32 i = 0; i < header.mesh_count; ++i) {
+        const auto& mesh = result->mesh(i);
+        if((mesh.index_size != 2 && mesh.index_size != 4)
+           || mesh.vertex_offset + u64(mesh.vertex_count) * sizeof(Vertex) > file_size
+           || mesh.index_offset + u64(mesh.index_count) * mesh.index_size > file_size
+           || mesh.lod_count == 0 || mesh.lod_count > MAX_MESH_LODS)
+            return nullptr;
+        for(u32 lod = 0; lod < mesh.lod_count; ++lod)
+            if(u64(mesh.lods[lod].index_offset) + mesh.lods[lod].index_count > mesh.index_count)
+                return nullptr;
+    }
+
+    return result;
+}
+
+
+bool ModelCache::write(const std::string& cache_path, ModelCacheHeader header, const std::vector<MeshData>& meshes) {
+    const auto align = [](u64 offset) { return (offset + 15) & ~u64(15); };
+
+    header.magic = MODEL_CACHE_MAGIC;
+    header.version = MODEL_CACHE_VERSION;
+    header.mesh_count = u32(meshes.size());
+
+    std::vector<ModelCacheMesh> table(meshes.size());
+    u64 offset = sizeof(ModelCacheHeader) + sizeof(ModelCacheMesh) * table.size();
+    for(size_t i = 0; i < meshes.size(); ++i) {
+        const auto& mesh = meshes[i];
+        auto& entry = table[i];
+        entry = ModelCacheMesh{};
+        entry.vertex_count = u32(mesh.vertices.size());
+        entry.index_count = u32(mesh.indices.size());
+        entry.index_size = mesh.needs_index32() ? 4 : 2;
+        entry.diffuse = mesh.diffuse;
+        entry.aabb = mesh.aabb;
+        if(mesh.lods.empty()) {
+            entry.lod_count = 1;
+            entry.lods[0] = MeshLod{0, entry.index_count, 0.0f};
+        }
+        else {
+            entry.lod_count = u32(std::min<size_t>(mesh.lods.size(), MAX_MESH_LODS));
+            std::copy(mesh.lods.begin(), mesh.lods.begin() + entry.lod_count, entry.lods);
+        }
+
+        entry.vertex_offset = offset;
+        offset = align(offset + u64(entry.vertex_count) * sizeof(Vertex));
+        entry.index_offset = offset;
+        offset = align(offset + u64(entry.index_count) * entry.index_size);
+    }
+
+    // write to a temporary first so a crash never leaves a truncated cache behind, every writer
+    // has its own so concurrent loads of one file never interleave before the rename
+    static std::atomic<u32> s_writer_count{0};
+    const size_t thread_hash = std::hash<std::thread::id>()(std::this_thread::get_id());
+    const std::string tmp_path = cache_path + "." + std::to_string(thread_hash) + "." + std::to_string(s_writer_count++) + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if(!out.is_open())
+            return false;
+
+        const char zeros[16] = {};
+        const auto pad = [&]() {
+            const auto pos = u64(out.tellp());
+            out.write(zeros, std::streamsize(align(pos) - pos));
+        };
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(table.data()), std::streamsize(sizeof(ModelCacheMesh) * table.size()));
+        std::vector<u16> indices16;
+        for(size_t i = 0; i < meshes.size(); ++i) {
+            const auto& mesh = meshes[i];
+            out.write(reinterpret_cast<const char*>(mesh.vertices.data()), std::streamsize(sizeof(Vertex) * mesh.vertices.size()));
+            pad();
+            if(table[i].index_size == 4) {
+                out.write(reinterpret_cast<const char*>(mesh.indices.data()), std::streamsize(sizeof(u32) * mesh.indices.size()));
+            }
+            else {
+                indices16.assign(mesh.indices.begin(), mesh.indices.end());
+                out.write(reinterpret_cast<const char*>(indices16.data()), std::streamsize(sizeof(u16) * indices16.size()));
+            }
+            pad();
+        }
+        if(!out.good()) {
+            out.close();
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+    }
+
+    std::remove(cache_path.c_str());
+    if(std::rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "../types.h"
+#include "../mapped_file.h"
+#include "model.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+
+
+// Binary cache of a processed model, written next to the source file.
+// Layout: header, mesh table, then vertex/index blobs aligned to 16 bytes.
+// Blobs are already in the final gpu format so buffers can be created from the mapping directly.
+
+#define MODEL_CACHE_MAGIC 0x434c444du // "MDLC" in file byte order
+#define MODEL_CACHE_VERSION 5
+
+// how the meshes were processed, a cache only serves loads asking for the same
+#define MODEL_CACHE_FLAG_OPTIMIZED 0x1u
+#define MODEL_CACHE_FLAG_LODS 0x2u
+#define MODEL_CACHE_FLAG_MERGED 0x4u
+
+struct ModelCacheHeader {
+    u32 magic;
+    u32 version;
+    u64 source_hash;
+    u64 source_size;
+    u32 mesh_count;
+    u32 flags;
+    AABB aabb;
+    u64 corner_count; // before welding, for load stats
+    VertexCacheStats vertex_cache_before;
+    VertexCacheStats vertex_cache_after;
+    u32 source_mesh_count;  // before merging
+    u32 _pad0[3];
+};
+
+struct ModelCacheMesh {
+    u64 vertex_offset;  // from the beginning of the file
+    u64 index_offset;
+    u32 vertex_count;
+    u32 index_count;
+    u32 index_size;     // 2 or 4
+    u32 lod_count;      // at least 1, ranges of the index blob
+    glm::vec4 diffuse;
+    AABB aabb;
+    MeshLod lods[MAX_MESH_LODS];
+    u32 _pad0[2];
+};
+
+
+class ModelCache {
+public:
+    // maps and validates `cache_path`, nullptr if missing, stale or corrupt
+    static std::shared_ptr<ModelCache> open(const std::string& cache_path, u64 source_hash, u64 source_size, u32 flags);
+    // magic, version and mesh_count of header are filled in here
+    static bool write(const std::string& cache_path, ModelCacheHeader header, const std::vector<MeshData>& meshes);
+
+    static std::string path_for(const std::string& source_path) { return source_path + ".cache"; }
+    // content hash of a file, 0 if it can't be read
+    static u64 hash_file(const std::string& path, u64* size = nullptr);
+
+    const ModelCacheHeader& header() const { return *reinterpret_cast<const ModelCacheHeader*>(file.data()); }
+    const ModelCacheMesh& mesh(u32 i) const { return reinterpret_cast<const ModelCacheMesh*>(file.data() + sizeof(ModelCacheHeader))[i]; }
+    const u8* data() const { return file.data(); }
+
+private:
+    MappedFile file;
+};
@@ -0,0 +1,591 @@
+#include "obj_loader.h"
+#include "../mapped_file.h"
+#include "../thread_pool.h"
+#include <glm/geometric.hpp>
+#include <tinyobjloader/tiny_obj_loader.h>
+#include <filesystem>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+
+
+namespace {
+
+// attribute references of one triangle corner
+// while parsing: > 0 absolute (1 based), < 0 chunk local (-value - 1), 0 absent
+// after merging: 0 based global index, -1 absent
+struct ObjCorner {
+    i32 v, vt, vn;
+};
+
+struct ObjMaterialRun {
+    u64 first_triangle;     // chunk local
+    std::string name;
+};
+
+// relative reference reaching back into an earlier chunk
+struct ObjFarRef {
+    u64 slot;               // corner * 3 + attribute
+    i64 local;              // negative, relative to the first element of the chunk
+};
+
+struct ObjChunk {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec2> uvs;
+    std::vector<ObjCorner> corners;
+    std::vector<ObjMaterialRun> materials;
+    std::vector<std::string> libraries;
+    std::vector<ObjFarRef> far_refs;
+    const char* error = nullptr;
+};
+
+} // namespace
+
+
+static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+static const char* skip_space(const char* p, const char* end) {
+    while(p < end && is_space(*p))
+        ++p;
+    return p;
+}
+
+
+// fast path for the plain decimal notation exporters write, anything else goes through strtod
+static const char* parse_float(const char* p, const char* end, float& out) {
+    static const double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    p = skip_space(p, end);
+    const char* start = p;
+
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    u64 mantissa = 0;
+    i32 digits = 0;
+    i32 exponent = 0;
+    bool any_digit = false;
+    for(; p < end && is_digit(*p); ++p) {
+        any_digit = true;
+        if(digits < 19) {
+            mantissa = mantissa * 10 + u64(*p - '0');
+            digits += mantissa != 0;
+        }
+        else {
+            ++exponent;
+        }
+    }
+    if(p < end && *p == '.') {
+        for(++p; p < end && is_digit(*p); ++p) {
+            any_digit = true;
+            if(digits < 19) {
+                mantissa = mantissa * 10 + u64(*p - '0');
+                digits += mantissa != 0;
+                --exponent;
+            }
+        }
+    }
+    if(any_digit && p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool exp_negative = false;
+        if(q < end && (*q == '-' || *q == '+'))
+            exp_negative = *q++ == '-';
+        if(q < end && is_digit(*q)) {
+            i32 value = 0;
+            for(; q < end && is_digit(*q); ++q)
+                value = std::min(value * 10 + (*q - '0'), 10000);
+            exponent += exp_negative ? -value : value;
+            p = q;
+        }
+    }
+
+    // exact when both the mantissa and the power of ten are representable
+    if(any_digit && mantissa < (u64(1) << 53) && exponent >= -22 && exponent <= 22) {
+        double value = double(mantissa);
+        value = exponent < 0 ? value / pow10[-exponent] : value * pow10[exponent];
+        out = float(negative ? -value : value);
+        return p;
+    }
+
+    char buffer[128];
+    const auto length = std::min<size_t>(size_t(end - start), sizeof(buffer) - 1);
+    std::memcpy(buffer, start, length);
+    buffer[length] = 0;
+    char* parsed_end = nullptr;
+    out = std::strtof(buffer, &parsed_end);
+    return parsed_end == buffer ? nullptr : start + (parsed_end - buffer);
+}
+
+
+static const char* parse_int(const char* p, const char* end, i64& out) {
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    if(p == end || !is_digit(*p))
+        return nullptr;
+
+    i64 value = 0;
+    for(; p < end && is_digit(*p); ++p)
+        value = std::min<i64>(value * 10 + (*p - '0'), INT64_MAX / 16);
+    out = negative ? -value : value;
+    return p;
+}
+
+
+// rest of the line without surrounding whitespace
+static std::string parse_name(const char* p, const char* end) {
+    p = skip_space(p, end);
+    while(end > p && is_space(end[-1]))
+        --end;
+    return std::string(p, end);
+}
+
+
+namespace {
+
+// one corner of a polygon before triangulation
+struct ObjPolygonCorner {
+    ObjCorner corner;
+    i64 far[3];             // see ObjFarRef, 0 when the attribute is resolved within the chunk
+};
+
+} // namespace
+
+// stores an obj index with the encoding described at ObjCorner, false if it is invalid
+static bool encode_index(i64 index, u64 local_count, i32& out, i64& far) {
+    out = 0;
+    far = 0;
+    if(index > 0) {
+        if(index > INT32_MAX)
+            return false;
+        out = i32(index);
+        return true;
+    }
+    if(index == 0)
+        return false;
+
+    const i64 local = i64(local_count) + index;
+    if(local >= INT32_MAX)
+        return false;
+    if(local >= 0)
+        out = i32(-local - 1);
+    else
+        far = local;
+    return true;
+}
+
+
+static const char* parse_face(ObjChunk& chunk, const char* p, const char* end, std::vector<ObjPolygonCorner>& polygon) {
+    polygon.clear();
+    while(true) {
+        p = skip_space(p, end);
+        if(p == end)
+            break;
+
+        i64 v = 0, vt = 0, vn = 0;
+        if(!(p = parse_int(p, end, v)))
+            return nullptr;
+        if(p < end && *p == '/') {
+            ++p;
+            if(p < end && *p != '/' && !(p = parse_int(p, end, vt)))
+                return nullptr;
+            if(p < end && *p == '/' && !(p = parse_int(p + 1, end, vn)))
+                return nullptr;
+        }
+
+        ObjPolygonCorner corner{{0, 0, 0}, {0, 0, 0}};
+        if(!encode_index(v, chunk.positions.size(), corner.corner.v, corner.far[0]))
+            return nullptr;
+        if(vt != 0 && !encode_index(vt, chunk.uvs.size(), corner.corner.vt, corner.far[1]))
+            return nullptr;
+        if(vn != 0 && !encode_index(vn, chunk.normals.size(), corner.corner.vn, corner.far[2]))
+            return nullptr;
+        polygon.push_back(corner);
+    }
+    if(polygon.size() < 3)
+        return polygon.empty() ? nullptr : end;
+
+    const auto emit = [&](const ObjPolygonCorner& corner) {
+        const u64 slot = chunk.corners.size() * 3;
+        for(u64 attribute = 0; attribute < 3; ++attribute)
+            if(corner.far[attribute])
+                chunk.far_refs.push_back({slot + attribute, corner.far[attribute]});
+        chunk.corners.push_back(corner.corner);
+    };
+
+    // fan triangulation, convex polygons are by far the common case
+    for(size_t k = 2; k < polygon.size(); ++k) {
+        emit(polygon[0]);
+        emit(polygon[k - 1]);
+        emit(polygon[k]);
+    }
+    return end;
+}
+
+
+static void parse_chunk(ObjChunk& chunk, const char* begin, const char* end) {
+    std::vector<ObjPolygonCorner> polygon;
+    for(const char* line = begin; line < end;) {
+        const char* line_end = static_cast<const char*>(std::memchr(line, '\n', size_t(end - line)));
+        line_end = line_end ? line_end : end;
+        const char* p = skip_space(line, line_end);
+        const auto remaining = line_end - p;
+
+        bool ok = true;
+        if(remaining >= 2 && p[0] == 'v' && is_space(p[1])) {
+            glm::vec3 position;
+            p = parse_float(p + 2, line_end, position.x);
+            p = p ? parse_float(p, line_end, position.y) : nullptr;
+            p = p ? parse_float(p, line_end, position.z) : nullptr;
+            ok = p != nullptr;
+            chunk.positions.push_back(position);
+        }
+        else if(remaining >= 3 && p[0] == 'v' && p[1] == 'n' && is_space(p[2])) {
+            glm::vec3 normal;
+            p = parse_float(p + 3, line_end, normal.x);
+            p = p ? parse_float(p, line_end, normal.y) : nullptr;
+            p = p ? parse_float(p, line_end, normal.z) : nullptr;
+            ok = p != nullptr;
+            chunk.normals.push_back(normal);
+        }
+        else if(remaining >= 3 && p[0] == 'v' && p[1] == 't' && is_space(p[2])) {
+            glm::vec2 uv{0, 0};
+            p = parse_float(p + 3, line_end, uv.x);
+            // a lone u is allowed
+            if(p && skip_space(p, line_end) != line_end)
+                p = parse_float(p, line_end, uv.y);
+            ok = p != nullptr;
+            chunk.uvs.push_back(uv);
+        }
+        else if(remaining >= 2 && p[0] == 'f' && is_space(p[1])) {
+            ok = parse_face(chunk, p + 2, line_end, polygon) != nullptr;
+        }
+        else if(remaining >= 7 && std::memcmp(p, "usemtl", 6) == 0 && is_space(p[6])) {
+            chunk.materials.push_back({chunk.corners.size() / 3, parse_name(p + 7, line_end)});
+        }
+        else if(remaining >= 7 && std::memcmp(p, "mtllib", 6) == 0 && is_space(p[6])) {
+            chunk.libraries.push_back(parse_name(p + 7, line_end));
+        }
+        // comments, groups, smoothing groups, lines and points are ignored
+
+        if(!ok) {
+            chunk.error = line;
+            return;
+        }
+        line = line_end + 1;
+    }
+}
+
+
+// diffuse colors of the materials declared in a .mtl file
+static void load_mtl(const std::filesystem::path& path, std::unordered_map<std::string, glm::vec4>& diffuse) {
+    MappedFile file(path.string().c_str());
+    if(!file.is_valid()) {
+        printf("failed to open material library %s\n", path.string().c_str());
+        return;
+    }
+
+    const char* end = reinterpret_cast<const char*>(file.data()) + file.size();
+    std::string current;
+    for(const char* line = reinterpret_cast<const char*>(file.data()); line < end;) {
+        const char* line_end = static_cast<const char*>(std::memchr(line, '\n', size_t(end - line)));
+        line_end = line_end ? line_end : end;
+        const char* p = skip_space(line, line_end);
+
+        if(line_end - p >= 7 && std::memcmp(p, "newmtl", 6) == 0 && is_space(p[6])) {
+            current = parse_name(p + 7, line_end);
+            diffuse[current] = {.9, .6, .8, 1};
+        }
+        else if(line_end - p >= 3 && p[0] == 'K' && p[1] == 'd' && is_space(p[2]) && !current.empty()) {
+            glm::vec4 color{0, 0, 0, 1};
+            p = parse_float(p + 3, line_end, color.x);
+            p = p ? parse_float(p, line_end, color.y) : nullptr;
+            p = p ? parse_float(p, line_end, color.z) : nullptr;
+            if(p)
+                diffuse[current] = color;
+        }
+        line = line_end + 1;
+    }
+}
+
+
+namespace {
+
+// open addressing, keyed by the resolved attribute triple
+struct CornerWelder {
+    struct Slot {
+        ObjCorner key;
+        u32 vertex;
+    };
+    std::vector<Slot> slots;
+    u64 mask;
+
+    explicit CornerWelder(u64 corner_count) {
+        u64 capacity = 16;
+        while(capacity < corner_count * 2)
+            capacity *= 2;
+        slots.assign(capacity, Slot{{-1, -1, -1}, UINT32_MAX});
+        mask = capacity - 1;
+    }
+
+    // index of the vertex for key, inserted as next_vertex if new
+    std::pair<u32, bool> find_or_insert(const ObjCorner& key, u32 next_vertex) {
+        u64 h = (u64(u32(key.v)) * 0x9E3779B97F4A7C15ull) ^ (u64(u32(key.vt)) * 0xC2B2AE3D27D4EB4Full) ^ (u64(u32(key.vn)) * 0x165667B19E3779F9ull);
+        h ^= h >> 29;
+        for(u64 i = h & mask;; i = (i + 1) & mask) {
+            auto& slot = slots[i];
+            if(slot.vertex == UINT32_MAX) {
+                slot = {key, next_vertex};
+                return {next_vertex, true};
+            }
+            if(slot.key.v == key.v && slot.key.vt == key.vt && slot.key.vn == key.vn)
+                return {slot.vertex, false};
+        }
+    }
+};
+
+} // namespace
+
+
+std::optional<ObjLoadResult> load_obj(const std::string& filename, ThreadPool* pool) {
+    const auto for_each = [pool](u32 count, const std::function<void(u32)>& fn) {
+        if(pool) {
+            pool->parallel_for(count, fn);
+        }
+        else {
+            for(u32 i = 0; i < count; ++i)
+                fn(i);
+        }
+    };
+
+    const auto start_time = std::chrono::steady_clock::now();
+    ObjLoadResult result;
+
+    MappedFile file(filename.c_str());
+    if(!file.is_valid()) {
+        printf("failed to open %s\n", filename.c_str());
+        return std::nullopt;
+    }
+    const char* data = reinterpret_cast<const char*>(file.data());
+    const size_t size = file.size();
+    result.file_size = size;
+
+    // about a megabyte per chunk, with enough chunks to balance uneven lines across threads
+    const u32 threads = pool ? pool->worker_count() + 1 : 1;
+    const u32 chunk_count = u32(std::clamp<size_t>(size >> 20, 1, size_t(threads) * 8));
+    std::vector<const char*> bounds(chunk_count + 1);
+    bounds[0] = data;
+    bounds[chunk_count] = data + size;
+    for(u32 i = 1; i < chunk_count; ++i) {
+        const char* p = std::max(data + size * i / chunk_count, bounds[i - 1]);
+        const char* newline = static_cast<const char*>(std::memchr(p, '\n', size_t(data + size - p)));
+        bounds[i] = newline ? newline + 1 : data + size;
+    }
+
+    std::vector<ObjChunk> chunks(chunk_count);
+    for_each(chunk_count, [&](u32 i) { parse_chunk(chunks[i], bounds[i], bounds[i + 1]); });
+
+    for(u32 i = 0; i < chunk_count; ++i) {
+        if(chunks[i].error) {
+            const char* line_end = static_cast<const char*>(std::memchr(chunks[i].error, '\n', size_t(data + size - chunks[i].error)));
+            const auto line = std::string(chunks[i].error, line_end ? line_end : data + size);
+            printf("failed to parse %s at byte %llu: %s\n",
+                   filename.c_str(),
+                   (unsigned long long)(chunks[i].error - data),
+                   line.substr(0, 80).c_str());
+            return std::nullopt;
+        }
+    }
+
+    // prefix sums place every chunk in the global attribute arrays
+    struct ChunkBase { u64 position, normal, uv, corner; };
+    std::vector<ChunkBase> bases(chunk_count + 1, ChunkBase{0, 0, 0, 0});
+    for(u32 i = 0; i < chunk_count; ++i) {
+        bases[i + 1].position = bases[i].position + chunks[i].positions.size();
+        bases[i + 1].normal = bases[i].normal + chunks[i].normals.size();
+        bases[i + 1].uv = bases[i].uv + chunks[i].uvs.size();
+        bases[i + 1].corner = bases[i].corner + chunks[i].corners.size();
+    }
+    const auto& totals = bases[chunk_count];
+    if(totals.position > INT32_MAX || totals.normal > INT32_MAX || totals.uv > INT32_MAX || totals.corner / 3 > UINT32_MAX) {
+        printf("%s is too large\n", filename.c_str());
+        return std::nullopt;
+    }
+
+    std::vector<glm::vec3> positions(totals.position);
+    std::vector<glm::vec3> normals(totals.normal);
+    std::vector<glm::vec2> uvs(totals.uv);
+    std::vector<ObjCorner> corners(totals.corner);
+    std::vector<u8> chunk_failed(chunk_count, 0);
+
+    for_each(chunk_count, [&](u32 i) {
+        auto& chunk = chunks[i];
+        const auto& base = bases[i];
+        std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + base.position);
+        std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + base.normal);
+        std::copy(chunk.uvs.begin(), chunk.uvs.end(), uvs.begin() + base.uv);
+
+        const auto resolve = [](i32 value, u64 chunk_base, u64 total, bool& failed) {
+            const i64 index = value > 0 ? i64(value) - 1 : value < 0 ? i64(chunk_base) - value - 1 : -1;
+            failed |= index >= i64(total);
+            return i32(index);
+        };
+
+        bool failed = false;
+        auto* out = corners.data() + base.corner;
+        for(const auto& corner : chunk.corners) {
+            *out++ = {
+                resolve(corner.v, base.position, totals.position, failed),
+                resolve(corner.vt, base.uv, totals.uv, failed),
+                resolve(corner.vn, base.normal, totals.normal, failed),
+            };
+        }
+        for(const auto& ref : chunk.far_refs) {
+            const u64 chunk_base[] = {base.position, base.uv, base.normal};
+            const i64 index = i64(chunk_base[ref.slot % 3]) + ref.local;
+            failed |= index < 0;
+            auto& corner = corners[base.corner + ref.slot / 3];
+            (ref.slot % 3 == 0 ? corner.v : ref.slot % 3 == 1 ? corner.vt : corner.vn) = i32(std::max<i64>(index, -1));
+        }
+
+        chunk.positions = {};
+        chunk.normals = {};
+        chunk.uvs = {};
+        chunk.corners = {};
+        chunk_failed[i] = failed;
+    });
+
+    if(std::find(chunk_failed.begin(), chunk_failed.end(), 1) != chunk_failed.end()) {
+        printf("%s references vertices that don't exist\n", filename.c_str());
+        return std::nullopt;
+    }
+
+    result.corner_count = corners.size();
+    result.parse_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+    const auto build_start = std::chrono::steady_clock::now();
+
+    // materials, a chunk continues with the material active at the end of the previous one
+    std::unordered_map<std::string, glm::vec4> library;
+    const auto directory = std::filesystem::path(filename).parent_path();
+    for(const auto& chunk : chunks)
+        for(const auto& name : chunk.libraries)
+            load_mtl(directory / name, library);
+
+    std::vector<std::string> material_names{""};
+    std::unordered_map<std::string, u32> material_ids{{"", 0}};
+    // [first, last) triangle ranges per material
+    std::vector<std::vector<std::pair<u64, u64>>> material_ranges(1);
+    u32 current = 0;
+    u64 run_start = 0;
+    for(u32 i = 0; i < chunk_count; ++i) {
+        for(const auto& run : chunks[i].materials) {
+            const u64 tri = bases[i].corner / 3 + run.first_triangle;
+            if(tri > run_start)
+                material_ranges[current].emplace_back(run_start, tri);
+            run_start = tri;
+
+            const auto [it, inserted] = material_ids.try_emplace(run.name, u32(material_names.size()));
+            if(inserted) {
+                material_names.push_back(run.name);
+                material_ranges.emplace_back();
+            }
+            current = it->second;
+        }
+    }
+    if(totals.corner / 3 > run_start)
+        material_ranges[current].emplace_back(run_start, totals.corner / 3);
+    chunks.clear();
+
+    // smooth normals for corners the file gives none
+    std::vector<glm::vec3> generated;
+    if(std::any_of(corners.begin(), corners.end(), [](const ObjCorner& c) { return c.vn < 0; })) {
+        generated.assign(positions.size(), glm::vec3(0));
+        for(size_t c = 0; c + 2 < corners.size(); c += 3) {
+            const auto& a = positions[corners[c].v];
+            const auto& b = positions[corners[c + 1].v];
+            const auto& d = positions[corners[c + 2].v];
+            const auto face_normal = glm::cross(b - a, d - a);   // area weighted
+            for(size_t k = 0; k < 3; ++k)
+                if(corners[c + k].vn < 0)
+                    generated[corners[c + k].v] += face_normal;
+        }
+        for(auto& n : generated) {
+            const float length = glm::length(n);
+            n = length > 0 ? n / length : glm::vec3(0, 1, 0);
+        }
+    }
+
+    // one mesh per material, welded on the attribute triple
+    std::vector<MeshData> meshes(material_names.size());
+    for_each(u32(meshes.size()), [&](u32 m) {
+        const auto& ranges = material_ranges[m];
+        u64 triangle_count = 0;
+        for(const auto& [first, last] : ranges)
+            triangle_count += last - first;
+        if(triangle_count == 0)
+            return;
+
+        MeshData& mesh = meshes[m];
+        const auto it = library.find(material_names[m]);
+        mesh.diffuse = it != library.end() ? it->second : glm::vec4{.9, .6, .8, 1};
+        mesh.indices.reserve(triangle_count * 3);
+
+        CornerWelder welder(triangle_count * 3);
+        for(const auto& [first, last] : ranges) {
+            for(u64 c = first * 3; c < last * 3; ++c) {
+                const auto& corner = corners[c];
+                const auto [index, inserted] = welder.find_or_insert(corner, u32(mesh.vertices.size()));
+                if(inserted) {
+                    const auto& position = positions[corner.v];
+                    mesh.vertices.push_back(Vertex{
+                        position,
+                        corner.vn >= 0 ? normals[corner.vn] : generated[corner.v],
+                        corner.vt >= 0 ? uvs[corner.vt] : glm::vec2{0, 0},
+                    });
+                    if(index > 0) {
+                        mesh.aabb.min = glm::min(mesh.aabb.min, position);
+                        mesh.aabb.max = glm::max(mesh.aabb.max, position);
+                    }
+                    else {
+                        mesh.aabb = {position, position};
+                    }
+                }
+                mesh.indices.push_back(index);
+            }
+        }
+    });
+
+    for(auto& mesh : meshes)
+        if(!mesh.indices.empty())
+            result.meshes.emplace_back(std::move(mesh));
+
+    result.build_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - build_start).count();
+    return result;
+}
+
+
+float benchmark_tinyobj(const std::string& filename) {
+    const auto start_time = std::chrono::steady_clock::now();
+
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warn, err;
+    const auto directory = std::filesystem::path(filename).parent_path().string() + "/";
+    if(!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename.c_str(), directory.c_str(), true)) {
+        printf("tinyobjloader failed to load %s: %s\n", filename.c_str(), err.c_str());
+        return -1;
+    }
+
+    return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "model.h"
+
+#include <string>
+#include <vector>
+#include <optional>
+
+class ThreadPool;
+
+
+struct ObjLoadResult {
+    std::vector<MeshData> meshes;   // one welded mesh per material
+    u64 corner_count = 0;           // triangle corners before welding
+    u64 file_size = 0;
+    float parse_ms = 0;             // mapping, chunked parsing and merging
+    float build_ms = 0;             // welding into meshes
+};
+
+
+// Wavefront obj loader for very large files: the file is mapped, cut into line aligned
+// chunks that are parsed in parallel, then merged and welded per material.
+// Polygons are fan triangulated, negative (relative) indices are supported.
+// Runs on the calling thread only when pool is null.
+std::optional<ObjLoadResult> load_obj(const std::string& filename, ThreadPool* pool);
+
+// parse time of the same file through tinyobjloader in ms, negative on failure
+float benchmark_tinyobj(const std::string& filename);
@@ -0,0 +1,279 @@
+#include "occlusion.h"
+#include "bvh.h"
+#include "model.h"
+#include "../thread_pool.h"
+
+#include <glm/vec4.hpp>
+#include <glm/geometric.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define OCCLUSION_RASTER_SSE 1
+#endif
+
+
+// a triangle of one of the input meshes, ranked by area
+struct OccluderCandidate {
+    float area;
+    u32 mesh;
+    u32 triangle;
+};
+
+
+static u32 index_at(const BvhMeshInput& mesh, u32 i) {
+    return mesh.index_size == 4 ? static_cast<const u32*>(mesh.indices)[i] : u32(static_cast<const u16*>(mesh.indices)[i]);
+}
+
+
+OccluderMesh build_occluders(const std::vector<BvhMeshInput>& meshes, u32 max_triangles) {
+    std::vector<OccluderCandidate> candidates;
+    for(u32 m = 0; m < meshes.size(); ++m) {
+        const auto& mesh = meshes[m];
+        for(u32 t = 0; t < mesh.index_count / 3; ++t) {
+            const glm::vec3& a = mesh.vertices[index_at(mesh, t * 3 + 0)].position;
+            const glm::vec3& b = mesh.vertices[index_at(mesh, t * 3 + 1)].position;
+            const glm::vec3& c = mesh.vertices[index_at(mesh, t * 3 + 2)].position;
+            const float area = glm::length(glm::cross(b - a, c - a)) * 0.5f;
+            if(area > 0.0f)
+                candidates.push_back({area, m, t});
+        }
+    }
+
+    const auto larger = [](const OccluderCandidate& a, const OccluderCandidate& b) { return a.area > b.area; };
+    if(candidates.size() > max_triangles) {
+        std::nth_element(candidates.begin(), candidates.begin() + max_triangles, candidates.end(), larger);
+        candidates.resize(max_triangles);
+    }
+
+    OccluderMesh result;
+    result.vertices.reserve(candidates.size() * 3);
+    result.min_area = candidates.empty() ? 0.0f : FLT_MAX;
+    for(const auto& candidate : candidates) {
+        const auto& mesh = meshes[candidate.mesh];
+        for(u32 corner = 0; corner < 3; ++corner)
+            result.vertices.push_back(mesh.vertices[index_at(mesh, candidate.triangle * 3 + corner)].position);
+        result.min_area = std::min(result.min_area, candidate.area);
+    }
+    return result;
+}
+
+
+void OcclusionBuffer::begin(u32 width, u32 height, const glm::mat4& view_proj) {
+    this->view_proj = view_proj;
+    tiles_x = std::max((width + TILE_WIDTH - 1) / TILE_WIDTH, 1u);
+    tiles_y = std::max((height + TILE_HEIGHT - 1) / TILE_HEIGHT, 1u);
+    size_x = tiles_x * TILE_WIDTH;
+    size_y = tiles_y * TILE_HEIGHT;
+
+    triangles.clear();
+    bins.resize(tiles_x * tiles_y);
+    for(auto& bin : bins)
+        bin.clear();
+    for(u32 i = 0; i < OCCLUSION_HIZ_LEVELS; ++i)
+        levels[i].assign((size_x >> i) * (size_y >> i), 1.0f);
+}
+
+
+u32 OcclusionBuffer::add_occluder(const OccluderMesh& mesh, const glm::mat4& model) {
+    const glm::mat4 mvp = view_proj * model;
+    const float width = float(size_x), height = float(size_y);
+    u32 added = 0;
+    for(size_t i = 0; i + 2 < mesh.vertices.size(); i += 3) {
+        glm::vec4 clip[3];
+        bool crosses_near = false;
+        for(u32 corner = 0; corner < 3; ++corner) {
+            clip[corner] = mvp * glm::vec4(mesh.vertices[i + corner], 1.0f);
+            crosses_near |= clip[corner].z < 0.0f || clip[corner].w <= 0.0f;
+        }
+        // clipping would add triangles, dropping it only makes the buffer see less
+        if(crosses_near)
+            continue;
+        if((clip[0].x > clip[0].w && clip[1].x > clip[1].w && clip[2].x > clip[2].w)
+        || (clip[0].x < -clip[0].w && clip[1].x < -clip[1].w && clip[2].x < -clip[2].w)
+        || (clip[0].y > clip[0].w && clip[1].y > clip[1].w && clip[2].y > clip[2].w)
+        || (clip[0].y < -clip[0].w && clip[1].y < -clip[1].w && clip[2].y < -clip[2].w)
+        || (clip[0].z > clip[0].w && clip[1].z > clip[1].w && clip[2].z > clip[2].w))
+            continue;
+
+        float x[3], y[3], z[3];
+        for(u32 corner = 0; corner < 3; ++corner) {
+            const float inv_w = 1.0f / clip[corner].w;
+            x[corner] = (clip[corner].x * inv_w * 0.5f + 0.5f) * width;
+            y[corner] = (0.5f - clip[corner].y * inv_w * 0.5f) * height;
+            z[corner] = clip[corner].z * inv_w;
+        }
+
+        // occluders are two sided, both windings are turned into positive area
+        float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if(std::abs(area) < 1e-6f)
+            continue;
+        if(area < 0.0f) {
+            std::swap(x[1], x[2]);
+            std::swap(y[1], y[2]);
+            std::swap(z[1], z[2]);
+            area = -area;
+        }
+
+        const float min_x = std::min({x[0], x[1], x[2]}), max_x = std::max({x[0], x[1], x[2]});
+        const float min_y = std::min({y[0], y[1], y[2]}), max_y = std::max({y[0], y[1], y[2]});
+        if(max_x < 0.0f || max_y < 0.0f || min_x >= width || min_y >= height)
+            continue;
+
+        ScreenTriangle tri;
+        tri.min_x = u32(std::max(min_x, 0.0f));
+        tri.min_y = u32(std::max(min_y, 0.0f));
+        tri.max_x = u32(std::min(max_x, width - 1.0f));
+        tri.max_y = u32(std::min(max_y, height - 1.0f));
+
+        // edge i is opposite corner i and divided by the area gives that corner's barycentric weight
+        const float inv_area = 1.0f / area;
+        tri.depth_a = tri.depth_b = tri.depth_c = 0.0f;
+        for(u32 e = 0; e < 3; ++e) {
+            const u32 a = (e + 1) % 3, b = (e + 2) % 3;
+            tri.edge_a[e] = y[a] - y[b];
+            tri.edge_b[e] = x[b] - x[a];
+            tri.edge_c[e] = x[a] * y[b] - x[b] * y[a];
+            tri.depth_a += tri.edge_a[e] * z[e] * inv_area;
+            tri.depth_b += tri.edge_b[e] * z[e] * inv_area;
+            tri.depth_c += tri.edge_c[e] * z[e] * inv_area;
+        }
+
+        const u32 index = u32(triangles.size());
+        triangles.push_back(tri);
+        for(u32 ty = tri.min_y / TILE_HEIGHT; ty <= tri.max_y / TILE_HEIGHT; ++ty)
+            for(u32 tx = tri.min_x / TILE_WIDTH; tx <= tri.max_x / TILE_WIDTH; ++tx)
+                bins[ty * tiles_x + tx].push_back(index);
+        ++added;
+    }
+    return added;
+}
+
+
+void OcclusionBuffer::rasterize_tile(u32 tile) {
+    const u32 tile_x = (tile % tiles_x) * TILE_WIDTH;
+    const u32 tile_y = (tile / tiles_x) * TILE_HEIGHT;
+    float* depth = levels[0].data();
+
+    for(const u32 index : bins[tile]) {
+        const auto& tri = triangles[index];
+        // four pixels at a time, the tile width keeps groups from leaving the tile
+        const u32 x0 = std::max(tri.min_x, tile_x) & ~3u;
+        const u32 x1 = std::min(tri.max_x, tile_x + TILE_WIDTH - 1);
+        const u32 y0 = std::max(tri.min_y, tile_y);
+        const u32 y1 = std::min(tri.max_y, tile_y + TILE_HEIGHT - 1);
+
+        for(u32 py = y0; py <= y1; ++py) {
+            const float center_y = float(py) + 0.5f;
+            float* row = depth + size_t(py) * size_x;
+#if defined(OCCLUSION_RASTER_SSE)
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+            __m128 edge_a[3], edge_row[3];
+            for(u32 e = 0; e < 3; ++e) {
+                edge_a[e] = _mm_set1_ps(tri.edge_a[e]);
+                edge_row[e] = _mm_set1_ps(tri.edge_b[e] * center_y + tri.edge_c[e]);
+            }
+            const __m128 depth_a = _mm_set1_ps(tri.depth_a);
+            const __m128 depth_row = _mm_set1_ps(tri.depth_b * center_y + tri.depth_c);
+            for(u32 px = x0; px <= x1; px += 4) {
+                const __m128 center_x = _mm_add_ps(_mm_set1_ps(float(px)), offsets);
+                __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edge_a[0], center_x), edge_row[0]), zero);
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edge_a[1], center_x), edge_row[1]), zero));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edge_a[2], center_x), edge_row[2]), zero));
+                if(_mm_movemask_ps(inside) == 0)
+                    continue;
+                const __m128 z = _mm_add_ps(_mm_mul_ps(depth_a, center_x), depth_row);
+                const __m128 old = _mm_loadu_ps(row + px);
+                const __m128 closer = _mm_min_ps(old, z);
+                _mm_storeu_ps(row + px, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, old)));
+            }
+#else
+            for(u32 px = x0; px <= x1; ++px) {
+                const float center_x = float(px) + 0.5f;
+                bool inside = true;
+                for(u32 e = 0; e < 3; ++e)
+                    inside &= tri.edge_a[e] * center_x + tri.edge_b[e] * center_y + tri.edge_c[e] >= 0.0f;
+                if(inside)
+                    row[px] = std::min(row[px], tri.depth_a * center_x + tri.depth_b * center_y + tri.depth_c);
+            }
+#endif
+        }
+    }
+
+    // the tile size is divisible by every level's scale, so each tile reduces on its own
+    for(u32 i = 1; i < OCCLUSION_HIZ_LEVELS; ++i) {
+        const float* src = levels[i - 1].data();
+        float* dst = levels[i].data();
+        const u32 src_width = size_x >> (i - 1), dst_width = size_x >> i;
+        for(u32 y = tile_y >> i; y < (tile_y + TILE_HEIGHT) >> i; ++y) {
+            for(u32 x = tile_x >> i; x < (tile_x + TILE_WIDTH) >> i; ++x) {
+                const float* quad = src + size_t(y * 2) * src_width + x * 2;
+                dst[size_t(y) * dst_width + x] = std::max(std::max(quad[0], quad[1]), std::max(quad[src_width], quad[src_width + 1]));
+            }
+        }
+    }
+}
+
+
+void OcclusionBuffer::rasterize(ThreadPool* pool) {
+    const u32 tile_count = tiles_x * tiles_y;
+    if(pool) {
+        pool->parallel_for(tile_count, [this](u32 tile) { rasterize_tile(tile); });
+    }
+    else {
+        for(u32 tile = 0; tile < tile_count; ++tile)
+            rasterize_tile(tile);
+    }
+}
+
+
+bool OcclusionBuffer::is_occluded(const AABB& box, const glm::mat4& model) const {
+    if(triangles.empty())
+        return false;
+
+    const glm::mat4 mvp = view_proj * model;
+    float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+    float min_z = FLT_MAX;
+    for(u32 corner = 0; corner < 8; ++corner) {
+        const glm::vec3 p((corner & 1) ? box.max.x : box.min.x,
+                          (corner & 2) ? box.max.y : box.min.y,
+                          (corner & 4) ? box.max.z : box.min.z);
+        const glm::vec4 clip = mvp * glm::vec4(p, 1.0f);
+        // reaches in front of the near plane, covers the camera
+        if(clip.z < 0.0f || clip.w <= 0.0f)
+            return false;
+        const float inv_w = 1.0f / clip.w;
+        const float x = (clip.x * inv_w * 0.5f + 0.5f) * float(size_x);
+        const float y = (0.5f - clip.y * inv_w * 0.5f) * float(size_y);
+        min_x = std::min(min_x, x);
+        max_x = std::max(max_x, x);
+        min_y = std::min(min_y, y);
+        max_y = std::max(max_y, y);
+        min_z = std::min(min_z, clip.z * inv_w);
+    }
+    // off screen boxes are for frustum culling to decide
+    if(max_x < 0.0f || max_y < 0.0f || min_x >= float(size_x) || min_y >= float(size_y))
+        return false;
+
+    u32 x0 = u32(std::max(min_x, 0.0f)), x1 = u32(std::min(max_x, float(size_x - 1)));
+    u32 y0 = u32(std::max(min_y, 0.0f)), y1 = u32(std::min(max_y, float(size_y - 1)));
+    // coarsest level needed to cover the box with at most 4x4 texels
+    u32 level = 0;
+    while(level + 1 < OCCLUSION_HIZ_LEVELS && ((x1 >> level) - (x0 >> level) >= 4 || (y1 >> level) - (y0 >> level) >= 4))
+        ++level;
+    x0 >>= level;
+    x1 >>= level;
+    y0 >>= level;
+    y1 >>= level;
+
+    const float* depth = levels[level].data();
+    const u32 level_width = size_x >> level;
+    for(u32 y = y0; y <= y1; ++y)
+        for(u32 x = x0; x <= x1; ++x)
+            if(depth[size_t(y) * level_width + x] >= min_z)
+                return false;
+    return true;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "../types.h"
+#include "aabb.h"
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <vector>
+
+
+class ThreadPool;
+struct BvhMeshInput;
+
+
+#define OCCLUDER_MAX_TRIANGLES 8192
+#define OCCLUSION_HIZ_LEVELS 6
+
+
+// the largest triangles of a model in model space, three corners each, rasterized into an
+// OcclusionBuffer to hide whatever is behind them
+struct OccluderMesh {
+    std::vector<glm::vec3> vertices;
+    float min_area = 0;     // smallest kept triangle
+
+    u32 triangle_count() const { return u32(vertices.size() / 3); }
+};
+
+// picks up to max_triangles of the biggest full detail triangles, large flat surfaces like walls
+// and floors hide the most per triangle whichever mesh they belong to
+OccluderMesh build_occluders(const std::vector<BvhMeshInput>& meshes, u32 max_triangles = OCCLUDER_MAX_TRIANGLES);
+
+
+// Low resolution depth buffer rasterized on the cpu with a max depth pyramid on top, boxes are
+// tested against the pyramid level where they cover only a few texels. Depth is z/w of the
+// left-handed, zero-to-one projection passed to begin, so closer is smaller.
+// Triangles are binned into tiles, and every tile is rasterized and reduced on its own thread.
+class OcclusionBuffer final {
+public:
+    static constexpr u32 TILE_WIDTH = 64;
+    static constexpr u32 TILE_HEIGHT = 32;
+
+    // clears to the far plane, width and height are rounded up to whole tiles
+    void begin(u32 width, u32 height, const glm::mat4& view_proj);
+    // transforms and bins the triangles, ones crossing the near plane are dropped, returns how many were kept
+    u32 add_occluder(const OccluderMesh& mesh, const glm::mat4& model);
+    // null pool rasterizes on the calling thread
+    void rasterize(ThreadPool* pool);
+
+    // conservative: only boxes entirely behind rasterized occluders are reported
+    bool is_occluded(const AABB& box, const glm::mat4& model) const;
+
+    u32 width() const { return size_x; }
+    u32 height() const { return size_y; }
+    u32 triangle_count() const { return u32(triangles.size()); }
+    // one float per pixel, level 0 is the depth buffer itself
+    const std::vector<float>& level(u32 i) const { return levels[i]; }
+
+private:
+    // edge functions and depth as planes over pixel coordinates, inside where all edges are >= 0
+    struct ScreenTriangle {
+        float edge_a[3], edge_b[3], edge_c[3];
+        float depth_a, depth_b, depth_c;
+        u32 min_x, min_y, max_x, max_y;   // inclusive pixel bounds
+    };
+
+    void rasterize_tile(u32 tile);
+
+    glm::mat4 view_proj{1.0f};
+    u32 size_x = 0, size_y = 0;
+    u32 tiles_x = 0, tiles_y = 0;
+    std::vector<ScreenTriangle> triangles;
+    std::vector<std::vector<u32>> bins;     // triangles touching each tile
+    std::vector<float> levels[OCCLUSION_HIZ_LEVELS];
+};
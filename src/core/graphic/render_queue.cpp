@@ -0,0 +1,66 @@
+#include "render_queue.h"
+
+#include <cstring>
+
+
+u64 RenderQueue::make_key(u8 view, float depth, u16 program, u16 material) {
+    // the bits of a non-negative float sort like the float, keep its exponent and top mantissa bits
+    u32 depth_bits = 0;
+    if(depth > 0.0f)
+        std::memcpy(&depth_bits, &depth, sizeof(depth_bits));
+
+    return (u64(view) << 56)
+         | (u64(depth_bits >> 7) << 32)
+         | (u64(program) << 16)
+         | u64(material);
+}
+
+
+void RenderQueue::clear() {
+    keys.clear();
+    payloads.clear();
+}
+
+
+void RenderQueue::push(u64 key, u32 payload) {
+    keys.push_back(key);
+    payloads.push_back(payload);
+}
+
+
+void RenderQueue::sort() {
+    const size_t count = keys.size();
+    if(count < 2)
+        return;
+
+    // histograms of all digits in one pass
+    u32 histogram[8][256] = {};
+    for(u64 key : keys)
+        for(u32 digit = 0; digit < 8; ++digit)
+            ++histogram[digit][(key >> (digit * 8)) & 0xff];
+
+    key_scratch.resize(count);
+    payload_scratch.resize(count);
+
+    for(u32 digit = 0; digit < 8; ++digit) {
+        u32* counts = histogram[digit];
+        const u32 shift = digit * 8;
+        if(counts[(keys[0] >> shift) & 0xff] == count)
+            continue;
+
+        u32 offset = 0;
+        for(u32 i = 0; i < 256; ++i) {
+            const u32 n = counts[i];
+            counts[i] = offset;
+            offset += n;
+        }
+
+        for(size_t i = 0; i < count; ++i) {
+            const u32 slot = counts[(keys[i] >> shift) & 0xff]++;
+            key_scratch[slot] = keys[i];
+            payload_scratch[slot] = payloads[i];
+        }
+        keys.swap(key_scratch);
+        payloads.swap(payload_scratch);
+    }
+}
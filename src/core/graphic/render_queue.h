@@ -0,0 +1,31 @@
+#pragma once
+
+#include "../types.h"
+
+#include <vector>
+
+
+// draw packets ordered by 64 bit keys, the payload indexes the caller's own packet storage
+class RenderQueue {
+public:
+    // view in the top 8 bits, then 24 bits of depth so opaque draws go front to back,
+    // then 16 bits each of program and material so draws at equal depth still share state
+    static u64 make_key(u8 view, float depth, u16 program, u16 material);
+
+    void clear();
+    void push(u64 key, u32 payload);
+    // least significant digit first radix sort on 8 bit digits, stable,
+    // passes over digits that every key shares are skipped
+    void sort();
+
+    u32 size() const { return u32(keys.size()); }
+    u64 key(u32 i) const { return keys[i]; }
+    // in key order once sorted
+    u32 operator[](u32 i) const { return payloads[i]; }
+
+private:
+    std::vector<u64> keys;
+    std::vector<u32> payloads;
+    std::vector<u64> key_scratch;
+    std::vector<u32> payload_scratch;
+};
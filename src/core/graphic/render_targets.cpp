@@ -0,0 +1,138 @@
+#include "render_targets.h"
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+
+struct PooledTarget {
+    RenderTargetDesc desc;
+    bgfx::FrameBufferHandle framebuffer = BGFX_INVALID_HANDLE;
+    u64 bytes = 0;
+    u64 last_used = 0;  // collect() calls
+    bool acquired = false;
+};
+
+struct RenderTargetsImpl {
+    std::vector<PooledTarget> targets;
+    u32 max_unused_frames = 0;
+    u64 frame = 0;
+    RenderTargetStats stats;
+};
+
+static RenderTargetsImpl* s_targets_impl = nullptr;
+
+
+bool RenderTargetDesc::operator==(const RenderTargetDesc& other) const {
+    return width == other.width
+        && height == other.height
+        && attachment_count == other.attachment_count
+        && flags == other.flags
+        && std::equal(formats, formats + attachment_count, other.formats);
+}
+
+
+static bool is_depth_format(bgfx::TextureFormat::Enum format) {
+    return format > bgfx::TextureFormat::UnknownDepth && format < bgfx::TextureFormat::Count;
+}
+
+
+static PooledTarget create_target(const RenderTargetDesc& desc) {
+    PooledTarget target;
+    target.desc = desc;
+
+    bgfx::Attachment attachments[RENDER_TARGET_MAX_ATTACHMENTS];
+    for(u8 i = 0; i < desc.attachment_count; ++i) {
+        const auto format = desc.formats[i];
+        const auto texture = bgfx::createTexture2D(desc.width, desc.height, false, 1, format, desc.flags);
+        // depth is sampled by later passes as well as written
+        attachments[i].init(texture, is_depth_format(format) ? bgfx::Access::ReadWrite : bgfx::Access::Write);
+
+        bgfx::TextureInfo info;
+        bgfx::calcTextureSize(info, desc.width, desc.height, 1, false, false, 1, format);
+        target.bytes += info.storageSize;
+    }
+    target.framebuffer = bgfx::createFrameBuffer(desc.attachment_count, attachments, true);
+    return target;
+}
+
+
+bool RenderTargets::init(u32 max_unused_frames) {
+    assert(s_targets_impl == nullptr && "render targets is initialized twice");
+    s_targets_impl = new RenderTargetsImpl();
+    s_targets_impl->max_unused_frames = max_unused_frames;
+    return true;
+}
+
+
+void RenderTargets::quit() {
+    if(s_targets_impl == nullptr)
+        return;
+
+    for(auto& target : s_targets_impl->targets)
+        bgfx::destroy(target.framebuffer);
+    delete s_targets_impl;
+    s_targets_impl = nullptr;
+}
+
+
+bgfx::FrameBufferHandle RenderTargets::acquire(const RenderTargetDesc& desc) {
+    assert(desc.attachment_count > 0 && desc.width > 0 && desc.height > 0 && "empty render target");
+    auto& impl = *s_targets_impl;
+    // first free match in creation order, so a frame acquiring the same things gets the same targets
+    for(auto& target : impl.targets) {
+        if(!target.acquired && target.desc == desc) {
+            target.acquired = true;
+            target.last_used = impl.frame;
+            ++impl.stats.acquired;
+            return target.framebuffer;
+        }
+    }
+
+    auto& target = impl.targets.emplace_back(create_target(desc));
+    target.acquired = true;
+    target.last_used = impl.frame;
+    ++impl.stats.acquired;
+    ++impl.stats.target_count;
+    ++impl.stats.created;
+    impl.stats.bytes += target.bytes;
+    return target.framebuffer;
+}
+
+
+void RenderTargets::collect() {
+    auto& impl = *s_targets_impl;
+    ++impl.frame;
+    impl.stats.acquired = 0;
+
+    // bgfx defers the destruction until frames still using them are rendered
+    auto& targets = impl.targets;
+    for(auto& target : targets) {
+        target.acquired = false;
+        if(impl.frame - target.last_used > impl.max_unused_frames) {
+            bgfx::destroy(target.framebuffer);
+            target.framebuffer = BGFX_INVALID_HANDLE;
+            --impl.stats.target_count;
+            ++impl.stats.destroyed;
+            impl.stats.bytes -= target.bytes;
+        }
+    }
+    targets.erase(std::remove_if(targets.begin(), targets.end(), [](const PooledTarget& target) {
+        return !bgfx::isValid(target.framebuffer);
+    }), targets.end());
+}
+
+
+u32 RenderTargets::max_unused_frames() {
+    return s_targets_impl->max_unused_frames;
+}
+
+
+void RenderTargets::set_max_unused_frames(u32 frames) {
+    s_targets_impl->max_unused_frames = frames;
+}
+
+
+const RenderTargetStats& RenderTargets::stats() {
+    return s_targets_impl->stats;
+}
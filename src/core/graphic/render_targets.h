@@ -0,0 +1,56 @@
+#pragma once
+
+#include "../types.h"
+
+#include <bgfx/bgfx.h>
+
+
+#define RENDER_TARGET_MAX_ATTACHMENTS 4
+
+
+// size, attachment formats and texture flags of a pooled framebuffer, flags apply to every attachment
+struct RenderTargetDesc {
+    u16 width = 0;
+    u16 height = 0;
+    u8 attachment_count = 0;
+    bgfx::TextureFormat::Enum formats[RENDER_TARGET_MAX_ATTACHMENTS] = {};
+    u64 flags = BGFX_TEXTURE_RT;
+
+    RenderTargetDesc& add(bgfx::TextureFormat::Enum format) {
+        formats[attachment_count++] = format;
+        return *this;
+    }
+
+    bool operator==(const RenderTargetDesc& other) const;
+};
+
+
+struct RenderTargetStats {
+    u32 target_count = 0;
+    u32 acquired = 0;       // this frame
+    u64 bytes = 0;          // of every pooled texture
+    u64 created = 0;        // since init
+    u64 destroyed = 0;
+};
+
+
+// Transient framebuffers shared by description. Every acquire within a frame gets a target of its
+// own, and the next frame's acquire with the same description gets the same one back, so views
+// keep their framebuffer and nothing is recreated unless the size or format really changes.
+// Targets nobody acquired for max_unused_frames frames are destroyed, the old size after a resize
+// goes that way. Call from the thread driving bgfx.
+class RenderTargets {
+public:
+    static bool init(u32 max_unused_frames = 3);
+    static void quit();
+
+    // valid until the end of the frame, the pool owns the framebuffer and its textures
+    static bgfx::FrameBufferHandle acquire(const RenderTargetDesc& desc);
+
+    // once per frame before anything acquires, frees targets unused for too long
+    static void collect();
+
+    static u32 max_unused_frames();
+    static void set_max_unused_frames(u32 frames);
+    static const RenderTargetStats& stats();
+};
@@ -1,25 +1,42 @@
 #include "shader.h"
-#include "binary_reader.h"
+#include "shader_pack.h"
 
 #include <bgfx/bgfx.h>
 
-#include <cassert>
+#include <cstdio>
+
+
+// from the pack for the current renderer, invalid when it has no build of the shader
+static bgfx::ShaderHandle create_packed_shader(const std::string& name, u64& bytes) {
+    const auto renderer = bgfx::getRendererType();
+    const auto packed = find_packed_shader(name, renderer);
+    if(packed.data == nullptr) {
+        printf("shader %s is not packed for %s\n", name.c_str(), bgfx::getRendererName(renderer));
+        return BGFX_INVALID_HANDLE;
+    }
+    bytes += packed.size;
+    auto shader = bgfx::createShader(bgfx::makeRef(packed.data, packed.size));
+    bgfx::setName(shader, name.c_str());
+    return shader;
+}
 
 
-Shader::Shader(const std::string& vs_file, const std::string& fs_file) {
-    assert(bgfx::getRendererType() == bgfx::RendererType::Direct3D11);
-    auto alloc = [](auto size) { return bgfx::alloc(size); };
-    auto get = [](auto mem) { return mem->data; };
-    auto vs_data = read_binary(vs_file, alloc, get);
-    auto vs = bgfx::createShader(vs_data);
-    auto fs_data = read_binary(fs_file, alloc, get);
-    auto fs = bgfx::createShader(fs_data);
+Shader::Shader(const std::string& vs_name, const std::string& fs_name) {
+    auto vs = create_packed_shader(vs_name, bytes);
+    auto fs = create_packed_shader(fs_name, bytes);
+    if(!bgfx::isValid(vs) || !bgfx::isValid(fs)) {
+        if(bgfx::isValid(vs))
+            bgfx::destroy(vs);
+        if(bgfx::isValid(fs))
+            bgfx::destroy(fs);
+        return;
+    }
 
     program = bgfx::createProgram(vs, fs, true);
 }
 
 
-Shader::Shader(Shader&& other) noexcept : program(other.program) {
+Shader::Shader(Shader&& other) noexcept : program(other.program), bytes(other.bytes) {
     other.program = BGFX_INVALID_HANDLE;
 }
 
@@ -1,18 +1,26 @@
 #pragma once
 
+#include "../types.h"
+
 #include <bgfx/bgfx.h>
 #include <string>
 
 
+// A program from the shaders packed into the executable by the build, named after their source in
+// shaders/src without extension. Every renderer's build is packed, so nothing is read from disk
+// whichever renderer runs. The program is invalid when either shader isn't packed for it.
 class Shader {
 public:
-    Shader(const std::string& vs_file, const std::string& fs_file);
+    Shader(const std::string& vs_name, const std::string& fs_name);
     Shader(Shader&&) noexcept;
     ~Shader();
 
     // todo
-    const auto& handle() { return program; }
+    const auto& handle() const { return program; }
+    // of both shaders' code
+    u64 size_bytes() const { return bytes; }
 
 private:
     bgfx::ProgramHandle program = BGFX_INVALID_HANDLE;
+    u64 bytes = 0;
 };
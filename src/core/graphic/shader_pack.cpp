@@ -0,0 +1,24 @@
+#include "shader_pack.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "embedded/shaders/shader_pack.bin.h"
+
+
+PackedShader find_packed_shader(const std::string& name, bgfx::RendererType::Enum renderer) {
+    if(renderer == bgfx::RendererType::Direct3D12)
+        renderer = bgfx::RendererType::Direct3D11;
+
+    // sorted by name, every renderer's build of a shader is next to the others
+    const auto begin = std::begin(SHADER_PACK_INDEX);
+    const auto end = std::end(SHADER_PACK_INDEX);
+    auto it = std::lower_bound(begin, end, name, [](const ShaderPackEntry& entry, const std::string& name) {
+        return std::strcmp(entry.name, name.c_str()) < 0;
+    });
+    for(; it != end && name == it->name; ++it) {
+        if(it->renderer == renderer || renderer == bgfx::RendererType::Noop)
+            return {SHADER_PACK_DATA + it->offset, it->size};
+    }
+    return {};
+}
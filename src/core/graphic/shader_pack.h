@@ -0,0 +1,25 @@
+#pragma once
+
+#include "../types.h"
+
+#include <bgfx/bgfx.h>
+
+#include <string>
+
+
+// one compiled shader of the pack the build makes from shaders/src, see shaders/CMakeLists.txt
+struct ShaderPackEntry {
+    const char* name;
+    bgfx::RendererType::Enum renderer;
+    u32 offset;
+    u32 size;
+};
+
+struct PackedShader {
+    const u8* data = nullptr;   // static, bgfx can reference it instead of copying
+    u32 size = 0;
+};
+
+// the build of shader `name` (vs_fog, fs_blit...) for a renderer, empty when it isn't packed.
+// Direct3D 12 runs the Direct3D 11 build, noop takes any since it only reads the header
+PackedShader find_packed_shader(const std::string& name, bgfx::RendererType::Enum renderer);
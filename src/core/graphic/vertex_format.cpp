@@ -0,0 +1,122 @@
+#include "vertex_format.h"
+#include "model.h"
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+
+
+const char* vertex_format_name(VertexFormat format) {
+    switch(format) {
+    case VertexFormat::Float: return "float";
+    case VertexFormat::Compact8: return "compact, 8 bit normals";
+    case VertexFormat::Compact16: return "compact, 16 bit normals";
+    }
+    return "unknown";
+}
+
+u32 vertex_stride(VertexFormat format) {
+    switch(format) {
+    case VertexFormat::Float: return sizeof(Vertex);
+    case VertexFormat::Compact8: return 12;
+    case VertexFormat::Compact16: return 16;
+    }
+    return 0;
+}
+
+
+u16 float_to_half(float value) {
+    u32 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const u32 sign = (bits >> 16) & 0x8000;
+    const i32 exponent = i32((bits >> 23) & 0xff) - 127 + 15;
+    u32 mantissa = bits & 0x7fffff;
+
+    if(exponent >= 31)  // overflow, inf and nan all become inf
+        return u16(sign | 0x7c00);
+    if(exponent <= 0) {
+        if(exponent < -10)
+            return u16(sign);
+        // denormal, round to nearest
+        mantissa |= 0x800000;
+        const u32 shift = u32(14 - exponent);
+        return u16(sign | ((mantissa + (1u << (shift - 1))) >> shift));
+    }
+    // a carry out of the mantissa correctly bumps the exponent
+    return u16(sign | ((u32(exponent) << 10) + ((mantissa + 0x1000) >> 13)));
+}
+
+
+glm::vec2 oct_encode(const glm::vec3& n) {
+    const float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if(l1 == 0)
+        return glm::vec2(0);
+    const auto p = glm::vec2(n.x, n.y) / l1;
+    if(n.z >= 0)
+        return p;
+    return glm::vec2((1 - std::abs(p.y)) * (p.x >= 0 ? 1.0f : -1.0f),
+                     (1 - std::abs(p.x)) * (p.y >= 0 ? 1.0f : -1.0f));
+}
+
+glm::vec3 oct_decode(const glm::vec2& e) {
+    glm::vec3 n(e.x, e.y, 1 - std::abs(e.x) - std::abs(e.y));
+    if(n.z < 0) {
+        n.x = (1 - std::abs(e.y)) * (e.x >= 0 ? 1.0f : -1.0f);
+        n.y = (1 - std::abs(e.x)) * (e.y >= 0 ? 1.0f : -1.0f);
+    }
+    return glm::normalize(n);
+}
+
+
+i16 quantize_snorm16(float value) {
+    return i16(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+
+float pack_vertices(const Vertex* vertices, u32 count, const AABB& aabb, VertexFormat format, u8* dst, glm::vec4 dequant[2]) {
+    assert(format != VertexFormat::Float && "float vertices are uploaded as they are");
+    const auto center = aabb.center();
+    // degenerate axes still need a non zero scale
+    const auto half_extent = glm::max(aabb.extent() * .5f, glm::vec3(1e-6f));
+    dequant[0] = glm::vec4(center, float(format));
+    dequant[1] = glm::vec4(half_extent, 0);
+
+    const auto stride = vertex_stride(format);
+    float max_error = 0;
+    for(u32 i = 0; i < count; ++i, dst += stride) {
+        const auto& vertex = vertices[i];
+
+        i16 position[4];
+        glm::vec3 unpacked;
+        for(int axis = 0; axis < 3; ++axis) {
+            position[axis] = quantize_snorm16((vertex.position[axis] - center[axis]) / half_extent[axis]);
+            unpacked[axis] = center[axis] + float(position[axis]) / 32767.0f * half_extent[axis];
+        }
+        max_error = std::max(max_error, glm::length(unpacked - vertex.position));
+
+        const auto normal = oct_encode(vertex.normal);
+        if(format == VertexFormat::Compact8) {
+            // 255 levels per axis so 0 is exact, both packed into the snorm w: x * 255 + y - 32512
+            const auto x = i32(std::lround((normal.x + 1) * 127.0f));
+            const auto y = i32(std::lround((normal.y + 1) * 127.0f));
+            position[3] = i16(std::clamp(x, 0, 254) * 255 + std::clamp(y, 0, 254) - 32512);
+        }
+        else {
+            position[3] = 0;
+        }
+
+        u8* out = dst;
+        std::memcpy(out, position, sizeof(position));
+        out += sizeof(position);
+        if(format == VertexFormat::Compact16) {
+            const i16 packed_normal[2] = {quantize_snorm16(normal.x), quantize_snorm16(normal.y)};
+            std::memcpy(out, packed_normal, sizeof(packed_normal));
+            out += sizeof(packed_normal);
+        }
+        const u16 uv[2] = {float_to_half(vertex.uv.x), float_to_half(vertex.uv.y)};
+        std::memcpy(out, uv, sizeof(uv));
+    }
+    return max_error;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "../types.h"
+#include "aabb.h"
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+
+// how vertices are stored on the gpu, compact formats are unpacked by vs_blinn_phong
+enum class VertexFormat : u8 {
+    Float,      // 32 bytes, Vertex as is
+    Compact8,   // 12 bytes, 16 bit positions with an 8+8 bit octahedral normal in w, half uvs
+    Compact16,  // 16 bytes, 16 bit positions, 16+16 bit octahedral normal, half uvs
+};
+
+const char* vertex_format_name(VertexFormat format);
+u32 vertex_stride(VertexFormat format);
+
+
+u16 float_to_half(float value);
+
+// unit vector to the [-1, 1] square
+glm::vec2 oct_encode(const glm::vec3& n);
+glm::vec3 oct_decode(const glm::vec2& e);
+
+
+// packs count vertices into dst (count * vertex_stride(format) bytes) in one of the compact formats
+// and fills dequant with what the vertex shader needs to unpack them: center and format in [0], half extent in [1].
+// Positions are quantized relative to aabb. Returns the largest position error introduced.
+float pack_vertices(const struct Vertex* vertices, u32 count, const AABB& aabb, VertexFormat format, u8* dst, glm::vec4 dequant[2]);
@@ -0,0 +1,64 @@
+#include "volume_texture.h"
+#include "binary_reader.h"
+
+#include <glm/common.hpp>
+
+
+VolumeTexture::VolumeTexture(VolumeTexture&& other) noexcept : data(std::move(other.data)),
+                                                               dims(other.dims),
+                                                               texture(other.texture) {
+    other.texture = BGFX_INVALID_HANDLE;
+}
+
+VolumeTexture& VolumeTexture::operator=(VolumeTexture&& other) noexcept {
+    using std::swap;
+    swap(data, other.data);
+    swap(dims, other.dims);
+    swap(texture, other.texture);
+    return *this;
+}
+
+VolumeTexture::~VolumeTexture() {
+    if(bgfx::isValid(texture))
+        bgfx::destroy(texture);
+    texture = BGFX_INVALID_HANDLE;
+}
+
+
+std::optional<VolumeTexture> VolumeTexture::load_from_file(const std::string& filename, u16 width, u16 height, u16 depth) {
+    const size_t expected = size_t(width) * height * depth;
+
+    size_t filesize = 0;
+    auto alloc = [&](auto size) { return std::vector<u8>(filesize = size > 0 ? size_t(size) : 0); };
+    auto get = [](auto& buffer) { return buffer.data(); };
+    auto buffer = read_binary(filename, alloc, get);
+    if(filesize < expected)
+        return std::nullopt;
+    buffer.resize(expected);
+
+    VolumeTexture result;
+    result.dims = {width, height, depth};
+    result.data = std::move(buffer);
+    result.texture = bgfx::createTexture3D(width, height, depth, false, bgfx::TextureFormat::R8, 0,
+                                           bgfx::copy(result.data.data(), (u32)result.data.size()));
+    return result;
+}
+
+std::shared_ptr<VolumeTexture> VolumeTexture::load_from_file_shared(const std::string& filename, u16 width, u16 height, u16 depth) {
+    std::optional<VolumeTexture> result = load_from_file(filename, width, height, depth);
+    if(result.has_value()) {
+        return std::make_shared<VolumeTexture>(std::move(result.value()));
+    }
+    else {
+        return nullptr;
+    }
+}
+
+
+u8 VolumeTexture::sample(const glm::vec3& uvw) const {
+    if(data.empty())
+        return 0;
+
+    const glm::uvec3 texel = glm::min(glm::uvec3(glm::clamp(uvw, 0.f, 1.f) * glm::vec3(dims)), dims - 1u);
+    return data[(size_t(texel.z) * dims.y + texel.y) * dims.x + texel.x];
+}
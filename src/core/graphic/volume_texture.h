@@ -0,0 +1,38 @@
+#pragma once
+
+#include "../types.h"
+
+#include <bgfx/bgfx.h>
+#include <glm/vec3.hpp>
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <memory>
+
+
+// R8 density volume, kept on the cpu as well so it can be queried without a gpu readback
+class VolumeTexture final {
+public:
+    VolumeTexture() = default;
+    VolumeTexture(const VolumeTexture&) = delete;
+    VolumeTexture& operator=(const VolumeTexture&) = delete;
+    VolumeTexture(VolumeTexture&& other) noexcept;
+    VolumeTexture& operator=(VolumeTexture&& other) noexcept;
+    ~VolumeTexture();
+
+    // raw file of width * height * depth bytes, x varies fastest
+    static std::optional<VolumeTexture> load_from_file(const std::string& filename, u16 width, u16 height, u16 depth);
+    static std::shared_ptr<VolumeTexture> load_from_file_shared(const std::string& filename, u16 width, u16 height, u16 depth);
+
+    // nearest sample, uvw is clamped to [0, 1]
+    u8 sample(const glm::vec3& uvw) const;
+
+    bgfx::TextureHandle handle() const { return texture; }
+    const glm::uvec3& size() const { return dims; }
+
+private:
+    std::vector<u8> data;
+    glm::uvec3 dims{0};
+    bgfx::TextureHandle texture = BGFX_INVALID_HANDLE;
+};
@@ -0,0 +1,116 @@
+#include "mapped_file.h"
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+#ifdef _WIN32
+MappedFile::MappedFile(const char* path) {
+    HANDLE f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (f == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(f, &size) || size.QuadPart == 0) {
+        CloseHandle(f);
+        return;
+    }
+
+    HANDLE m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m == nullptr) {
+        CloseHandle(f);
+        return;
+    }
+
+    void* view = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+    if (view == nullptr) {
+        CloseHandle(m);
+        CloseHandle(f);
+        return;
+    }
+
+    ptr     = (const u8*)view;
+    length  = (size_t)size.QuadPart;
+    file    = f;
+    mapping = m;
+}
+
+void MappedFile::close() {
+    if (ptr) {
+        UnmapViewOfFile(ptr);
+    }
+    if (mapping) {
+        CloseHandle((HANDLE)mapping);
+    }
+    if (file) {
+        CloseHandle((HANDLE)file);
+    }
+    ptr     = nullptr;
+    length  = 0;
+    file    = nullptr;
+    mapping = nullptr;
+}
+#else
+MappedFile::MappedFile(const char* path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return;
+    }
+
+    void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (view == MAP_FAILED) {
+        return;
+    }
+
+    ptr    = (const u8*)view;
+    length = (size_t)st.st_size;
+}
+
+void MappedFile::close() {
+    if (ptr) {
+        munmap((void*)ptr, length);
+    }
+    ptr    = nullptr;
+    length = 0;
+}
+#endif
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : ptr(other.ptr),
+      length(other.length),
+      file(other.file),
+      mapping(other.mapping) {
+    other.ptr     = nullptr;
+    other.length  = 0;
+    other.file    = nullptr;
+    other.mapping = nullptr;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    std::swap(ptr, other.ptr);
+    std::swap(length, other.length);
+    std::swap(file, other.file);
+    std::swap(mapping, other.mapping);
+    return *this;
+}
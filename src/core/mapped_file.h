@@ -0,0 +1,27 @@
+#pragma once
+#include "types.h"
+#include <cstddef>
+
+// read-only memory mapping of a whole file
+class MappedFile {
+public:
+    ~MappedFile();
+    MappedFile() = default;
+    explicit MappedFile(const char* path);
+    MappedFile(const MappedFile& other) = delete;
+    MappedFile& operator=(const MappedFile& other) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    // empty files are reported as invalid
+    bool is_valid() const { return ptr != nullptr; }
+    const u8* data() const { return ptr; }
+    size_t size() const { return length; }
+
+private:
+    void close();
+
+    const u8* ptr = nullptr;
+    size_t length = 0;
+    void* file    = nullptr; // HANDLE on windows, unused elsewhere
+    void* mapping = nullptr; // HANDLE on windows, unused elsewhere
+};
@@ -6,6 +6,9 @@
 
 struct ScreenImpl {
     Window window;
+    // without a window the size is only what the setup and set_size ask for, drawable and logical alike
+    bool headless = false;
+    glm::ivec2 headless_size;
 };
 
 static ScreenImpl* s_screen_impl = nullptr;
@@ -13,6 +16,11 @@ static ScreenImpl* s_screen_impl = nullptr;
 bool Screen::init(const AppSetup& setup) {
     assert(s_screen_impl == nullptr && "screen is initialized twice");
     s_screen_impl = new ScreenImpl();
+    if (setup.headless) {
+        s_screen_impl->headless      = true;
+        s_screen_impl->headless_size = glm::ivec2(setup.width, setup.height);
+        return true;
+    }
 
     int x = setup.centered ? (int)SDL_WINDOWPOS_CENTERED : setup.x;
     int y = setup.centered ? (int)SDL_WINDOWPOS_CENTERED : setup.y;
@@ -32,31 +40,39 @@ void Screen::quit() {
 }
 
 glm::ivec2 Screen::size() {
-    return s_screen_impl->window.size();
+    return s_screen_impl->headless ? s_screen_impl->headless_size : s_screen_impl->window.size();
 }
 
 void Screen::set_size(i32 width, i32 height) {
+    if (s_screen_impl->headless) {
+        s_screen_impl->headless_size = glm::ivec2(width, height);
+        return;
+    }
     s_screen_impl->window.set_size(width, height);
 }
 
 i32 Screen::width() {
-    return s_screen_impl->window.width();
+    return size().x;
 }
 
 i32 Screen::height() {
-    return s_screen_impl->window.height();
+    return size().y;
 }
 
 glm::ivec2 Screen::draw_size() {
-    return s_screen_impl->window.draw_size();
+    return s_screen_impl->headless ? s_screen_impl->headless_size : s_screen_impl->window.draw_size();
 }
 
 i32 Screen::draw_width() {
-    return s_screen_impl->window.draw_width();
+    return draw_size().x;
 }
 
 i32 Screen::draw_height() {
-    return s_screen_impl->window.draw_height();
+    return draw_size().y;
+}
+
+bool Screen::headless() {
+    return s_screen_impl->headless;
 }
 
 class Window& Screen::get_window() {
@@ -14,9 +14,12 @@ public:
     static glm::ivec2 draw_size();
     static i32 draw_width();
     static i32 draw_height();
+    // set up without a window, see AppSetup::headless
+    static bool headless();
     static void show_cursor(bool v);
     static bool cursor_shown();
     static void set_relative_cursor(bool v);
     static bool relative_cursor();
+    // invalid when headless
     static class Window& get_window();
 };
\ No newline at end of file
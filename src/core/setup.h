@@ -2,12 +2,37 @@
 #include "types.h"
 #include <string>
 
+enum class PresentMode : u8 {
+    Vsync,    // waits for the display, no tearing
+    Uncapped, // as fast as possible, for benchmarking
+    Capped,   // paced to fps_cap by Gfx::limit_frame_rate, low latency on variable refresh displays
+};
+
+struct PresentSettings {
+    PresentMode mode = PresentMode::Vsync;
+    u32 fps_cap      = 120;
+    bool late_input  = true; // capped: wait before input is sampled rather than after the frame is handed over
+    float spin_ms    = 1.5f; // capped: the end of each wait is spun, sleeping alone overshoots by up to a scheduler tick
+};
+
+enum class RendererBackend : u8 {
+    Auto,   // Direct3D 11 on Windows, whatever bgfx prefers elsewhere
+    Noop,   // draws nothing, measures the cpu side
+    OpenGL,
+    Vulkan, // the loader picks the driver, VK_ICD_FILENAMES can point it at a software one like lavapipe
+    Direct3D11,
+};
+
 struct AppSetup {
-    std::string title = u8"App";
-    bool centered     = true;
-    i32 x             = 0;
-    i32 y             = 0;
-    i32 width         = 800;
-    i32 height        = 600;
-    u32 flags         = 0;
+    std::string title        = u8"App";
+    bool centered            = true;
+    i32 x                    = 0;
+    i32 y                    = 0;
+    i32 width                = 800;
+    i32 height               = 600;
+    u32 flags                = 0;
+    bool render_thread       = false; // see Gfx::init
+    bool headless            = false; // no window, width and height size the offscreen back-buffer, see Gfx::backbuffer
+    RendererBackend renderer = RendererBackend::Auto;
+    PresentSettings present;
 };
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+
+ThreadPool::ThreadPool(u32 worker_count) {
+    if (worker_count == 0) {
+        u32 hw       = std::thread::hardware_concurrency();
+        worker_count = hw > 1 ? hw - 1 : 1;
+    }
+
+    workers.reserve(worker_count);
+    for (u32 i = 0; i < worker_count; ++i) {
+        workers.emplace_back([this]() { worker_loop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::enqueue(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.emplace_back(std::move(task));
+    }
+    cv.notify_one();
+}
+
+void ThreadPool::worker_loop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (stopping && tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::parallel_for(u32 count, const std::function<void(u32)>& fn) {
+    if (count == 0) {
+        return;
+    }
+
+    // helpers may start after every index is taken, even after we returned,
+    // so everything they touch lives in a shared block
+    struct Batch {
+        std::atomic<u32> next{ 0 };
+        std::atomic<u32> done{ 0 };
+        u32 count;
+        const std::function<void(u32)>* fn;
+        std::mutex mutex;
+        std::condition_variable cv;
+
+        void run() {
+            u32 finished = 0;
+            for (u32 i = next++; i < count; i = next++) {
+                (*fn)(i);
+                ++finished;
+            }
+            if (finished != 0 && (done += finished) == count) {
+                std::lock_guard<std::mutex> lock(mutex);
+                cv.notify_all();
+            }
+        }
+    };
+
+    auto batch   = std::make_shared<Batch>();
+    batch->count = count;
+    batch->fn    = &fn;
+
+    u32 helpers = std::min(worker_count(), count - 1);
+    for (u32 i = 0; i < helpers; ++i) {
+        enqueue([batch]() { batch->run(); });
+    }
+
+    batch->run();
+
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    batch->cv.wait(lock, [&]() { return batch->done == count; });
+}
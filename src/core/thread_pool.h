@@ -0,0 +1,48 @@
+#pragma once
+#include "types.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed set of worker threads pulling from one fifo queue
+class ThreadPool {
+public:
+    // 0 picks one worker per hardware thread minus the caller's
+    explicit ThreadPool(u32 worker_count = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool& other) = delete;
+    ThreadPool& operator=(const ThreadPool& other) = delete;
+
+    u32 worker_count() const { return (u32)workers.size(); }
+
+    template <typename F>
+    auto submit(F&& f) -> std::future<decltype(f())> {
+        using R   = decltype(f());
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+        auto fut  = task->get_future();
+        enqueue([task]() { (*task)(); });
+        return fut;
+    }
+
+    // calls fn(i) for every i in [0, count) and returns when all calls finished,
+    // the calling thread takes part so this is safe to nest inside pool tasks
+    void parallel_for(u32 count, const std::function<void(u32)>& fn);
+
+    // process wide pool, created on first use
+    static ThreadPool& shared();
+
+private:
+    void enqueue(std::function<void()> task);
+    void worker_loop();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+};
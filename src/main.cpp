@@ -17,19 +17,36 @@
 
 #include "core/graphic/model.h"
 #include "core/graphic/shader.h"
+#include "core/graphic/volume_texture.h"
+#include "core/graphic/obj_loader.h"
+#include "core/graphic/assets.h"
+#include "core/graphic/render_targets.h"
+#include "core/graphic/image_writer.h"
+#include "core/thread_pool.h"
 
 #include "components/transform.h"
 #include "components/camera.h"
 #include "components/camera_control_data.h"
 #include "components/render.h"
+#include "components/fog_volume.h"
 
 #include "systems/camera_control.h"
 #include "systems/rendering.h"
+#include "systems/fog_rendering.h"
+#include "systems/quality_governor.h"
 
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
 #include <fstream>
 #include <memory>
+#include <optional>
+#include <sstream>
+#include <thread>
 
 #define FOG_TEXTURE_SIZE 256
+#define MODEL_FILE "./res/models/A_full.fbx"
 
 class Blit {
 public:
@@ -40,7 +57,7 @@ public:
     }
 
     void init() {
-        shader = std::make_shared<Shader>("./res/shaders/vs_blit.bin", "./res/shaders/fs_blit.bin");
+        shader = Assets::shader("vs_blit", "fs_blit");
         color  = bgfx::createUniform("s_color", bgfx::UniformType::Sampler);
     }
 
@@ -73,18 +90,6 @@ private:
     std::shared_ptr<Shader> shader;
 };
 
-struct FogParameters {
-    glm::vec3 camera_pos;
-    float noise_scale;
-    glm::vec3 box_min;
-    float density;
-    glm::vec3 box_max;
-    float _pad1;
-    glm::vec4 color_min;
-    glm::vec4 color_max;
-    glm::vec4 _[3];
-};
-
 struct LightParameters {
     glm::vec3 u_ambient_light;
     float _pad0;
@@ -97,6 +102,108 @@ struct LightParameters {
     glm::vec4 _[4];
 };
 
+// one image of a batch run, see parse_batch_file
+struct BatchPose {
+    std::string name;
+    glm::vec3 eye    = glm::vec3(0);
+    glm::vec3 target = glm::vec3(0, 0, 1);
+    float fov        = 60.0f; // degrees
+    // what a pose leaves out stays as the batch started
+    std::optional<float> density;
+    std::optional<float> noise_scale;
+    std::optional<float> step_size;
+    std::optional<float> max_steps;
+    std::optional<float> fog_resolution;
+    std::optional<float> lod_bias;
+};
+
+// One pose per line: name eye_x eye_y eye_z target_x target_y target_z [key=value ...]
+// with keys fov, density, scale, step, steps, resolution and lod_bias. Empty lines and lines
+// starting with # are skipped, the name is the image's file name without extension
+static std::optional<std::vector<BatchPose>> parse_batch_file(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file) {
+        printf("failed to open %s\n", filename.c_str());
+        return std::nullopt;
+    }
+
+    std::vector<BatchPose> poses;
+    std::string line;
+    u32 line_number = 0;
+    while (std::getline(file, line)) {
+        ++line_number;
+        std::istringstream in(line);
+        BatchPose pose;
+        if (!(in >> pose.name) || pose.name[0] == '#') {
+            continue;
+        }
+        if (!(in >> pose.eye.x >> pose.eye.y >> pose.eye.z >> pose.target.x >> pose.target.y >> pose.target.z)) {
+            printf("%s:%u: expected a name, an eye and a target position\n", filename.c_str(), line_number);
+            return std::nullopt;
+        }
+
+        std::string param;
+        while (in >> param) {
+            size_t eq         = param.find('=');
+            std::string key   = param.substr(0, eq);
+            const char* begin = eq == std::string::npos ? "" : param.c_str() + eq + 1;
+            char* end         = nullptr;
+            float value       = std::strtof(begin, &end);
+            if (end == begin || *end != '\0') {
+                printf("%s:%u: expected key=number, got %s\n", filename.c_str(), line_number, param.c_str());
+                return std::nullopt;
+            }
+
+            if (key == "fov") {
+                pose.fov = value;
+            }
+            else if (key == "density") {
+                pose.density = value;
+            }
+            else if (key == "scale") {
+                pose.noise_scale = value;
+            }
+            else if (key == "step") {
+                pose.step_size = value;
+            }
+            else if (key == "steps") {
+                pose.max_steps = value;
+            }
+            else if (key == "resolution") {
+                pose.fog_resolution = value;
+            }
+            else if (key == "lod_bias") {
+                pose.lod_bias = value;
+            }
+            else {
+                printf("%s:%u: unknown parameter %s\n", filename.c_str(), line_number, key.c_str());
+                return std::nullopt;
+            }
+        }
+        poses.push_back(std::move(pose));
+    }
+    return poses;
+}
+
+static std::optional<RendererBackend> parse_renderer(const std::string& name) {
+    if (name == "auto") {
+        return RendererBackend::Auto;
+    }
+    if (name == "noop") {
+        return RendererBackend::Noop;
+    }
+    if (name == "opengl") {
+        return RendererBackend::OpenGL;
+    }
+    if (name == "vulkan") {
+        return RendererBackend::Vulkan;
+    }
+    if (name == "d3d11") {
+        return RendererBackend::Direct3D11;
+    }
+    return std::nullopt;
+}
+
 class Demo : public App {
 public:
     AppSetup on_setup() override {
@@ -106,15 +213,22 @@ public:
         as.width    = 1280;
         as.height   = 720;
         as.flags    = SDL_WINDOW_SHOWN;
+        // update the next frame while bgfx renders this one
+        as.render_thread = true;
+        if (!parse_args(as)) {
+            printf("usage: main [--renderer auto|noop|opengl|vulkan|d3d11] [--batch <poses file> [--out <dir>] [--size <width>x<height>]]\n");
+            request_quit(1);
+        }
         return as;
     }
 
     void on_awake() override {
-        model = Model::load_from_file_shared("./res/models/A_full.fbx");
+        model = Assets::model(MODEL_FILE, model_options);
 
-        program         = std::make_shared<Shader>("./res/shaders/vs_blinn_phong.bin", "./res/shaders/fs_blinn_phong.bin");
-        u_light_params  = bgfx::createUniform("u_light_params", bgfx::UniformType::Vec4, sizeof(LightParameters) / sizeof(glm::vec4));
-        u_diffuse_color = bgfx::createUniform("u_diffuse_color", bgfx::UniformType::Vec4);
+        program           = Assets::shader("vs_blinn_phong", "fs_blinn_phong");
+        program_instanced = Assets::shader("vs_blinn_phong_instanced", "fs_blinn_phong");
+        u_light_params    = bgfx::createUniform("u_light_params", bgfx::UniformType::Vec4, sizeof(LightParameters) / sizeof(glm::vec4));
+        u_diffuse_color   = bgfx::createUniform("u_diffuse_color", bgfx::UniformType::Vec4);
 
         const uint64_t sampler_flags = 0
                                        | BGFX_SAMPLER_MIN_POINT
@@ -123,61 +237,53 @@ public:
                                        | BGFX_SAMPLER_U_CLAMP
                                        | BGFX_SAMPLER_V_CLAMP;
 
-        bgfx::TextureHandle color = bgfx::createTexture2D(Screen::draw_width(),
-                                                          Screen::draw_height(),
-                                                          false,
-                                                          1,
-                                                          bgfx::TextureFormat::RGBA8,
-                                                          BGFX_TEXTURE_RT | sampler_flags);
-
         bgfx::TextureFormat::Enum depth_format = bgfx::isTextureValid(0, false, 1, bgfx::TextureFormat::D32F, BGFX_TEXTURE_RT | sampler_flags)
                                                      ? bgfx::TextureFormat::D32F
                                                      : bgfx::TextureFormat::D24;
 
-        bgfx::TextureHandle depth = bgfx::createTexture2D(Screen::draw_width(),
-                                                          Screen::draw_height(),
-                                                          false,
-                                                          1,
-                                                          depth_format,
-                                                          BGFX_TEXTURE_RT | sampler_flags);
-
-        bgfx::Attachment attach[2];
-        attach[0].init(color);
-        attach[1].init(depth, bgfx::Access::ReadWrite);
-
-        main_fb = bgfx::createFrameBuffer(std::size(attach), attach, true);
+        // sized every frame in on_render, the pool keeps it until the drawable size changes
+        main_fb_desc.flags = BGFX_TEXTURE_RT | sampler_flags;
+        main_fb_desc.add(bgfx::TextureFormat::RGBA8).add(depth_format);
 
-        pe_depth  = bgfx::createUniform("s_depth", bgfx::UniformType::Sampler);
-        pe_params = bgfx::createUniform("u_params", bgfx::UniformType::Vec4, sizeof(FogParameters) / sizeof(glm::vec4));
-        pe_shader = std::make_shared<Shader>("./res/shaders/vs_fog.bin", "./res/shaders/fs_fog.bin");
-
-        if (load_fog_data("./res/textures/Perlin_Noise.raw"))
-            pe_noise = bgfx::createUniform("s_noise", bgfx::UniformType::Sampler);
-        else {
+        Systems::rendering_init(scene);
+        Systems::fog_rendering_init();
+        Systems::quality_governor_init();
+        fog_texture = VolumeTexture::load_from_file_shared("./res/textures/Perlin_Noise.raw", FOG_TEXTURE_SIZE, FOG_TEXTURE_SIZE, FOG_TEXTURE_SIZE);
+        if (fog_texture == nullptr) {
             perror("failed to load fog data");
-            return;
         }
 
-        fog_params.noise_scale = 1.0f;
-        fog_params.density     = 0.5f;
-        fog_params.color_min   = glm::vec4(0.f, 0.432f, 1.0f, 0.422f);
-        fog_params.color_max   = glm::vec4(1, 0.0f, 0.0f, 1);
-        fog_params.box_min     = model->aabb.min;
-        fog_params.box_max     = model->aabb.max;
-
         light_params.u_ambient_light   = glm::vec3(0.6, 0.6, 0.6);
         light_params.u_dir_light_dir   = Transform::FORWARD;
         light_params.u_dir_light_color = glm::vec3(0.27, 0.27, 0.27);
 
         blit.init();
+
+        if (batch.enabled) {
+            auto poses = parse_batch_file(batch.file);
+            std::error_code error;
+            std::filesystem::create_directories(batch.out_dir, error);
+            if (!poses || error) {
+                printf("batch: nothing rendered%s%s\n", error ? ", " : "", error ? error.message().c_str() : "");
+                request_quit(1);
+                return;
+            }
+            batch.poses = std::move(*poses);
+        }
     }
 
     void on_start() override {
         // add entities to scene
-        auto teapot = scene.create();
-        scene.emplace<Transform>(teapot);
-        auto& render_comp   = scene.emplace<RenderComponent>(teapot, RenderComponent(model, program));
-        render_comp.uniform = u_diffuse_color;
+        model_entity = scene.create();
+        scene.emplace<Transform>(model_entity);
+        auto& render_comp            = scene.emplace<RenderComponent>(model_entity, RenderComponent(model, program));
+        render_comp.instanced_shader = program_instanced;
+        render_comp.uniform          = u_diffuse_color;
+
+        // one gas source filling the whole model, add more entities for more sources
+        // its box is fitted once the model finished loading
+        fog_entity = scene.create();
+        scene.emplace<FogVolume>(fog_entity, FogVolume(fog_texture, model->aabb));
 
         glm::vec3 init_pos = glm::vec3(3.0f, 1.2f, -2.0f);
         camera_entity      = scene.create();
@@ -187,14 +293,63 @@ public:
     }
 
     void on_update() override {
+        if (pending_model && !pending_model->is_ready() && pending_model->state != ModelState::Loading) {
+            pending_model.reset();
+        }
+        if (pending_model && pending_model->is_ready()) {
+            model = std::move(pending_model);
+            scene.patch<RenderComponent>(model_entity, [&](RenderComponent& render) { render.model = model; });
+        }
+
+        if (!fog_fitted && model->is_ready()) {
+            scene.get<FogVolume>(fog_entity).box = model->aabb;
+            fog_fitted                           = true;
+        }
+
+        if (batch.enabled) {
+            update_batch();
+            return;
+        }
+
+        if (flythrough.frame >= 0) {
+            update_flythrough();
+            return;
+        }
+        if (instancing_benchmark.frame >= 0) {
+            update_instancing_benchmark();
+            return;
+        }
+        if (submit_benchmark.frame >= 0) {
+            update_submit_benchmark();
+            return;
+        }
+        if (pacing_benchmark.frame >= 0) {
+            update_pacing_benchmark();
+        }
+
+        // click the scene to inspect it, looking around picks at the center of the screen
+        if (Input::mouse_button_pressed(0) && !Gui::want_capture_mouse()) {
+            glm::vec2 ndc(0.0f);
+            if (gui_capture_input) {
+                glm::vec2 mouse = glm::vec2(Input::mouse_pos());
+                ndc             = glm::vec2(mouse.x / Screen::width() * 2.0f - 1.0f, 1.0f - mouse.y / Screen::height() * 2.0f);
+            }
+            pick_at(ndc);
+        }
+
         if (!process_scene_input())
             return;
         Systems::camera_control(scene);
     }
 
     void on_render() override {
+        // settles this frame's quality before anything reads it
+        Systems::quality_governor();
         Transform& trans = scene.get<Transform>(camera_entity);
 
+        main_fb_desc.width              = (u16)std::max(Screen::draw_width(), 1);
+        main_fb_desc.height             = (u16)std::max(Screen::draw_height(), 1);
+        bgfx::FrameBufferHandle main_fb = RenderTargets::acquire(main_fb_desc);
         bgfx::setViewFrameBuffer(Gfx::main_view(), main_fb);
         light_params.u_camera_pos = glm::vec3(trans.position);
         bgfx::setUniform(u_light_params, &light_params, UINT16_MAX);
@@ -207,33 +362,19 @@ public:
         blit.blit(Gfx::pe_view(), scene_color, 0, 0, Screen::draw_width(), Screen::draw_height());
 
         // volumetric fog rendering
-        Camera& camera = scene.get<Camera>(camera_entity);
-        glm::mat4 view = trans.view_matrix();
-        glm::mat4 proj = camera.matrix();
-
-        bgfx::setViewTransform(Gfx::pe_view(), glm::value_ptr(view), glm::value_ptr(proj));
-        bgfx::setViewRect(Gfx::pe_view(), 0, 0, Screen::draw_width(), Screen::draw_height());
-        bgfx::setViewClear(Gfx::pe_view(), BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, 0);
+        Systems::fog_rendering(scene, Gfx::pe_view(), scene_depth);
 
-        bgfx::setTexture(0, pe_depth, scene_depth);
-        bgfx::setTexture(1, pe_noise, pe_noise_tex);
-
-        fog_params.camera_pos = glm::vec3(trans.position);
-        bgfx::setUniform(pe_params, &fog_params, UINT16_MAX);
-
-        // draw screen quad
-        bgfx::setVertexCount(3);
-        bgfx::setState(BGFX_STATE_WRITE_RGB
-                           | BGFX_STATE_DEPTH_TEST_ALWAYS
-                           | BGFX_STATE_CULL_CW
-                           | BGFX_STATE_BLEND_ALPHA,
-                       0);
-        // bgfx::setTexture(0, pe_color, scene_color);
-        // bgfx::setTexture(1, pe_depth, scene_depth);
-        bgfx::submit(Gfx::pe_view(), pe_shader->handle());
+        if (batch.rendering >= 0) {
+            read_batch_image((u32)batch.rendering);
+        }
     }
 
     void on_gui() override {
+        // nothing over the images
+        if (batch.enabled) {
+            return;
+        }
+
         ImGui::Begin("Control panel", nullptr, 0);
         {
             if (ImGui::BeginTabBar("menu")) {
@@ -270,7 +411,7 @@ public:
             }
             draw_compass(angle, 100.0f, IM_COL32(100, 100, 150, 255), IM_COL32_WHITE);
 
-            int density = query_fog_density(trans.position);
+            int density = int(query_fog_density(trans.position) * 255.0f);
             ImGui::SameLine();
             ImGui::VSliderInt("", ImVec2(25, 100.0f), &density, 0, 255);
             float height = trans.position.y;
@@ -287,18 +428,18 @@ public:
     void on_quit() override {
         scene.clear();
 
-        pe_shader.reset();
-        bgfx::destroy(pe_depth);
-        bgfx::destroy(pe_params);
-        bgfx::destroy(pe_noise);
-        bgfx::destroy(pe_noise_tex);
+        Systems::quality_governor_quit();
+        Systems::fog_rendering_quit();
+        Systems::rendering_quit();
+        fog_texture.reset();
 
         blit.destroy();
 
         program.reset();
+        program_instanced.reset();
         bgfx::destroy(u_diffuse_color);
         bgfx::destroy(u_light_params);
-        bgfx::destroy(main_fb);
+        pending_model.reset();
         model.reset();
     }
 
@@ -337,51 +478,428 @@ private:
         ImGui::Dummy(ImVec2(2 * radius, 2 * radius));
     }
 
-    bool load_fog_data(const char* path) {
-        using std::ios_base;
-        std::ifstream in_file(path, ios_base::binary | ios_base::ate);
-        if (!in_file.is_open()) {
-            return false;
+    // one orbit per pass from close up to far away, counts what the previous frame rendered
+    void update_flythrough() {
+        const i32 frames_per_pass = 600;
+        i32 pass                  = flythrough.frame / frames_per_pass;
+        i32 step                  = flythrough.frame % frames_per_pass;
+        if (flythrough.frame > 0) {
+            i32 last_pass = (flythrough.frame - 1) / frames_per_pass;
+            u64 triangles = Systems::rendering_stats().triangles;
+            flythrough.frames[last_pass] += 1;
+            flythrough.triangles[last_pass] += triangles;
+            flythrough.max_triangles[last_pass] = std::max(flythrough.max_triangles[last_pass], triangles);
+        }
+
+        Transform& trans = scene.get<Transform>(camera_entity);
+        if (pass >= 2) {
+            trans                                      = flythrough.saved_view;
+            Systems::rendering_settings().lods_enabled = flythrough.saved_lods;
+            flythrough.frame                           = -1;
+            return;
         }
-        auto size = in_file.tellg();
-        in_file.seekg(0, ios_base::beg);
-        fog_data = std::vector<u8>(size);
-        in_file.read((char*)fog_data.data(), fog_data.size());
-        in_file.close();
 
-        const bgfx::Memory* mem = bgfx::copy(fog_data.data(), fog_data.size());
-        pe_noise_tex            = bgfx::createTexture3D(FOG_TEXTURE_SIZE, FOG_TEXTURE_SIZE, FOG_TEXTURE_SIZE, false, bgfx::TextureFormat::R8, 0, mem);
+        Systems::rendering_settings().lods_enabled = pass == 0;
+        float t                                    = (float)step / frames_per_pass;
+        float radius                               = glm::length(model->aabb.extent()) * glm::mix(0.6f, 4.0f, t);
+        float angle                                = t * glm::two_pi<float>();
+        glm::vec3 center                           = model->aabb.center();
+        glm::vec3 eye                              = center + glm::vec3(cos(angle) * radius, radius * 0.3f, sin(angle) * radius);
+        trans                                      = Transform::look_at(eye, center);
+        ++flythrough.frame;
+    }
+
+    // `count` small copies of the model in a square grid above it, moves the camera to overlook them
+    std::vector<entt::entity> spawn_model_grid(u32 count) {
+        u32 grid_size    = (u32)std::ceil(std::sqrt((float)count));
+        glm::vec3 extent = model->aabb.extent();
+        float cell       = glm::length(extent) * 0.05f;
+        float scale      = cell * 0.8f / glm::max(extent.x, glm::max(extent.y, extent.z));
+        glm::vec3 origin = model->aabb.center() - glm::vec3(cell * grid_size * 0.5f, 0.0f, cell * grid_size * 0.5f);
+        origin.y         = model->aabb.max.y + cell;
+
+        std::vector<entt::entity> entities;
+        for (u32 i = 0; i < count; ++i) {
+            glm::vec3 position = origin + glm::vec3((i % grid_size) * cell, 0.0f, (i / grid_size) * cell);
+            glm::quat rotation = glm::angleAxis(i * 0.37f, Transform::UP);
+            // the model's origin may be far from its bounds, keep every copy inside its cell
+            position -= rotation * (model->aabb.center() * scale);
+
+            entt::entity entity = scene.create();
+            scene.emplace<Transform>(entity, position, rotation, glm::vec3(scale));
+            auto& render            = scene.emplace<RenderComponent>(entity, RenderComponent(model, program));
+            render.instanced_shader = program_instanced;
+            render.uniform          = u_diffuse_color;
+            entities.push_back(entity);
+        }
+
+        glm::vec3 center = origin + glm::vec3(cell * grid_size * 0.5f, 0.0f, cell * grid_size * 0.5f);
+        scene.get<Transform>(camera_entity) = Transform::look_at(center + glm::vec3(0.0f, 0.4f, -0.6f) * (cell * grid_size), center);
+        return entities;
+    }
+
+    // a grid of small copies of the model drawn for one pass with instancing and one without,
+    // counts what the previous frame cost. Without instancing a model with many meshes can run
+    // into bgfx's draw call limit per frame, the extra draws are then dropped by bgfx
+    void update_instancing_benchmark() {
+        const i32 frames_per_pass = 240;
+        auto& bench               = instancing_benchmark;
+        i32 pass                  = bench.frame / frames_per_pass;
+        if (bench.frame == 0) {
+            bench.entities = spawn_model_grid(100 * 100);
+        }
+        else {
+            i32 last_pass     = (bench.frame - 1) / frames_per_pass;
+            const auto& stats = Systems::rendering_stats();
+            bench.frames[last_pass] += 1;
+            bench.render_ms[last_pass] += stats.total_ms;
+            bench.frame_ms[last_pass] += Time::delta() * 1000.0f;
+            bench.draw_calls[last_pass] = stats.draw_calls;
+        }
+
+        if (pass >= 2) {
+            scene.destroy(bench.entities.begin(), bench.entities.end());
+            bench.entities.clear();
+            scene.get<Transform>(camera_entity)      = bench.saved_view;
+            Systems::rendering_settings().instancing = bench.saved_instancing;
+            bench.frame                              = -1;
+            return;
+        }
+
+        Systems::rendering_settings().instancing = pass == 0;
+        ++bench.frame;
+    }
+
+    // about 50k draws without instancing, submitted with each thread count in turn,
+    // counts what the previous frame cost
+    void update_submit_benchmark() {
+        const i32 frames_per_step = 120;
+        const u32 target_draws    = 50000;
+        auto& bench               = submit_benchmark;
+        u32 step                  = bench.frame / frames_per_step;
+        if (bench.frame == 0) {
+            u32 meshes     = std::max(1u, (u32)model->mdt.size());
+            bench.entities = spawn_model_grid((target_draws + meshes - 1) / meshes);
+        }
+        else {
+            u32 last_step     = (bench.frame - 1) / frames_per_step;
+            const auto& stats = Systems::rendering_stats();
+            bench.frames[last_step] += 1;
+            bench.submit_ms[last_step] += stats.submit_ms;
+            bench.draw_calls = stats.draw_calls;
+        }
+
+        auto& settings = Systems::rendering_settings();
+        if (step >= bench.thread_counts.size()) {
+            scene.destroy(bench.entities.begin(), bench.entities.end());
+            bench.entities.clear();
+            scene.get<Transform>(camera_entity) = bench.saved_view;
+            settings.instancing                 = bench.saved_instancing;
+            settings.submit_threads             = bench.saved_threads;
+            bench.frame                         = -1;
+            return;
+        }
+
+        settings.instancing     = false;
+        settings.submit_threads = bench.thread_counts[step];
+        ++bench.frame;
+    }
+
+    static const char* present_mode_name(PresentMode mode) {
+        switch (mode) {
+        case PresentMode::Vsync: return "vsync";
+        case PresentMode::Uncapped: return "uncapped";
+        case PresentMode::Capped: return "capped";
+        }
+        return "";
+    }
+
+    // averages frame time and latency of the previous frames, the render thread is chosen at startup
+    // by AppSetup::render_thread so compare two runs, the present mode can change in between
+    void update_pacing_benchmark() {
+        const i32 frame_count = 600;
+        auto& bench           = pacing_benchmark;
+        if (bench.frame > 0) {
+            const GfxFrameStats& frame = Gfx::frame_stats();
+            bench.frame_ms += frame.last_frame_ms;
+            bench.latency_ms += frame.last_latency_ms;
+        }
+        if (bench.frame == frame_count) {
+            bench.frame_ms /= frame_count;
+            bench.latency_ms /= frame_count;
+            bench.render_thread = Gfx::frame_stats().render_thread;
+            bench.jitter_ms     = Gfx::frame_stats().jitter_ms;
+            bench.mode          = Gfx::present().mode;
+            printf("frame pacing, %s, render thread %s: %.2f ms/frame (%.0f fps), %.2f ms latency, %.3f ms jitter\n",
+                   present_mode_name(bench.mode),
+                   bench.render_thread ? "on" : "off",
+                   bench.frame_ms,
+                   1000.0f / bench.frame_ms,
+                   bench.latency_ms,
+                   bench.jitter_ms);
+            bench.frame = -1;
+            return;
+        }
+        ++bench.frame;
+    }
+
+    // --batch <poses file> [--out <dir>] [--size <width>x<height>] renders every pose of the file without
+    // a window and quits, see parse_batch_file. --renderer works with a window as well
+    bool parse_args(AppSetup& setup) {
+        for (size_t i = 0; i < args.size(); ++i) {
+            const std::string& arg = args[i];
+            bool has_value         = i + 1 < args.size();
+            if (arg == "--batch" && has_value) {
+                batch.file = args[++i];
+            }
+            else if (arg == "--out" && has_value) {
+                batch.out_dir = args[++i];
+            }
+            else if (arg == "--size" && has_value) {
+                i32 width = 0, height = 0;
+                if (sscanf(args[++i].c_str(), "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                    return false;
+                }
+                setup.width  = width;
+                setup.height = height;
+            }
+            else if (arg == "--renderer" && has_value) {
+                auto renderer = parse_renderer(args[++i]);
+                if (!renderer) {
+                    return false;
+                }
+                setup.renderer = *renderer;
+            }
+            else {
+                return false;
+            }
+        }
+
+        if (!batch.file.empty()) {
+            batch.enabled  = true;
+            setup.headless = true;
+            // nothing to wait for but the renderer
+            setup.present.mode = PresentMode::Uncapped;
+        }
         return true;
     }
 
-    u8 query_fog_density(const glm::vec3& pos) {
-        if (glm::any(glm::lessThan(pos, model->aabb.min))
-            || glm::any(glm::lessThan(model->aabb.max, pos))) {
-            return 0.0f; // out of range
+    // every pose starts from the settings the batch started with, so an image doesn't depend on the poses before it
+    void apply_batch_pose(const BatchPose& pose) {
+        auto& fog       = Systems::fog_rendering_settings();
+        auto& rendering = Systems::rendering_settings();
+        fog             = batch.fog;
+        rendering       = batch.rendering_settings;
+
+        fog.step_size        = pose.step_size.value_or(fog.step_size);
+        fog.max_steps        = (i32)pose.max_steps.value_or((float)fog.max_steps);
+        fog.resolution_scale = pose.fog_resolution.value_or(fog.resolution_scale);
+        rendering.lod_bias   = (i32)pose.lod_bias.value_or((float)rendering.lod_bias);
+
+        FogVolume& volume  = scene.get<FogVolume>(fog_entity);
+        volume.density     = pose.density.value_or(batch.density);
+        volume.noise_scale = pose.noise_scale.value_or(batch.noise_scale);
+
+        scene.get<Transform>(camera_entity) = Transform::look_at(pose.eye, pose.target);
+        scene.get<Camera>(camera_entity).set_fov(glm::radians(pose.fov));
+    }
+
+    // one pose per frame, images are written once their read-back arrives, with a render thread
+    // a few are in flight at a time. Quits after the last one
+    void update_batch() {
+        using clock     = std::chrono::steady_clock;
+        batch.rendering = -1;
+        if (!model->is_ready()) {
+            if (model->state != ModelState::Loading) {
+                printf("batch: failed to load %s\n", MODEL_FILE);
+                request_quit(1);
+            }
+            return;
         }
 
-        auto to_offset = [](const glm::uvec3 v) {
-            return v.z * FOG_TEXTURE_SIZE * FOG_TEXTURE_SIZE
-                   + v.y * FOG_TEXTURE_SIZE
-                   + v.x;
-        };
+        if (!batch.started) {
+            const FogVolume& volume  = scene.get<FogVolume>(fog_entity);
+            batch.started            = true;
+            batch.begin              = clock::now();
+            batch.fog                = Systems::fog_rendering_settings();
+            batch.rendering_settings = Systems::rendering_settings();
+            batch.density            = volume.density;
+            batch.noise_scale        = volume.noise_scale;
+            printf("batch: %zu poses at %dx%d on %s\n",
+                   batch.poses.size(),
+                   Screen::draw_width(),
+                   Screen::draw_height(),
+                   bgfx::getRendererName(bgfx::getRendererType()));
+        }
 
-        auto clamp = [](const glm::uvec3 v) {
-            return glm::clamp(v, glm::zero<glm::uvec3>(), glm::uvec3(FOG_TEXTURE_SIZE - 1));
-        };
+        while (!batch.pending.empty() && Gfx::frame_number() >= batch.pending.front().ready_frame) {
+            write_batch_image(batch.pending.front());
+            batch.pending.pop_front();
+        }
+
+        if (batch.next < batch.poses.size()) {
+            apply_batch_pose(batch.poses[batch.next]);
+            batch.pose_begin = clock::now();
+            batch.rendering  = (i32)batch.next++;
+            return;
+        }
+        if (!batch.pending.empty()) {
+            return;
+        }
 
-        glm::vec3 extent   = model->aabb.max - model->aabb.min;
-        glm::vec3 norm_pos = (pos - model->aabb.min) / extent;
-        glm::uvec3 uvw     = norm_pos * (float)FOG_TEXTURE_SIZE;
+        float seconds = std::chrono::duration<float>(clock::now() - batch.begin).count();
+        size_t count  = batch.poses.size();
+        printf("batch: %zu images (%u written) in %.2f s, %.1f ms/image, %.2f images/s\n",
+               count,
+               batch.written,
+               seconds,
+               count ? seconds * 1000.0f / count : 0.0f,
+               seconds > 0 ? count / seconds : 0.0f);
+        // without read-back nothing is written and the run only measures, a failed write fails the batch
+        request_quit(batch.read_back && batch.written < count ? 1 : 0);
+    }
 
-        u32 offset = to_offset(uvw);
+    void read_batch_image(u32 pose) {
+        BatchImage& image = batch.pending.emplace_back();
+        image.pose        = pose;
+        image.begin       = batch.pose_begin;
+        image.width       = Screen::draw_width();
+        image.height      = Screen::draw_height();
+        image.ready_frame = Gfx::read_backbuffer(image.pixels);
+        if (image.ready_frame == 0) {
+            if (pose == 0) {
+                printf("batch: %s can't read back, rendering without writing images\n", bgfx::getRendererName(bgfx::getRendererType()));
+            }
+            batch.read_back = false;
+            batch.pending.pop_back();
+        }
+    }
 
-        return fog_data[offset];
+    void write_batch_image(const BatchImage& image) {
+        std::string filename = batch.out_dir + "/" + batch.poses[image.pose].name + ".tga";
+        if (!write_tga(filename, image.width, image.height, image.pixels.data(), bgfx::getCaps()->originBottomLeft)) {
+            printf("batch: failed to write %s\n", filename.c_str());
+            return;
+        }
+        ++batch.written;
+        printf("batch: %u/%zu %s in %.1f ms\n",
+               image.pose + 1,
+               batch.poses.size(),
+               filename.c_str(),
+               std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - image.begin).count());
+    }
+
+    // world space ray through a point of the screen, ndc in [-1, 1] with y up
+    Ray camera_ray(const glm::vec2& ndc) {
+        const Transform& trans  = scene.get<Transform>(camera_entity);
+        const Camera& camera    = scene.get<Camera>(camera_entity);
+        glm::mat4 inv_view_proj = glm::inverse(camera.matrix() * trans.view_matrix());
+        // zero to one depth, see Camera::perspective
+        glm::vec4 near = inv_view_proj * glm::vec4(ndc, 0.0f, 1.0f);
+        glm::vec4 far  = inv_view_proj * glm::vec4(ndc, 1.0f, 1.0f);
+
+        Ray ray;
+        ray.origin    = glm::vec3(near) / near.w;
+        ray.direction = glm::normalize(glm::vec3(far) / far.w - ray.origin);
+        return ray;
+    }
+
+    // the bvh is in model space, t stays the same since the transform is affine
+    Ray to_model_space(const Ray& ray) {
+        glm::mat4 to_model = glm::inverse(scene.get<Transform>(model_entity).matrix());
+        Ray local;
+        local.origin    = glm::vec3(to_model * glm::vec4(ray.origin, 1.0f));
+        local.direction = glm::vec3(to_model * glm::vec4(ray.direction, 0.0f));
+        return local;
+    }
+
+    void pick_at(const glm::vec2& ndc) {
+        pick = {};
+        if (!model->is_ready() || !model->bvh) {
+            return;
+        }
+
+        Ray ray = camera_ray(ndc);
+        RayHit hit;
+        if (!model->bvh->intersect(to_model_space(ray), hit)) {
+            return;
+        }
+        pick.hit           = true;
+        pick.point         = ray.origin + ray.direction * hit.t;
+        pick.mesh          = hit.mesh;
+        pick.triangle      = hit.triangle;
+        pick.concentration = query_fog_density(pick.point);
+        if (hit.mesh < model->mesh_diffuse.size()) {
+            pick.color = model->mesh_diffuse[hit.mesh];
+        }
+    }
+
+    // primary rays over the whole screen from the current camera, one by one and in packets
+    void run_ray_benchmark() {
+        const u32 size = 256, tile = 4; // tile * tile == BVH_PACKET_SIZE
+        std::vector<Ray> rays(size * size);
+        for (u32 y = 0; y < size; ++y) {
+            for (u32 x = 0; x < size; ++x) {
+                glm::vec2 ndc      = glm::vec2((x + 0.5f) / size, (y + 0.5f) / size) * 2.0f - 1.0f;
+                rays[y * size + x] = to_model_space(camera_ray(ndc));
+            }
+        }
+
+        const Bvh& bvh = *model->bvh;
+        ray_benchmark  = {};
+        auto start     = std::chrono::steady_clock::now();
+        for (const Ray& ray : rays) {
+            RayHit hit;
+            ray_benchmark.hits += bvh.intersect(ray, hit) ? 1 : 0;
+        }
+        float single_s = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        for (u32 ty = 0; ty < size; ty += tile) {
+            for (u32 tx = 0; tx < size; tx += tile) {
+                RayPacket packet;
+                for (u32 y = ty; y < ty + tile; ++y) {
+                    for (u32 x = tx; x < tx + tile; ++x) {
+                        packet.push(rays[y * size + x]);
+                    }
+                }
+                RayHit hits[BVH_PACKET_SIZE];
+                bvh.intersect(packet, hits);
+            }
+        }
+        float packet_s = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+        ray_benchmark.rays         = (u32)rays.size();
+        ray_benchmark.single_mrays = rays.size() / std::max(single_s, 1e-6f) / 1e6f;
+        ray_benchmark.packet_mrays = rays.size() / std::max(packet_s, 1e-6f) / 1e6f;
+    }
+
+    // densest fog among all volumes at a world position
+    float query_fog_density(const glm::vec3& pos) {
+        float density = 0.0f;
+        for (auto&& [entity, volume] : scene.view<const FogVolume>().each()) {
+            density = glm::max(density, volume.sample(pos));
+        }
+        return density;
     }
 
     void gui_control_tab() {
         const ImGuiTreeNodeFlags header_flags = ImGuiTreeNodeFlags_DefaultOpen;
 
+        if (ImGui::CollapsingHeader("Picking", header_flags)) {
+            ImGui::TextWrapped("Click the scene with the ui active, or anywhere while looking around to pick at the center");
+            if (pick.hit) {
+                ImGui::Text("point: (%.2f, %.2f, %.2f)", pick.point.x, pick.point.y, pick.point.z);
+                ImGui::Text("mesh: %u, triangle: %u", pick.mesh, pick.triangle);
+                ImGui::ColorButton("material", ImVec4(pick.color.x, pick.color.y, pick.color.z, 1.0f));
+                ImGui::SameLine();
+                ImGui::Text("gas concentration: %.3f", pick.concentration);
+            }
+            else {
+                ImGui::Text("nothing picked");
+            }
+        }
+
         if (ImGui::CollapsingHeader("Camera", header_flags)) {
             auto&& [trans, control] = scene.get<Transform, CameraControlData>(camera_entity);
             ImGui::DragFloat3("Position", glm::value_ptr(trans.position), 0, 0, 0, "%.3f");
@@ -391,20 +909,29 @@ private:
         }
 
         if (ImGui::CollapsingHeader("Fog", header_flags)) {
-            ImGui::SliderFloat("Scale", &fog_params.noise_scale, 0.0f, 1.0f);
-            ImGui::SliderFloat("Density", &fog_params.density, 0.0f, 1.0f);
-
             ImGuiColorEditFlags flags = ImGuiColorEditFlags_InputRGB
                                         | ImGuiColorEditFlags_PickerHueWheel
                                         | ImGuiColorEditFlags_AlphaBar
                                         | ImGuiColorEditFlags_AlphaPreviewHalf
                                         | ImGuiColorEditFlags_Float;
-            ImGui::ColorEdit4("Color min",
-                              glm::value_ptr(fog_params.color_min),
-                              flags);
-            ImGui::ColorEdit4("Color max",
-                              glm::value_ptr(fog_params.color_max),
-                              flags);
+
+            for (auto&& [entity, volume] : scene.view<FogVolume>().each()) {
+                ImGui::PushID((int)entity);
+                if (ImGui::TreeNodeEx("volume", ImGuiTreeNodeFlags_DefaultOpen, "Volume %u", (u32)entity)) {
+                    ImGui::SliderFloat("Scale", &volume.noise_scale, 0.0f, 1.0f);
+                    ImGui::SliderFloat("Density", &volume.density, 0.0f, 1.0f);
+                    ImGui::DragFloat3("Box min", glm::value_ptr(volume.box.min), 0.1f);
+                    ImGui::DragFloat3("Box max", glm::value_ptr(volume.box.max), 0.1f);
+                    ImGui::ColorEdit4("Color min",
+                                      glm::value_ptr(volume.color_min),
+                                      flags);
+                    ImGui::ColorEdit4("Color max",
+                                      glm::value_ptr(volume.color_max),
+                                      flags);
+                    ImGui::TreePop();
+                }
+                ImGui::PopID();
+            }
         }
 
         if (ImGui::CollapsingHeader("Light", header_flags)) {
@@ -426,6 +953,18 @@ private:
             }
             ImGui::ColorEdit3("Color", glm::value_ptr(light_params.u_dir_light_color), flags);
         }
+
+        if (ImGui::CollapsingHeader("Model", header_flags)) {
+            // reloads the model, the old one is drawn until the new one is ready
+            int format = (int)model_options.vertex_format;
+            if (ImGui::Combo("Vertex format", &format, "float\0compact, 8 bit normals\0compact, 16 bit normals\0")) {
+                model_options.vertex_format = (VertexFormat)format;
+                pending_model               = Assets::model(MODEL_FILE, model_options);
+            }
+            if (ImGui::Checkbox("Merge meshes", &model_options.merge_meshes)) {
+                pending_model = Assets::model(MODEL_FILE, model_options);
+            }
+        }
     }
 
     void gui_help_tab() {
@@ -474,6 +1013,291 @@ private:
         if (ImGui::CollapsingHeader("Gfx")) {
             ImGui::Text("main view: %u", Gfx::main_view());
             ImGui::Text("gui view: %u", Gfx::gui_view());
+            const GfxFrameStats& frame = Gfx::frame_stats();
+            ImGui::Text("render thread: %s", frame.render_thread ? "on" : "off");
+            ImGui::Text("frame: %.2f ms (%.0f fps), latency: %.2f ms", frame.frame_ms, frame.frame_ms > 0 ? 1000.0f / frame.frame_ms : 0.0f, frame.latency_ms);
+            ImGui::Text("jitter: %.3f ms, limiter waited %.2f ms", frame.jitter_ms, frame.limiter_ms);
+            PresentSettings present = Gfx::present();
+            int mode                = (int)present.mode;
+            bool changed            = ImGui::Combo("Present mode", &mode, "vsync\0uncapped\0capped\0");
+            present.mode            = (PresentMode)mode;
+            if (present.mode == PresentMode::Capped) {
+                int fps_cap = (int)present.fps_cap;
+                changed |= ImGui::SliderInt("FPS cap", &fps_cap, 10, 360);
+                present.fps_cap = (u32)fps_cap;
+                changed |= ImGui::Checkbox("Late input", &present.late_input);
+                changed |= ImGui::SliderFloat("Spin (ms)", &present.spin_ms, 0.0f, 4.0f);
+            }
+            if (changed) {
+                Gfx::set_present(present);
+            }
+            const RenderTargetStats& targets = RenderTargets::stats();
+            ImGui::Text("render targets: %u pooled (%.2f MB), %u acquired, %llu created, %llu destroyed",
+                        targets.target_count,
+                        targets.bytes / (1024.0 * 1024.0),
+                        targets.acquired,
+                        (unsigned long long)targets.created,
+                        (unsigned long long)targets.destroyed);
+            int unused_frames = (int)RenderTargets::max_unused_frames();
+            if (ImGui::SliderInt("Free targets after (frames)", &unused_frames, 1, 120)) {
+                RenderTargets::set_max_unused_frames((u32)unused_frames);
+            }
+        }
+
+        if (ImGui::CollapsingHeader("Model")) {
+            const ModelLoadStats& stats = model->stats;
+            ImGui::Text("state: %s", model->is_ready() ? "ready" : model->state == ModelState::Loading ? "loading" : "failed");
+            ImGui::Text("meshes: %u (%u in the file)", stats.mesh_count, stats.source_mesh_count);
+            ImGui::Text("merging: %.1f ms", stats.merge_ms);
+            ImGui::Text("multi material meshes: %u (%.1f ms splitting)", stats.multi_material_mesh_count, stats.material_ms);
+            ImGui::Text("corners: %llu", (unsigned long long)stats.corner_count);
+            ImGui::Text("welded vertices: %llu", (unsigned long long)stats.vertex_count);
+            ImGui::Text("indices: %llu", (unsigned long long)stats.index_count);
+            ImGui::Text("meshes with 32 bit indices: %u", stats.index32_mesh_count);
+            ImGui::Text("load time: %.1f ms%s", stats.load_ms, stats.from_cache ? " (cached)" : "");
+            u64 float_bytes = stats.vertex_count * sizeof(Vertex);
+            ImGui::Text("vertex format: %s", vertex_format_name(stats.vertex_format));
+            ImGui::Text("vertex memory: %.2f MB (%.2f MB as float, %.0f%% saved)",
+                        stats.vertex_bytes / (1024.0 * 1024.0),
+                        float_bytes / (1024.0 * 1024.0),
+                        float_bytes ? 100.0 * (1.0 - (double)stats.vertex_bytes / float_bytes) : 0.0);
+            ImGui::Text("max position error: %g", stats.max_position_error);
+            ImGui::Text("cpu geometry: %.2f MB kept, %.2f MB freed after upload",
+                        stats.cpu_bytes / (1024.0 * 1024.0),
+                        stats.freed_cpu_bytes / (1024.0 * 1024.0));
+            ImGui::Text("waiting for bgfx to release: %.2f MB", Model::referenced_bytes() / (1024.0 * 1024.0));
+            ImGui::Text("vertex cache acmr: %.3f -> %.3f", stats.vertex_cache_before.acmr(), stats.vertex_cache_after.acmr());
+            ImGui::Text("vertex cache atvr: %.3f -> %.3f", stats.vertex_cache_before.atvr(), stats.vertex_cache_after.atvr());
+            ImGui::Text("optimizing: %.1f ms", stats.optimize_ms);
+            ImGui::Text("lod triangles: %llu / %llu / %llu / %llu",
+                        (unsigned long long)stats.lod_triangle_count[0],
+                        (unsigned long long)stats.lod_triangle_count[1],
+                        (unsigned long long)stats.lod_triangle_count[2],
+                        (unsigned long long)stats.lod_triangle_count[3]);
+            ImGui::Text("simplifying: %.1f ms", stats.lod_ms);
+            if (model->bvh) {
+                ImGui::Text("bvh: %u nodes, %.2f MB, built in %.1f ms", model->bvh->node_count(), stats.bvh_bytes / (1024.0 * 1024.0), stats.bvh_ms);
+            }
+            if (model->occluders) {
+                ImGui::Text("occluders: %u triangles, picked in %.1f ms", model->occluders->triangle_count(), stats.occluder_ms);
+            }
+        }
+
+        if (ImGui::CollapsingHeader("Assets")) {
+            const AssetStats& stats = Assets::stats();
+            u64 lookups             = stats.hits + stats.misses;
+            ImGui::Text("models: %u, shaders: %u", stats.model_count, stats.shader_count);
+            ImGui::Text("hits: %llu, misses: %llu (%.0f%% hit rate)",
+                        (unsigned long long)stats.hits,
+                        (unsigned long long)stats.misses,
+                        lookups ? 100.0 * stats.hits / lookups : 0.0);
+            ImGui::Text("evictions: %llu", (unsigned long long)stats.evictions);
+            ImGui::Text("resident: %.2f MB (%.2f MB unused)", stats.resident_bytes / (1024.0 * 1024.0), stats.unused_bytes / (1024.0 * 1024.0));
+            int budget_mb = (int)(Assets::memory_budget() >> 20);
+            if (ImGui::SliderInt("Budget (MB)", &budget_mb, 16, 2048)) {
+                Assets::set_memory_budget((u64)budget_mb << 20);
+            }
+        }
+
+        if (ImGui::CollapsingHeader("Rendering")) {
+            const auto& stats = Systems::rendering_stats();
+            ImGui::Text("draw calls: %u (%u without merging)", stats.draw_calls, model->stats.source_mesh_count);
+            ImGui::Text("triangles: %llu", (unsigned long long)stats.triangles);
+            ImGui::Text("draws per lod: %u / %u / %u / %u", stats.lod_draws[0], stats.lod_draws[1], stats.lod_draws[2], stats.lod_draws[3]);
+            ImGui::Text("frustum: %u submitted, %u culled in %.3f ms", stats.draw_calls, stats.culled_meshes, stats.cull_ms);
+            auto& settings = Systems::rendering_settings();
+            ImGui::Checkbox("LODs", &settings.lods_enabled);
+            ImGui::SliderFloat("LOD error (px)", &settings.lod_error_pixels, 0.25f, 8.0f);
+            ImGui::SliderInt("LOD bias", &settings.lod_bias, -(MAX_MESH_LODS - 1), MAX_MESH_LODS - 1);
+            ImGui::Checkbox("Frustum culling", &settings.frustum_culling);
+            ImGui::Text("occlusion: %u of %u tested occluded (%.1f%%), %u entities, %u meshes",
+                        stats.occluded_instances + stats.occluded_meshes,
+                        stats.occlusion_tests,
+                        stats.occlusion_tests ? 100.0 * (stats.occluded_instances + stats.occluded_meshes) / stats.occlusion_tests : 0.0,
+                        stats.occluded_instances,
+                        stats.occluded_meshes);
+            ImGui::Text("occluders: %u triangles, %.3f ms rasterizing, %.3f ms testing", stats.occluder_triangles, stats.occlusion_raster_ms, stats.occlusion_test_ms);
+            ImGui::Checkbox("Occlusion culling", &settings.occlusion_culling);
+            int occluder_budget = (int)settings.occluder_budget;
+            if (ImGui::SliderInt("Occluder triangles", &occluder_budget, 0, 1 << 18)) {
+                settings.occluder_budget = (u32)occluder_budget;
+            }
+            ImGui::Text("instancing: %u instances in %u draws, %u entities culled", stats.instances, stats.instanced_draws, stats.culled_instances);
+            ImGui::Text("queue: %u packets, %.3f ms sort, %.3f ms submit, %.3f ms total", stats.draw_calls, stats.sort_ms, stats.submit_ms, stats.total_ms);
+            ImGui::Text("skipped: %u uniforms, %u states, %u entities updated", stats.skipped_uniforms, stats.skipped_states, stats.updated_entities);
+            ImGui::Checkbox("Instancing", &settings.instancing);
+            int submit_threads = (int)settings.submit_threads;
+            if (ImGui::SliderInt("Submit threads", &submit_threads, 1, (int)bgfx::getCaps()->limits.maxEncoders)) {
+                settings.submit_threads = (u32)submit_threads;
+            }
+            ImGui::Text("submitted on %u threads", stats.submit_threads);
+        }
+
+        if (ImGui::CollapsingHeader("Benchmarks")) {
+            if (ImGui::Button("Ray casting") && model->is_ready() && model->bvh) {
+                run_ray_benchmark();
+            }
+            if (ray_benchmark.rays > 0) {
+                ImGui::Text("%u rays, %u hits: %.2f Mrays/s single, %.2f Mrays/s in packets of %d",
+                            ray_benchmark.rays,
+                            ray_benchmark.hits,
+                            ray_benchmark.single_mrays,
+                            ray_benchmark.packet_mrays,
+                            BVH_PACKET_SIZE);
+            }
+            // orbits the camera around the model, once with lods and once at full detail
+            if (ImGui::Button("LOD flythrough") && model->is_ready() && flythrough.frame < 0) {
+                flythrough            = {};
+                flythrough.frame      = 0;
+                flythrough.saved_view = scene.get<Transform>(camera_entity);
+                flythrough.saved_lods = Systems::rendering_settings().lods_enabled;
+            }
+            for (u32 pass = 0; pass < 2; ++pass) {
+                if (flythrough.frames[pass] > 0) {
+                    ImGui::Text("%s: %.0f avg, %llu max triangles/frame",
+                                pass == 0 ? "with lods" : "full detail",
+                                (double)flythrough.triangles[pass] / flythrough.frames[pass],
+                                (unsigned long long)flythrough.max_triangles[pass]);
+                }
+            }
+            if (ImGui::Button("Instancing (10k)") && model->is_ready() && instancing_benchmark.frame < 0) {
+                instancing_benchmark                  = {};
+                instancing_benchmark.frame            = 0;
+                instancing_benchmark.saved_view       = scene.get<Transform>(camera_entity);
+                instancing_benchmark.saved_instancing = Systems::rendering_settings().instancing;
+            }
+            for (u32 pass = 0; pass < 2; ++pass) {
+                const auto& bench = instancing_benchmark;
+                if (bench.frames[pass] > 0) {
+                    ImGui::Text("%s: %u draws, %.2f ms rendering system, %.2f ms frame",
+                                pass == 0 ? "instanced" : "one by one",
+                                bench.draw_calls[pass],
+                                bench.render_ms[pass] / bench.frames[pass],
+                                bench.frame_ms[pass] / bench.frames[pass]);
+                }
+            }
+            if (ImGui::Button("Submission scaling (50k draws)") && model->is_ready() && submit_benchmark.frame < 0) {
+                auto& settings                    = Systems::rendering_settings();
+                submit_benchmark                  = {};
+                submit_benchmark.frame            = 0;
+                submit_benchmark.saved_view       = scene.get<Transform>(camera_entity);
+                submit_benchmark.saved_instancing = settings.instancing;
+                submit_benchmark.saved_threads    = settings.submit_threads;
+                // powers of two up to what both bgfx and the thread pool can use
+                u32 max_threads = std::min(bgfx::getCaps()->limits.maxEncoders, ThreadPool::shared().worker_count() + 1);
+                for (u32 threads = 1; threads < max_threads; threads *= 2) {
+                    submit_benchmark.thread_counts.push_back(threads);
+                }
+                submit_benchmark.thread_counts.push_back(max_threads);
+                submit_benchmark.frames.assign(submit_benchmark.thread_counts.size(), 0);
+                submit_benchmark.submit_ms.assign(submit_benchmark.thread_counts.size(), 0.0f);
+            }
+            if (!submit_benchmark.frames.empty() && submit_benchmark.frames[0] > 0) {
+                const auto& bench = submit_benchmark;
+                float base_ms     = bench.submit_ms[0] / bench.frames[0];
+                ImGui::Text("%u draws", bench.draw_calls);
+                for (size_t i = 0; i < bench.thread_counts.size(); ++i) {
+                    if (bench.frames[i] == 0) {
+                        continue;
+                    }
+                    float ms = bench.submit_ms[i] / bench.frames[i];
+                    ImGui::Text("%u threads: %.2f ms, %.2fx", bench.thread_counts[i], ms, ms > 0 ? base_ms / ms : 0.0f);
+                }
+            }
+            if (ImGui::Button("Frame pacing") && pacing_benchmark.frame < 0) {
+                pacing_benchmark       = {};
+                pacing_benchmark.frame = 0;
+            }
+            if (pacing_benchmark.frame < 0 && pacing_benchmark.frame_ms > 0) {
+                ImGui::Text("%s, render thread %s: %.2f ms/frame, %.2f ms latency, %.3f ms jitter",
+                            present_mode_name(pacing_benchmark.mode),
+                            pacing_benchmark.render_thread ? "on" : "off",
+                            pacing_benchmark.frame_ms,
+                            pacing_benchmark.latency_ms,
+                            pacing_benchmark.jitter_ms);
+            }
+            // reloads the model bypassing the cache, blocks the ui while running
+            if (ImGui::Button("Model load scaling")) {
+                load_benchmark.clear();
+                // powers of two, then every hardware thread
+                u32 max_threads = std::max(1u, std::thread::hardware_concurrency());
+                std::vector<u32> thread_counts;
+                for (u32 threads = 1; threads < max_threads; threads *= 2) {
+                    thread_counts.push_back(threads);
+                }
+                thread_counts.push_back(max_threads);
+
+                for (u32 threads : thread_counts) {
+                    ModelLoadOptions options;
+                    options.thread_count = threads;
+                    options.use_cache    = false;
+                    if (auto result = Model::load_from_file(MODEL_FILE, options)) {
+                        load_benchmark.push_back(result->stats);
+                    }
+                }
+            }
+            for (const ModelLoadStats& stats : load_benchmark) {
+                ImGui::Text("%2u threads: load %.1f ms, processing %.1f ms (x%.2f)",
+                            stats.thread_count,
+                            stats.load_ms,
+                            stats.process_ms,
+                            load_benchmark.front().process_ms / std::max(stats.process_ms, 0.001f));
+            }
+
+            // parsing only, tinyobjloader leaves welding to the caller
+            ImGui::InputText("OBJ file", obj_benchmark_file, sizeof(obj_benchmark_file));
+            if (ImGui::Button("Compare with tinyobjloader")) {
+                obj_benchmark = {};
+                if (auto result = load_obj(obj_benchmark_file, &ThreadPool::shared())) {
+                    obj_benchmark.file_mb  = (float)result->file_size / (1024.0f * 1024.0f);
+                    obj_benchmark.parse_ms = result->parse_ms;
+                    obj_benchmark.build_ms = result->build_ms;
+                }
+                obj_benchmark.tinyobj_ms = benchmark_tinyobj(obj_benchmark_file);
+            }
+            if (obj_benchmark.parse_ms > 0) {
+                ImGui::Text("load_obj: %.1f ms (%.0f MB/s), welding %.1f ms",
+                            obj_benchmark.parse_ms,
+                            obj_benchmark.file_mb * 1000.0f / obj_benchmark.parse_ms,
+                            obj_benchmark.build_ms);
+            }
+            if (obj_benchmark.tinyobj_ms > 0) {
+                ImGui::Text("tinyobjloader: %.1f ms (%.0f MB/s, x%.2f)",
+                            obj_benchmark.tinyobj_ms,
+                            obj_benchmark.file_mb * 1000.0f / obj_benchmark.tinyobj_ms,
+                            obj_benchmark.tinyobj_ms / std::max(obj_benchmark.parse_ms, 0.001f));
+            }
+        }
+
+        if (ImGui::CollapsingHeader("Fog")) {
+            const auto& stats = Systems::fog_rendering_stats();
+            ImGui::Text("volumes: %u", stats.total_volumes);
+            ImGui::Text("visible volumes: %u", stats.visible_volumes);
+            ImGui::Text("passes: %u", stats.passes);
+            auto& settings = Systems::fog_rendering_settings();
+            ImGui::SliderFloat("Step size", &settings.step_size, 0.05f, 1.0f);
+            ImGui::SliderInt("Max steps", &settings.max_steps, 8, 512);
+            ImGui::SliderFloat("Resolution", &settings.resolution_scale, 0.25f, 1.0f);
+            ImGui::Text("marched at %ux%u", stats.width, stats.height);
+        }
+
+        if (ImGui::CollapsingHeader("Quality governor")) {
+            const auto& stats = Systems::quality_governor_stats();
+            auto& settings    = Systems::quality_governor_settings();
+            ImGui::Checkbox("Enabled", &settings.enabled);
+            ImGui::SliderFloat("Target (ms)", &settings.target_ms, 4.0f, 50.0f);
+            ImGui::SliderFloat("Degrade above", &settings.degrade_above, 1.0f, 1.5f);
+            ImGui::SliderFloat("Upgrade below", &settings.upgrade_below, 0.5f, 1.0f);
+            ImGui::Text("frame: %.2f ms average, last %.2f ms cpu, %.2f ms gpu", stats.frame_ms, stats.cpu_ms, stats.gpu_ms);
+            ImGui::Text("upgrades wait %u frames of headroom", stats.upgrade_delay);
+            for (const auto& knob : stats.knobs) {
+                ImGui::Text("%s: %s (%u/%u)", knob.name.c_str(), knob.level_name.c_str(), knob.level, knob.level_count - 1);
+            }
+            ImGui::Separator();
+            // latest first
+            for (auto it = stats.decisions.rbegin(); it != stats.decisions.rend(); ++it) {
+                ImGui::Text("frame %llu: %s %u -> %u at %.2f ms", (unsigned long long)it->frame, it->knob.c_str(), it->from, it->to, it->frame_ms);
+            }
         }
 
         if (ImGui::CollapsingHeader("Time")) {
@@ -534,6 +1358,7 @@ private:
     bool gui_capture_input = true;
     std::shared_ptr<Model> model;
     std::shared_ptr<Shader> program;
+    std::shared_ptr<Shader> program_instanced;
     // todo: move these else where
     bgfx::UniformHandle u_diffuse_color = BGFX_INVALID_HANDLE;
     bgfx::UniformHandle u_light_params  = BGFX_INVALID_HANDLE;
@@ -541,15 +1366,99 @@ private:
 
     Blit blit;
 
-    std::vector<u8> fog_data;
-    FogParameters fog_params;
-    bgfx::FrameBufferHandle main_fb;
-    bgfx::UniformHandle pe_depth;
-    bgfx::UniformHandle pe_noise;
-    bgfx::UniformHandle pe_params;
-    std::shared_ptr<Shader> pe_shader;
-
-    bgfx::TextureHandle pe_noise_tex;
+    std::shared_ptr<VolumeTexture> fog_texture;
+    entt::entity fog_entity = entt::null;
+    bool fog_fitted         = false;
+    std::vector<ModelLoadStats> load_benchmark;
+    ModelLoadOptions model_options;
+    std::shared_ptr<Model> pending_model;
+    entt::entity model_entity = entt::null;
+    char obj_benchmark_file[256] = "./res/models/A_full.obj";
+    struct {
+        float file_mb    = 0;
+        float parse_ms   = 0;
+        float build_ms   = 0;
+        float tinyobj_ms = 0;
+    } obj_benchmark;
+    struct {
+        bool hit            = false;
+        glm::vec3 point     = glm::vec3(0);
+        u32 mesh            = 0;
+        u32 triangle        = 0;
+        glm::vec4 color     = glm::vec4(0);
+        float concentration = 0;
+    } pick;
+    struct {
+        u32 rays           = 0;
+        u32 hits           = 0;
+        float single_mrays = 0;
+        float packet_mrays = 0;
+    } ray_benchmark;
+    struct {
+        i32 frame            = -1; // running while >= 0
+        u32 frames[2]        = {};
+        u64 triangles[2]     = {};
+        u64 max_triangles[2] = {};
+        Transform saved_view;
+        bool saved_lods = true;
+    } flythrough;
+    struct {
+        i32 frame          = -1; // running while >= 0
+        u32 frames[2]      = {};
+        float render_ms[2] = {};
+        float frame_ms[2]  = {};
+        u32 draw_calls[2]  = {};
+        std::vector<entt::entity> entities;
+        Transform saved_view;
+        bool saved_instancing = true;
+    } instancing_benchmark;
+    struct {
+        i32 frame = -1; // running while >= 0
+        std::vector<u32> thread_counts;
+        std::vector<u32> frames;
+        std::vector<float> submit_ms;
+        u32 draw_calls = 0;
+        std::vector<entt::entity> entities;
+        Transform saved_view;
+        bool saved_instancing = true;
+        u32 saved_threads     = 1;
+    } submit_benchmark;
+    struct {
+        i32 frame          = -1; // running while >= 0
+        float frame_ms     = 0;
+        float latency_ms   = 0;
+        float jitter_ms    = 0; // standard deviation over the last frames of the run
+        bool render_thread = false;
+        PresentMode mode   = PresentMode::Vsync;
+    } pacing_benchmark;
+    RenderTargetDesc main_fb_desc;
+    struct BatchImage {
+        u32 pose        = 0;
+        u32 width       = 0;
+        u32 height      = 0;
+        u32 ready_frame = 0; // Gfx::frame_number once pixels is filled
+        std::vector<u8> pixels;
+        std::chrono::steady_clock::time_point begin; // pose applied
+    };
+    struct {
+        bool enabled = false;
+        std::string file;
+        std::string out_dir = ".";
+        std::vector<BatchPose> poses;
+        u32 next       = 0;
+        i32 rendering  = -1; // pose of the frame being built
+        u32 written    = 0;
+        bool read_back = true; // false once the renderer turned out not to support it
+        std::deque<BatchImage> pending; // oldest first, a deque keeps their pixels in place
+        bool started = false;
+        std::chrono::steady_clock::time_point begin;
+        std::chrono::steady_clock::time_point pose_begin;
+        // what every pose starts from
+        Systems::FogRenderingSettings fog;
+        Systems::RenderingSettings rendering_settings;
+        float density     = 0;
+        float noise_scale = 0;
+    } batch;
 
     // todo put these into base class
     entt::registry scene;
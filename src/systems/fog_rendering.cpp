@@ -0,0 +1,282 @@
+#include "fog_rendering.h"
+#include <entt/entity/registry.hpp>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+#include "core/gfx.h"
+#include "core/screen.h"
+#include "core/graphic/shader.h"
+#include "core/graphic/assets.h"
+#include "core/graphic/frustum.h"
+#include "core/graphic/render_targets.h"
+#include "core/graphic/volume_texture.h"
+
+#include "components/transform.h"
+#include "components/camera.h"
+#include "components/fog_volume.h"
+
+// must match MAX_VOLUMES in fs_fog.sc
+#define MAX_FOG_VOLUMES_PER_PASS 4
+
+struct FogPassParameters {
+    glm::vec3 camera_pos;
+    float volume_count;
+    float step_size;
+    float max_steps;
+    glm::vec2 _pad0;
+};
+
+struct FogVolumeParameters {
+    glm::vec3 box_min;
+    float noise_scale;
+    glm::vec3 box_max;
+    float density;
+    glm::vec4 color_min;
+    glm::vec4 color_max;
+};
+
+struct VisibleFogVolume {
+    const FogVolume* volume;
+    float distance; // from camera to the closest point of the box
+};
+
+struct FogRenderingImpl {
+    std::shared_ptr<Shader> shader;
+    bgfx::UniformHandle u_depth         = BGFX_INVALID_HANDLE;
+    bgfx::UniformHandle u_pass_params   = BGFX_INVALID_HANDLE;
+    bgfx::UniformHandle u_volume_params = BGFX_INVALID_HANDLE;
+    bgfx::UniformHandle u_volumes[MAX_FOG_VOLUMES_PER_PASS];
+
+    Systems::FogRenderingSettings settings;
+    Systems::FogRenderingStats stats;
+    std::vector<VisibleFogVolume> visible; // reused between frames
+
+    // upsamples the reduced resolution target, premultiplied like the passes
+    std::shared_ptr<Shader> composite;
+    bgfx::UniformHandle u_color = BGFX_INVALID_HANDLE;
+    bgfx::TextureFormat::Enum low_res_format;
+};
+
+static FogRenderingImpl* s_fog_impl = nullptr;
+
+// screen space rect covered by a box, false if the box crosses the camera plane
+static bool project_box(const AABB& box, const glm::mat4& view_proj, glm::vec2& rect_min, glm::vec2& rect_max) {
+    rect_min = glm::vec2(1.0f);
+    rect_max = glm::vec2(-1.0f);
+    for (u32 i = 0; i < 8; ++i) {
+        glm::vec4 corner = glm::vec4(i & 1 ? box.max.x : box.min.x,
+                                     i & 2 ? box.max.y : box.min.y,
+                                     i & 4 ? box.max.z : box.min.z,
+                                     1.0f);
+        glm::vec4 clip = view_proj * corner;
+        if (clip.w <= 0.0f) {
+            return false;
+        }
+        glm::vec2 ndc = glm::vec2(clip) / clip.w;
+        rect_min      = glm::min(rect_min, ndc);
+        rect_max      = glm::max(rect_max, ndc);
+    }
+    rect_min = glm::clamp(rect_min, -1.0f, 1.0f);
+    rect_max = glm::clamp(rect_max, -1.0f, 1.0f);
+    return true;
+}
+
+namespace Systems {
+    bool fog_rendering_init() {
+        assert(s_fog_impl == nullptr && "fog rendering is initialized twice");
+        s_fog_impl = new FogRenderingImpl();
+
+        s_fog_impl->shader          = Assets::shader("vs_fog", "fs_fog");
+        s_fog_impl->u_depth         = bgfx::createUniform("s_depth", bgfx::UniformType::Sampler);
+        s_fog_impl->u_pass_params   = bgfx::createUniform("u_fog_params", bgfx::UniformType::Vec4, sizeof(FogPassParameters) / sizeof(glm::vec4));
+        s_fog_impl->u_volume_params = bgfx::createUniform("u_fog_volumes",
+                                                          bgfx::UniformType::Vec4,
+                                                          MAX_FOG_VOLUMES_PER_PASS * sizeof(FogVolumeParameters) / sizeof(glm::vec4));
+
+        const char* sampler_names[MAX_FOG_VOLUMES_PER_PASS] = { "s_volume0", "s_volume1", "s_volume2", "s_volume3" };
+        for (u32 i = 0; i < MAX_FOG_VOLUMES_PER_PASS; ++i) {
+            s_fog_impl->u_volumes[i] = bgfx::createUniform(sampler_names[i], bgfx::UniformType::Sampler);
+        }
+
+        s_fog_impl->composite = Assets::shader("vs_blit", "fs_blit");
+        s_fog_impl->u_color   = bgfx::createUniform("s_color", bgfx::UniformType::Sampler);
+        // fog is smooth, half floats keep thin layers from banding after blending
+        s_fog_impl->low_res_format = bgfx::isTextureValid(0, false, 1, bgfx::TextureFormat::RGBA16F, BGFX_TEXTURE_RT)
+                                         ? bgfx::TextureFormat::RGBA16F
+                                         : bgfx::TextureFormat::RGBA8;
+        return true;
+    }
+
+    void fog_rendering_quit() {
+        if (s_fog_impl == nullptr) {
+            return;
+        }
+
+        s_fog_impl->shader.reset();
+        bgfx::destroy(s_fog_impl->u_depth);
+        bgfx::destroy(s_fog_impl->u_pass_params);
+        bgfx::destroy(s_fog_impl->u_volume_params);
+        for (auto& u : s_fog_impl->u_volumes) {
+            bgfx::destroy(u);
+        }
+        s_fog_impl->composite.reset();
+        bgfx::destroy(s_fog_impl->u_color);
+        delete s_fog_impl;
+        s_fog_impl = nullptr;
+    }
+
+    FogRenderingSettings& fog_rendering_settings() {
+        return s_fog_impl->settings;
+    }
+
+    const FogRenderingStats& fog_rendering_stats() {
+        return s_fog_impl->stats;
+    }
+
+    void fog_rendering(entt::registry& scene, bgfx::ViewId view, bgfx::TextureHandle scene_depth) {
+        FogRenderingStats& stats             = s_fog_impl->stats;
+        stats                                = FogRenderingStats();
+        const FogRenderingSettings& settings = s_fog_impl->settings;
+
+        for (auto&& [entity, trans, camera] : scene.view<const Transform, const Camera>().each()) {
+            glm::mat4 view_mat  = trans.view_matrix();
+            glm::mat4 proj      = camera.matrix();
+            glm::mat4 view_proj = proj * view_mat;
+            glm::vec3 eye       = trans.position;
+            Frustum frustum     = Frustum::from_matrix(view_proj);
+
+            // a reduced resolution goes through fog_view first, the shader finds depth by the view rect
+            const float scale       = glm::clamp(settings.resolution_scale, 0.1f, 1.0f);
+            const bool low_res      = scale < 1.0f;
+            const bgfx::ViewId pass = low_res ? Gfx::fog_view() : view;
+            const u16 width         = (u16)std::max(1, (i32)(Screen::draw_width() * scale));
+            const u16 height        = (u16)std::max(1, (i32)(Screen::draw_height() * scale));
+            stats.width             = width;
+            stats.height            = height;
+            bgfx::FrameBufferHandle low_res_fb = BGFX_INVALID_HANDLE;
+            if (low_res) {
+                RenderTargetDesc desc;
+                desc.width  = width;
+                desc.height = height;
+                desc.flags  = BGFX_TEXTURE_RT | BGFX_SAMPLER_U_CLAMP | BGFX_SAMPLER_V_CLAMP;
+                low_res_fb  = RenderTargets::acquire(desc.add(s_fog_impl->low_res_format));
+                bgfx::setViewFrameBuffer(pass, low_res_fb);
+                bgfx::setViewClear(pass, BGFX_CLEAR_COLOR, 0x00000000);
+                bgfx::setViewMode(pass, bgfx::ViewMode::Sequential);
+            }
+            bgfx::setViewTransform(pass, glm::value_ptr(view_mat), glm::value_ptr(proj));
+            bgfx::setViewRect(pass, 0, 0, width, height);
+
+            // cull, only visible volumes cost anything past this point
+            auto& visible = s_fog_impl->visible;
+            visible.clear();
+            for (auto&& [volume_entity, volume] : scene.view<const FogVolume>().each()) {
+                ++stats.total_volumes;
+                if (volume.texture == nullptr || !frustum.intersects(volume.box)) {
+                    continue;
+                }
+                glm::vec3 closest = glm::clamp(eye, volume.box.min, volume.box.max);
+                visible.push_back({ &volume, glm::distance(eye, closest) });
+            }
+            stats.visible_volumes = (u32)visible.size();
+            if (visible.empty()) {
+                break;
+            }
+
+            // front to back, the shader composites volumes of one pass in this order
+            std::sort(visible.begin(), visible.end(), [](const VisibleFogVolume& a, const VisibleFogVolume& b) {
+                return a.distance < b.distance;
+            });
+
+            const u32 pass_count = (u32)(visible.size() + MAX_FOG_VOLUMES_PER_PASS - 1) / MAX_FOG_VOLUMES_PER_PASS;
+
+            // passes are blended over each other, so submit the farthest batch first
+            for (u32 pass = pass_count; pass-- > 0;) {
+                u32 first = pass * MAX_FOG_VOLUMES_PER_PASS;
+                u32 count = std::min<u32>(MAX_FOG_VOLUMES_PER_PASS, (u32)visible.size() - first);
+
+                FogPassParameters pass_params;
+                pass_params.camera_pos   = eye;
+                pass_params.volume_count = (float)count;
+                pass_params.step_size    = settings.step_size;
+                pass_params.max_steps    = (float)settings.max_steps;
+
+                FogVolumeParameters volume_params[MAX_FOG_VOLUMES_PER_PASS] = {};
+
+                bool full_screen   = false;
+                glm::vec2 rect_min = glm::vec2(1.0f);
+                glm::vec2 rect_max = glm::vec2(-1.0f);
+                for (u32 i = 0; i < count; ++i) {
+                    const FogVolume& volume = *visible[first + i].volume;
+
+                    FogVolumeParameters& p = volume_params[i];
+                    p.box_min              = volume.box.min;
+                    p.noise_scale          = volume.noise_scale;
+                    p.box_max              = volume.box.max;
+                    p.density              = volume.density;
+                    p.color_min            = volume.color_min;
+                    p.color_max            = volume.color_max;
+
+                    glm::vec2 box_min, box_max;
+                    if (project_box(volume.box, view_proj, box_min, box_max)) {
+                        rect_min = glm::min(rect_min, box_min);
+                        rect_max = glm::max(rect_max, box_max);
+                    }
+                    else {
+                        full_screen = true;
+                    }
+                }
+
+                // only shade the pixels the batch can cover
+                if (full_screen) {
+                    bgfx::setScissor(0, 0, width, height);
+                }
+                else {
+                    u16 x0 = (u16)glm::floor((rect_min.x * 0.5f + 0.5f) * width);
+                    u16 x1 = (u16)glm::ceil((rect_max.x * 0.5f + 0.5f) * width);
+                    u16 y0 = (u16)glm::floor((0.5f - rect_max.y * 0.5f) * height);
+                    u16 y1 = (u16)glm::ceil((0.5f - rect_min.y * 0.5f) * height);
+                    if (x1 <= x0 || y1 <= y0) {
+                        continue;
+                    }
+                    bgfx::setScissor(x0, y0, x1 - x0, y1 - y0);
+                }
+
+                bgfx::setTexture(0, s_fog_impl->u_depth, scene_depth);
+                for (u32 i = 0; i < count; ++i) {
+                    bgfx::setTexture(1 + i, s_fog_impl->u_volumes[i], visible[first + i].volume->texture->handle());
+                }
+                bgfx::setUniform(s_fog_impl->u_pass_params, &pass_params, UINT16_MAX);
+                bgfx::setUniform(s_fog_impl->u_volume_params, volume_params, UINT16_MAX);
+
+                // draw screen quad, output is premultiplied
+                bgfx::setVertexCount(3);
+                bgfx::setState(BGFX_STATE_WRITE_RGB
+                                   | BGFX_STATE_DEPTH_TEST_ALWAYS
+                                   | BGFX_STATE_CULL_CW
+                                   | BGFX_STATE_BLEND_FUNC(BGFX_STATE_BLEND_ONE, BGFX_STATE_BLEND_INV_SRC_ALPHA),
+                               0);
+                bgfx::submit(pass, s_fog_impl->shader->handle());
+                ++stats.passes;
+            }
+
+            // upsample over the scene, filtered and blended like a full resolution pass
+            if (low_res && stats.passes > 0) {
+                bgfx::setTexture(0, s_fog_impl->u_color, bgfx::getTexture(low_res_fb, 0), BGFX_SAMPLER_U_CLAMP | BGFX_SAMPLER_V_CLAMP);
+                bgfx::setVertexCount(3);
+                bgfx::setState(BGFX_STATE_WRITE_RGB
+                                   | BGFX_STATE_DEPTH_TEST_ALWAYS
+                                   | BGFX_STATE_CULL_CW
+                                   | BGFX_STATE_BLEND_FUNC(BGFX_STATE_BLEND_ONE, BGFX_STATE_BLEND_INV_SRC_ALPHA),
+                               0);
+                bgfx::submit(view, s_fog_impl->composite->handle());
+            }
+
+            // we only support only one camera in scene for now
+            break;
+        }
+    }
+} // namespace Systems
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "entt/fwd.hpp"
+#include <bgfx/bgfx.h>
+#include "core/types.h"
+
+namespace Systems {
+    struct FogRenderingSettings {
+        float step_size        = 0.25f;
+        i32 max_steps          = 100;
+        float resolution_scale = 1.0f; // below 1 volumes are marched into a smaller target and upsampled
+    };
+
+    struct FogRenderingStats {
+        u32 total_volumes   = 0;
+        u32 visible_volumes = 0;
+        u32 passes          = 0;
+        u16 width           = 0; // of the target volumes were marched into
+        u16 height          = 0;
+    };
+
+    bool fog_rendering_init();
+    void fog_rendering_quit();
+
+    // raymarch every visible FogVolume on top of what is already in `view`,
+    // scene_depth is the depth buffer the scene was rendered with
+    void fog_rendering(entt::registry& scene, bgfx::ViewId view, bgfx::TextureHandle scene_depth);
+
+    FogRenderingSettings& fog_rendering_settings();
+    const FogRenderingStats& fog_rendering_stats();
+}
@@ -0,0 +1,259 @@
+#include "quality_governor.h"
+#include <bgfx/bgfx.h>
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+#include "systems/fog_rendering.h"
+#include "systems/rendering.h"
+
+#define MAX_QUALITY_DECISIONS 8
+
+struct RegisteredKnob {
+    Systems::QualityKnobId id;
+    Systems::QualityKnob knob;
+    u32 level = 0;
+};
+
+struct QualityGovernorImpl {
+    Systems::QualityGovernorSettings settings;
+    Systems::QualityGovernorStats stats;
+    std::vector<RegisteredKnob> knobs;
+    Systems::QualityKnobId next_id = 1;
+
+    std::vector<float> history; // frame costs since the last decision, oldest first
+    u64 frame              = 0;
+    u32 headroom_frames    = 0; // consecutive frames under upgrade_below
+    u32 upgrade_delay      = 0; // current, see QualityGovernorSettings::upgrade_delay
+    u64 last_upgrade_frame = 0; // 0 once the last upgrade held
+    bool was_enabled       = false;
+};
+
+static QualityGovernorImpl* s_governor_impl = nullptr;
+
+// fog step count and size move together, fewer and longer steps cover the same depth
+static const struct {
+    i32 max_steps;
+    float step_size;
+} FOG_STEP_LEVELS[] = { { 100, 0.25f }, { 72, 0.35f }, { 50, 0.5f }, { 36, 0.7f } };
+
+static const float FOG_RESOLUTION_LEVELS[] = { 1.0f, 0.75f, 0.5f };
+
+static const i32 LOD_BIAS_LEVELS[] = { 0, 1, 2 };
+
+static void update_knob_stats() {
+    auto& knobs = s_governor_impl->stats.knobs;
+    knobs.clear();
+    for (const auto& knob : s_governor_impl->knobs) {
+        knobs.push_back({ knob.knob.name, knob.knob.levels[knob.level], knob.level, (u32)knob.knob.levels.size() });
+    }
+}
+
+static void set_level(RegisteredKnob& knob, u32 level) {
+    knob.level = level;
+    knob.knob.apply(level);
+    update_knob_stats();
+}
+
+static void log_decision(const RegisteredKnob& knob, u32 from, float frame_ms) {
+    auto& decisions = s_governor_impl->stats.decisions;
+    decisions.push_back({ s_governor_impl->frame, knob.knob.name, from, knob.level, frame_ms });
+    if (decisions.size() > MAX_QUALITY_DECISIONS) {
+        decisions.pop_front();
+    }
+}
+
+// the least degraded knob that can still go down, so quality drops evenly across knobs
+static RegisteredKnob* pick_degrade() {
+    RegisteredKnob* best = nullptr;
+    for (auto& knob : s_governor_impl->knobs) {
+        if (knob.level + 1 >= knob.knob.levels.size()) {
+            continue;
+        }
+        if (best == nullptr || knob.level < best->level || (knob.level == best->level && knob.knob.priority < best->knob.priority)) {
+            best = &knob;
+        }
+    }
+    return best;
+}
+
+// the most degraded knob, the reverse of pick_degrade
+static RegisteredKnob* pick_upgrade() {
+    RegisteredKnob* best = nullptr;
+    for (auto& knob : s_governor_impl->knobs) {
+        if (knob.level == 0) {
+            continue;
+        }
+        if (best == nullptr || knob.level > best->level || (knob.level == best->level && knob.knob.priority > best->knob.priority)) {
+            best = &knob;
+        }
+    }
+    return best;
+}
+
+// the larger of the last frame's cpu time without waits and its gpu time, 0 while bgfx has no timings yet
+static float measure_frame(Systems::QualityGovernorStats& stats) {
+    const bgfx::Stats* bgfx_stats = bgfx::getStats();
+    stats.cpu_ms                  = 0.0f;
+    stats.gpu_ms                  = 0.0f;
+    if (bgfx_stats->cpuTimerFreq > 0) {
+        i64 busy     = std::max<i64>(bgfx_stats->cpuTimeFrame - bgfx_stats->waitRender - bgfx_stats->waitSubmit, 0);
+        stats.cpu_ms = float(double(busy) * 1000.0 / double(bgfx_stats->cpuTimerFreq));
+    }
+    if (bgfx_stats->gpuTimerFreq > 0 && bgfx_stats->gpuTimeEnd > bgfx_stats->gpuTimeBegin) {
+        stats.gpu_ms = float(double(bgfx_stats->gpuTimeEnd - bgfx_stats->gpuTimeBegin) * 1000.0 / double(bgfx_stats->gpuTimerFreq));
+    }
+    return std::max(stats.cpu_ms, stats.gpu_ms);
+}
+
+namespace Systems {
+    bool quality_governor_init() {
+        assert(s_governor_impl == nullptr && "quality governor is initialized twice");
+        s_governor_impl                = new QualityGovernorImpl();
+        s_governor_impl->upgrade_delay = s_governor_impl->settings.upgrade_delay;
+
+        QualityKnob fog_steps;
+        fog_steps.name = "fog steps";
+        for (const auto& level : FOG_STEP_LEVELS) {
+            fog_steps.levels.push_back(std::to_string(level.max_steps) + " x " + std::to_string(level.step_size).substr(0, 4));
+        }
+        fog_steps.apply = [](u32 level) {
+            fog_rendering_settings().max_steps = FOG_STEP_LEVELS[level].max_steps;
+            fog_rendering_settings().step_size = FOG_STEP_LEVELS[level].step_size;
+        };
+        fog_steps.priority = 0;
+        add_quality_knob(std::move(fog_steps));
+
+        QualityKnob fog_resolution;
+        fog_resolution.name = "fog resolution";
+        for (float scale : FOG_RESOLUTION_LEVELS) {
+            fog_resolution.levels.push_back(std::to_string(i32(scale * 100.0f)) + "%");
+        }
+        fog_resolution.apply = [](u32 level) {
+            fog_rendering_settings().resolution_scale = FOG_RESOLUTION_LEVELS[level];
+        };
+        fog_resolution.priority = 1;
+        add_quality_knob(std::move(fog_resolution));
+
+        // geometry is rarely what costs the most here, it goes last
+        QualityKnob lod_bias;
+        lod_bias.name = "lod bias";
+        for (i32 bias : LOD_BIAS_LEVELS) {
+            lod_bias.levels.push_back("+" + std::to_string(bias));
+        }
+        lod_bias.apply = [](u32 level) {
+            rendering_settings().lod_bias = LOD_BIAS_LEVELS[level];
+        };
+        lod_bias.priority = 2;
+        add_quality_knob(std::move(lod_bias));
+        return true;
+    }
+
+    void quality_governor_quit() {
+        delete s_governor_impl;
+        s_governor_impl = nullptr;
+    }
+
+    QualityKnobId add_quality_knob(QualityKnob knob) {
+        assert(!knob.levels.empty() && knob.apply && "a quality knob needs levels and a way to apply them");
+        RegisteredKnob& added = s_governor_impl->knobs.emplace_back();
+        added.id              = s_governor_impl->next_id++;
+        added.knob            = std::move(knob);
+        set_level(added, 0);
+        return added.id;
+    }
+
+    void remove_quality_knob(QualityKnobId id) {
+        auto& knobs = s_governor_impl->knobs;
+        knobs.erase(std::remove_if(knobs.begin(), knobs.end(), [id](const RegisteredKnob& knob) { return knob.id == id; }), knobs.end());
+        update_knob_stats();
+    }
+
+    QualityGovernorSettings& quality_governor_settings() {
+        return s_governor_impl->settings;
+    }
+
+    const QualityGovernorStats& quality_governor_stats() {
+        return s_governor_impl->stats;
+    }
+
+    void quality_governor() {
+        QualityGovernorImpl& impl               = *s_governor_impl;
+        const QualityGovernorSettings& settings = impl.settings;
+        QualityGovernorStats& stats             = impl.stats;
+        ++impl.frame;
+        float cost = measure_frame(stats);
+
+        // turning it off hands back full quality
+        if (!settings.enabled) {
+            if (impl.was_enabled) {
+                for (auto& knob : impl.knobs) {
+                    set_level(knob, 0);
+                }
+                impl.history.clear();
+                impl.headroom_frames    = 0;
+                impl.last_upgrade_frame = 0;
+                impl.upgrade_delay      = settings.upgrade_delay;
+                impl.was_enabled        = false;
+            }
+            return;
+        }
+        impl.was_enabled = true;
+
+        auto& history = impl.history;
+        if (cost > 0.0f) {
+            history.push_back(cost);
+        }
+        u32 window = std::max(settings.window, 1u);
+        if (history.size() > window) {
+            history.erase(history.begin(), history.end() - window);
+        }
+        stats.frame_ms      = history.empty() ? 0.0f : std::accumulate(history.begin(), history.end(), 0.0f) / history.size();
+        stats.upgrade_delay = impl.upgrade_delay;
+
+        // an upgrade that held for two windows resets the delay
+        if (impl.last_upgrade_frame != 0 && impl.frame - impl.last_upgrade_frame > 2 * window) {
+            impl.last_upgrade_frame = 0;
+            impl.upgrade_delay      = settings.upgrade_delay;
+        }
+        // decisions wait for a full window of frames rendered since the last one
+        if (history.size() < window) {
+            return;
+        }
+
+        if (stats.frame_ms > settings.target_ms * settings.degrade_above) {
+            impl.headroom_frames = 0;
+            RegisteredKnob* knob = pick_degrade();
+            if (knob == nullptr) {
+                return;
+            }
+            // undoing a recent upgrade means it was too eager, wait longer before the next one
+            if (impl.last_upgrade_frame != 0) {
+                impl.upgrade_delay      = std::min(impl.upgrade_delay * 2, settings.upgrade_delay * 16);
+                impl.last_upgrade_frame = 0;
+            }
+            u32 from = knob->level;
+            set_level(*knob, from + 1);
+            log_decision(*knob, from, stats.frame_ms);
+            history.clear();
+        }
+        else if (stats.frame_ms < settings.target_ms * settings.upgrade_below) {
+            if (++impl.headroom_frames < std::max(impl.upgrade_delay, settings.upgrade_delay)) {
+                return;
+            }
+            RegisteredKnob* knob = pick_upgrade();
+            if (knob == nullptr) {
+                return;
+            }
+            u32 from = knob->level;
+            set_level(*knob, from - 1);
+            log_decision(*knob, from, stats.frame_ms);
+            impl.last_upgrade_frame = impl.frame;
+            impl.headroom_frames    = 0;
+            history.clear();
+        }
+        else {
+            impl.headroom_frames = 0;
+        }
+    }
+} // namespace Systems
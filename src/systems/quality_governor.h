@@ -0,0 +1,68 @@
+#pragma once
+
+#include "core/types.h"
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace Systems {
+    // a setting the governor may trade for frame time, level 0 is full quality and every further level is cheaper
+    struct QualityKnob {
+        std::string name;
+        std::vector<std::string> levels; // shown in the Debug tab, one per level
+        std::function<void(u32)> apply;  // switches to a level
+        i32 priority = 0;                // among knobs at the same level the lowest is given up first
+    };
+
+    using QualityKnobId = u32;
+
+    struct QualityGovernorSettings {
+        bool enabled        = false;
+        float target_ms     = 16.6f;
+        float degrade_above = 1.05f; // of target_ms, over this one knob gets a level cheaper
+        float upgrade_below = 0.8f;  // under this for upgrade_delay frames one knob gets a level better
+        u32 window          = 30;    // frames averaged for every decision, history restarts after each
+        u32 upgrade_delay   = 60;    // doubles each time an upgrade has to be undone, up to 16 times this
+    };
+
+    struct QualityDecision {
+        u64 frame;
+        std::string knob;
+        u32 from;
+        u32 to;
+        float frame_ms; // the average that triggered it
+    };
+
+    struct QualityKnobStatus {
+        std::string name;
+        std::string level_name;
+        u32 level;
+        u32 level_count;
+    };
+
+    struct QualityGovernorStats {
+        float frame_ms    = 0.0f; // average of the current history
+        float cpu_ms      = 0.0f; // last frame, without waiting for the renderer or vsync
+        float gpu_ms      = 0.0f;
+        u32 upgrade_delay = 0;    // frames of headroom the next upgrade waits for
+        std::vector<QualityKnobStatus> knobs;
+        std::deque<QualityDecision> decisions; // latest last
+    };
+
+    // registers the fog step, fog resolution and lod bias knobs, after fog_rendering_init and rendering_init
+    bool quality_governor_init();
+    void quality_governor_quit();
+
+    // the knob starts at level 0, which is applied at once
+    QualityKnobId add_quality_knob(QualityKnob knob);
+    // leaves the setting at whatever level it was
+    void remove_quality_knob(QualityKnobId id);
+
+    // call once per frame, before the systems it governs run. Frame cost is the larger of the cpu and
+    // gpu time bgfx reports for the last frame, so vsync or a frame limiter doesn't hide headroom
+    void quality_governor();
+
+    QualityGovernorSettings& quality_governor_settings();
+    const QualityGovernorStats& quality_governor_stats();
+}
@@ -1,50 +1,661 @@
 #include "rendering.h"
 #include <entt/entity/registry.hpp>
+#include <entt/entity/observer.hpp>
 #include <bgfx/bgfx.h>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/geometric.hpp>
+#include <cassert>
+#include <chrono>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
 
 #include "core/gfx.h"
 #include "core/graphic/model.h"
 #include "core/graphic/shader.h"
+#include "core/graphic/frustum.h"
+#include "core/graphic/occlusion.h"
+#include "core/graphic/render_queue.h"
 #include "core/screen.h"
+#include "core/thread_pool.h"
 
 #include "components/transform.h"
 #include "components/camera.h"
 #include "components/render.h"
 
+// cached per entity with a Transform and a RenderComponent, kept current through observers
+struct RenderEntry {
+    std::shared_ptr<Model> model;
+    std::shared_ptr<Shader> shader;
+    std::shared_ptr<Shader> instanced_shader;
+    bgfx::UniformHandle uniform = BGFX_INVALID_HANDLE;
+    glm::mat4 world             = glm::mat4(1);
+    AABB bounds{};          // world space, valid once ready
+    float scale    = 1.0f;  // largest axis scale of world, lod errors are in model units
+    bool ready     = false; // the model finished streaming in
+    u32 batch      = 0;     // index into RenderingImpl::batches
+    u32 batch_slot = 0;     // index into RenderBatch::entries
+};
+
+// an entity in the frustum this frame, distance from the camera to its bounds in world and in model units
+struct RenderInstance {
+    const RenderEntry* entry;
+    float distance;
+    float lod_distance;
+};
+
+// entities sharing a model and shader, drawn with one instanced call per mesh when possible
+struct RenderBatch {
+    std::pair<const Model*, const Shader*> key;
+    std::vector<RenderEntry*> entries;
+    // rebuilt every frame
+    std::vector<RenderInstance> instances;
+    bgfx::InstanceDataBuffer idb;
+};
+
+// one draw in the queue, either a mesh of one entity or a range of a batch's instance buffer
+struct DrawPacket {
+    u32 batch;
+    u32 mesh;
+    u32 lod;
+    const RenderEntry* entry; // nullptr for instanced draws
+    u32 first_instance;
+    u32 instance_count;
+};
+
+struct RenderingImpl {
+    bgfx::UniformHandle u_vertex_dequant = BGFX_INVALID_HANDLE;
+    Systems::RenderingSettings settings;
+    Systems::RenderingStats stats;
+
+    entt::registry* scene = nullptr;
+    entt::observer changes;
+    std::unordered_map<entt::entity, RenderEntry> entries;
+    std::vector<entt::entity> pending; // entries whose model is still loading
+    std::vector<RenderBatch> batches;
+    std::map<std::pair<const Model*, const Shader*>, u32> batch_index;
+
+    RenderQueue queue;
+    std::vector<DrawPacket> packets;
+    std::vector<u32> visible; // scratch for cull_boxes
+    std::vector<float> distances;
+
+    OcclusionBuffer occlusion;
+    std::vector<RenderInstance> occluders; // scratch for render_occluders
+};
+
+static RenderingImpl* s_rendering_impl = nullptr;
+
+static const u64 RENDER_STATE = BGFX_STATE_WRITE_RGB
+                                | BGFX_STATE_WRITE_Z
+                                | BGFX_STATE_DEPTH_TEST_LESS; // don't cull since model is corrupt
+
+// largest scale of the matrix' axes
+static float max_scale(const glm::mat4& m) {
+    return glm::max(glm::length(glm::vec3(m[0])), glm::max(glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))));
+}
+
+// from the camera to the nearest point of the box's bounding sphere
+static float distance_to(const AABB& bounds, const glm::vec3& camera_pos) {
+    return glm::max(glm::length(bounds.center() - camera_pos) - glm::length(bounds.extent()) * 0.5f, 0.001f);
+}
+
+// distance at which a level's error projects to lod_error_pixels, in model units
+static float lod_min_distance(const MeshDataTuple& mdt, u32 lod, float pixels_per_unit) {
+    return mdt.lods[lod].error * pixels_per_unit / s_rendering_impl->settings.lod_error_pixels;
+}
+
+static u32 apply_lod_bias(const MeshDataTuple& mdt, u32 lod) {
+    return (u32)glm::clamp((i32)lod + s_rendering_impl->settings.lod_bias, 0, (i32)mdt.lod_count - 1);
+}
+
+// picks the coarsest level whose simplification error stays below the pixel threshold,
+// pixels_per_unit is the projected size of one world unit at distance 1
+static u32 select_lod(const MeshDataTuple& mdt, float lod_distance, float pixels_per_unit) {
+    const Systems::RenderingSettings& settings = s_rendering_impl->settings;
+    if (!settings.lods_enabled || mdt.lod_count <= 1) {
+        return 0;
+    }
+
+    u32 lod = 0;
+    for (u32 i = 1; i < mdt.lod_count; ++i) {
+        if (lod_min_distance(mdt, i, pixels_per_unit) > lod_distance) {
+            break;
+        }
+        lod = i;
+    }
+    return apply_lod_bias(mdt, lod);
+}
+
+// the diffuse color is all the material there is for now
+static u16 material_id(const MeshDataTuple& mdt) {
+    glm::uvec4 c = glm::uvec4(glm::clamp(mdt.diffuse, 0.0f, 1.0f) * 255.0f);
+    u32 packed   = c.r | (c.g << 8) | (c.b << 16) | (c.a << 24);
+    return u16(packed ^ (packed >> 16));
+}
+
+static void detach_entry(RenderEntry& entry) {
+    auto& batches      = s_rendering_impl->batches;
+    RenderBatch& batch = batches[entry.batch];
+    RenderEntry* moved = batch.entries.back();
+    batch.entries[entry.batch_slot] = moved;
+    moved->batch_slot               = entry.batch_slot;
+    batch.entries.pop_back();
+    if (!batch.entries.empty()) {
+        return;
+    }
+
+    // drop the empty batch, the last one takes its place
+    u32 index = entry.batch;
+    s_rendering_impl->batch_index.erase(batch.key);
+    if (index + 1 != batches.size()) {
+        batches[index] = std::move(batches.back());
+        s_rendering_impl->batch_index[batches[index].key] = index;
+        for (RenderEntry* e : batches[index].entries) {
+            e->batch = index;
+        }
+    }
+    batches.pop_back();
+}
+
+static void attach_entry(RenderEntry& entry) {
+    auto& batches = s_rendering_impl->batches;
+    auto key      = std::make_pair<const Model*, const Shader*>(entry.model.get(), entry.shader.get());
+    auto [it, inserted] = s_rendering_impl->batch_index.emplace(key, u32(batches.size()));
+    if (inserted) {
+        batches.emplace_back().key = key;
+    }
+    entry.batch      = it->second;
+    entry.batch_slot = u32(batches[entry.batch].entries.size());
+    batches[entry.batch].entries.push_back(&entry);
+}
+
+static void remove_entry(entt::entity entity) {
+    auto it = s_rendering_impl->entries.find(entity);
+    if (it == s_rendering_impl->entries.end()) {
+        return;
+    }
+    detach_entry(it->second);
+    s_rendering_impl->entries.erase(it);
+}
+
+static void on_render_destroyed(entt::registry&, entt::entity entity) {
+    remove_entry(entity);
+}
+
+static void refresh_bounds(entt::entity entity, RenderEntry& entry) {
+    entry.ready = entry.model->is_ready();
+    if (entry.ready) {
+        entry.bounds = entry.model->aabb.transformed(entry.world);
+    }
+    else {
+        s_rendering_impl->pending.push_back(entity);
+    }
+}
+
+static void update_entry(entt::registry& scene, entt::entity entity) {
+    if (!scene.valid(entity) || !scene.all_of<Transform, RenderComponent>(entity)) {
+        remove_entry(entity);
+        return;
+    }
+
+    const auto& trans  = scene.get<Transform>(entity);
+    const auto& render = scene.get<RenderComponent>(entity);
+    if (render.model == nullptr || render.shader == nullptr) {
+        perror("null Model or Shader in RenderComponent\n");
+        remove_entry(entity);
+        return;
+    }
+
+    auto [it, inserted] = s_rendering_impl->entries.try_emplace(entity);
+    RenderEntry& entry  = it->second;
+    bool regroup        = inserted || entry.model != render.model || entry.shader != render.shader;
+    if (regroup && !inserted) {
+        detach_entry(entry);
+    }
+
+    entry.model            = render.model;
+    entry.shader           = render.shader;
+    entry.instanced_shader = render.instanced_shader;
+    entry.uniform          = render.uniform;
+    entry.world            = trans.matrix();
+    entry.scale            = max_scale(entry.world);
+    refresh_bounds(entity, entry);
+    if (regroup) {
+        attach_entry(entry);
+    }
+}
+
+// applies what the observers collected since the last frame
+static void apply_changes(entt::registry& scene) {
+    Systems::RenderingStats& stats = s_rendering_impl->stats;
+    for (auto entity : s_rendering_impl->changes) {
+        update_entry(scene, entity);
+        ++stats.updated_entities;
+    }
+    s_rendering_impl->changes.clear();
+
+    // an entity updated more than once while loading is listed more than once
+    std::vector<entt::entity> pending;
+    pending.swap(s_rendering_impl->pending);
+    std::sort(pending.begin(), pending.end());
+    pending.erase(std::unique(pending.begin(), pending.end()), pending.end());
+    for (auto entity : pending) {
+        auto it = s_rendering_impl->entries.find(entity);
+        if (it != s_rendering_impl->entries.end() && !it->second.ready) {
+            refresh_bounds(entity, it->second);
+        }
+    }
+}
+
+static void push_packet(const DrawPacket& packet, float depth, const Shader& shader) {
+    const MeshDataTuple& mdt = s_rendering_impl->batches[packet.batch].entries[0]->model->mdt[packet.mesh];
+    u64 key                  = RenderQueue::make_key(Gfx::main_view(), depth, shader.handle().idx, material_id(mdt));
+    s_rendering_impl->queue.push(key, u32(s_rendering_impl->packets.size()));
+    s_rendering_impl->packets.push_back(packet);
+}
+
+// rasterizes the occluders of the nearest visible entities that still fit the triangle budget,
+// on the shared pool one tile per task
+static void render_occluders(const glm::mat4& view_proj) {
+    Systems::RenderingStats& stats             = s_rendering_impl->stats;
+    const Systems::RenderingSettings& settings = s_rendering_impl->settings;
+    OcclusionBuffer& occlusion                 = s_rendering_impl->occlusion;
+    std::vector<RenderInstance>& occluders     = s_rendering_impl->occluders;
+
+    auto start = std::chrono::steady_clock::now();
+    occluders.clear();
+    for (const RenderBatch& batch : s_rendering_impl->batches) {
+        if (!batch.instances.empty() && batch.entries[0]->model->occluders != nullptr) {
+            occluders.insert(occluders.end(), batch.instances.begin(), batch.instances.end());
+        }
+    }
+    std::sort(occluders.begin(), occluders.end(), [](const RenderInstance& a, const RenderInstance& b) {
+        return a.distance < b.distance;
+    });
+
+    occlusion.begin(settings.occlusion_width, settings.occlusion_height, view_proj);
+    u32 budget = settings.occluder_budget;
+    for (const auto& instance : occluders) {
+        const OccluderMesh& mesh = *instance.entry->model->occluders;
+        // a smaller occluder further away may still fit
+        if (mesh.triangle_count() > budget) {
+            continue;
+        }
+        budget -= mesh.triangle_count();
+        stats.occluder_triangles += occlusion.add_occluder(mesh, instance.entry->world);
+    }
+    occlusion.rasterize(&ThreadPool::shared());
+    stats.occlusion_raster_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// drops instances whose whole model is hidden, an entity never hides behind its own occluders
+// since they lie inside its bounds
+static void cull_occluded_instances(RenderBatch& batch) {
+    Systems::RenderingStats& stats   = s_rendering_impl->stats;
+    const OcclusionBuffer& occlusion = s_rendering_impl->occlusion;
+
+    auto start = std::chrono::steady_clock::now();
+    stats.occlusion_tests += u32(batch.instances.size());
+    auto hidden = std::remove_if(batch.instances.begin(), batch.instances.end(), [&](const RenderInstance& instance) {
+        return occlusion.is_occluded(instance.entry->model->aabb, instance.entry->world);
+    });
+    stats.occluded_instances += u32(batch.instances.end() - hidden);
+    batch.instances.erase(hidden, batch.instances.end());
+    stats.occlusion_test_ms += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// same for the meshes of one entity that survived frustum culling
+static void cull_occluded_meshes(const RenderEntry& entry, std::vector<u32>& visible) {
+    Systems::RenderingStats& stats   = s_rendering_impl->stats;
+    const OcclusionBuffer& occlusion = s_rendering_impl->occlusion;
+    const Model& model               = *entry.model;
+
+    auto start = std::chrono::steady_clock::now();
+    stats.occlusion_tests += u32(visible.size());
+    auto hidden = std::remove_if(visible.begin(), visible.end(), [&](u32 index) {
+        return occlusion.is_occluded(model.mdt[index].aabb, entry.world);
+    });
+    stats.occluded_meshes += u32(visible.end() - hidden);
+    visible.erase(hidden, visible.end());
+    stats.occlusion_test_ms += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// one packet per visible mesh of every instance
+static void push_each(u32 batch_index, const Frustum& frustum, const glm::vec3& camera_pos, float pixels_per_unit) {
+    Systems::RenderingStats& stats = s_rendering_impl->stats;
+    const RenderBatch& batch       = s_rendering_impl->batches[batch_index];
+    std::vector<u32>& visible      = s_rendering_impl->visible;
+
+    for (const auto& instance : batch.instances) {
+        const RenderEntry& entry = *instance.entry;
+        const Model& model       = *entry.model;
+        if (s_rendering_impl->settings.frustum_culling) {
+            auto start = std::chrono::steady_clock::now();
+            cull_boxes(frustum, entry.world, model.mesh_bounds, visible);
+            stats.cull_ms += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+            stats.culled_meshes += u32(model.mdt.size() - visible.size());
+        }
+        else {
+            visible.resize(model.mdt.size());
+            for (u32 i = 0; i < visible.size(); ++i) {
+                visible[i] = i;
+            }
+        }
+        if (s_rendering_impl->settings.occlusion_culling) {
+            cull_occluded_meshes(entry, visible);
+        }
+
+        for (u32 index : visible) {
+            const MeshDataTuple& mdt = model.mdt[index];
+            float distance           = distance_to(mdt.aabb.transformed(entry.world), camera_pos);
+            u32 lod                  = select_lod(mdt, distance / entry.scale, pixels_per_unit);
+            push_packet({batch_index, index, lod, &entry, 0, 0}, distance, *entry.shader);
+        }
+    }
+}
+
+// all instances in one buffer sorted front to back, so every lod level of a mesh is a contiguous
+// range of it and each mesh takes one instanced draw per level in use. Lods come from the distance
+// to the whole model's bounds, which picks the same or more detail than per mesh bounds
+static void push_instanced(u32 batch_index, float pixels_per_unit) {
+    Systems::RenderingStats& stats             = s_rendering_impl->stats;
+    const Systems::RenderingSettings& settings = s_rendering_impl->settings;
+    RenderBatch& batch                         = s_rendering_impl->batches[batch_index];
+    const RenderEntry& first_entry             = *batch.entries[0];
+    const Model& model                         = *first_entry.model;
+
+    std::sort(batch.instances.begin(), batch.instances.end(), [](const RenderInstance& a, const RenderInstance& b) {
+        return a.lod_distance < b.lod_distance;
+    });
+
+    // transient buffer space is limited per frame, whatever doesn't fit is dropped
+    const u16 stride = sizeof(glm::mat4);
+    u32 count        = bgfx::getAvailInstanceDataBuffer((u32)batch.instances.size(), stride);
+    if (count == 0) {
+        return;
+    }
+    bgfx::allocInstanceDataBuffer(&batch.idb, count, stride);
+
+    std::vector<float>& distances = s_rendering_impl->distances;
+    distances.resize(count);
+    for (u32 i = 0; i < count; ++i) {
+        std::memcpy(batch.idb.data + i * stride, glm::value_ptr(batch.instances[i].entry->world), stride);
+        distances[i] = batch.instances[i].lod_distance;
+    }
+    stats.instances += count;
+
+    for (u32 mesh = 0; mesh < model.mdt.size(); ++mesh) {
+        const MeshDataTuple& mdt = model.mdt[mesh];
+        u32 level_count          = settings.lods_enabled ? mdt.lod_count : 1;
+        u32 first                = 0;
+        for (u32 level = 0; level < level_count && first < count; ++level) {
+            u32 end = count;
+            if (level + 1 < level_count) {
+                float next_distance = lod_min_distance(mdt, level + 1, pixels_per_unit);
+                end                 = u32(std::lower_bound(distances.begin() + first, distances.begin() + count, next_distance) - distances.begin());
+            }
+            if (end == first) {
+                continue;
+            }
+
+            u32 lod = settings.lods_enabled ? apply_lod_bias(mdt, level) : 0;
+            push_packet({batch_index, mesh, lod, nullptr, first, end - first}, batch.instances[first].distance, *first_entry.instanced_shader);
+            first = end;
+        }
+    }
+}
+
+// what one submitting thread counted, merged into RenderingStats afterwards
+struct SubmitCounters {
+    u32 draw_calls               = 0;
+    u32 instanced_draws          = 0;
+    u32 lod_draws[MAX_MESH_LODS] = {};
+    u64 triangles                = 0;
+    u32 skipped_uniforms         = 0;
+    u32 skipped_states           = 0;
+};
+
+// walks a range of the sorted queue and only sets uniforms and state that differ from the previous draw,
+// bgfx keeps uniform values between draws and state too when it isn't discarded on submit
+static void submit_range(bgfx::Encoder* encoder, u32 begin, u32 end, SubmitCounters& counters) {
+    const RenderQueue& queue = s_rendering_impl->queue;
+
+    bgfx::ProgramHandle last_program = BGFX_INVALID_HANDLE;
+    bgfx::UniformHandle last_uniform = BGFX_INVALID_HANDLE;
+    glm::vec4 last_diffuse           = glm::vec4(0);
+    const glm::vec4* last_dequant    = nullptr;
+    u64 last_state                   = 0;
+
+    for (u32 i = begin; i < end; ++i) {
+        const DrawPacket& packet = s_rendering_impl->packets[queue[i]];
+        RenderBatch& batch       = s_rendering_impl->batches[packet.batch];
+        const RenderEntry& first = *batch.entries[0];
+        const MeshDataTuple& mdt = first.model->mdt[packet.mesh];
+        const MeshLod& range     = mdt.lods[packet.lod];
+
+        Shader* shader = nullptr;
+        if (packet.entry != nullptr) {
+            encoder->setTransform(glm::value_ptr(packet.entry->world));
+            shader = packet.entry->shader.get();
+        }
+        else {
+            encoder->setInstanceDataBuffer(&batch.idb, packet.first_instance, packet.instance_count);
+            shader = first.instanced_shader.get();
+            ++counters.instanced_draws;
+        }
+        encoder->setVertexBuffer(0, mdt.vbh);
+        encoder->setIndexBuffer(mdt.ibh, range.index_offset, range.index_count);
+        u32 instance_count = packet.entry != nullptr ? 1 : packet.instance_count;
+        ++counters.draw_calls;
+        ++counters.lod_draws[packet.lod];
+        counters.triangles += u64(range.index_count / 3) * instance_count;
+
+        // todo: move to material
+        const float gloss = 32;
+        glm::vec4 diffuse = mdt.diffuse;
+        diffuse.a = gloss;
+        // a program switch resends every uniform rather than rely on the backend to carry them over
+        if (shader->handle().idx != last_program.idx) {
+            last_program = shader->handle();
+            last_uniform = BGFX_INVALID_HANDLE;
+            last_dequant = nullptr;
+        }
+        if (first.uniform.idx != last_uniform.idx || diffuse != last_diffuse) {
+            encoder->setUniform(first.uniform, glm::value_ptr(diffuse));
+            last_uniform = first.uniform;
+            last_diffuse = diffuse;
+        }
+        else {
+            ++counters.skipped_uniforms;
+        }
+        if (last_dequant == nullptr || std::memcmp(last_dequant, mdt.dequant, sizeof(mdt.dequant)) != 0) {
+            encoder->setUniform(s_rendering_impl->u_vertex_dequant, mdt.dequant, 2);
+            last_dequant = mdt.dequant;
+        }
+        else {
+            ++counters.skipped_uniforms;
+        }
+        if (RENDER_STATE != last_state) {
+            encoder->setState(RENDER_STATE);
+            last_state = RENDER_STATE;
+        }
+        else {
+            ++counters.skipped_states;
+        }
+
+        // the last draw leaves nothing behind for whoever submits next on this encoder
+        u8 discard = i + 1 == end ? BGFX_DISCARD_ALL : BGFX_DISCARD_ALL & ~BGFX_DISCARD_STATE;
+        encoder->submit(Gfx::main_view(), shader->handle(), i, discard);
+    }
+}
+
+// splits the queue into contiguous ranges, one encoder each. The queue position is the submit depth,
+// so bgfx restores queue order whichever thread a draw came from, and each range starts with
+// every uniform set since its first draw follows another encoder's last
+static void submit_queue() {
+    Systems::RenderingStats& stats = s_rendering_impl->stats;
+    u32 count                      = s_rendering_impl->queue.size();
+    u32 max_encoders               = bgfx::getCaps()->limits.maxEncoders;
+    u32 thread_count               = std::clamp(s_rendering_impl->settings.submit_threads, 1u, max_encoders);
+    // below this a range costs more to hand out than to submit
+    const u32 min_range = 256;
+    thread_count        = std::max(1u, std::min(thread_count, count / min_range));
+
+    std::vector<SubmitCounters> counters(thread_count);
+    if (thread_count == 1) {
+        bgfx::Encoder* encoder = bgfx::begin();
+        submit_range(encoder, 0, count, counters[0]);
+        bgfx::end(encoder);
+    }
+    else {
+        ThreadPool::shared().parallel_for(thread_count, [&](u32 t) {
+            bgfx::Encoder* encoder = bgfx::begin(true);
+            if (encoder == nullptr) {
+                // out of encoders, bgfx drops what this range would have drawn
+                return;
+            }
+            submit_range(encoder, u32(u64(count) * t / thread_count), u32(u64(count) * (t + 1) / thread_count), counters[t]);
+            bgfx::end(encoder);
+        });
+    }
+
+    for (const auto& c : counters) {
+        stats.draw_calls += c.draw_calls;
+        stats.instanced_draws += c.instanced_draws;
+        for (u32 i = 0; i < MAX_MESH_LODS; ++i) {
+            stats.lod_draws[i] += c.lod_draws[i];
+        }
+        stats.triangles += c.triangles;
+        stats.skipped_uniforms += c.skipped_uniforms;
+        stats.skipped_states += c.skipped_states;
+    }
+    stats.submit_threads = thread_count;
+}
+
 namespace Systems {
+    bool rendering_init(entt::registry& scene) {
+        assert(s_rendering_impl == nullptr && "rendering is initialized twice");
+        s_rendering_impl = new RenderingImpl();
+
+        // unpacks compact vertex formats, see MeshDataTuple::dequant
+        s_rendering_impl->u_vertex_dequant = bgfx::createUniform("u_vertex_dequant", bgfx::UniformType::Vec4, 2);
+
+        // entities that gain both components or change either of them, removals come through on_destroy
+        s_rendering_impl->scene = &scene;
+        s_rendering_impl->changes.connect(scene, entt::collector.group<Transform, RenderComponent>()
+                                                     .update<Transform>()
+                                                     .where<RenderComponent>()
+                                                     .update<RenderComponent>()
+                                                     .where<Transform>());
+        scene.on_destroy<Transform>().connect<&on_render_destroyed>();
+        scene.on_destroy<RenderComponent>().connect<&on_render_destroyed>();
+
+        // whatever was there before the observer
+        for (auto entity : scene.view<const Transform, const RenderComponent>()) {
+            update_entry(scene, entity);
+        }
+        return true;
+    }
+
+    void rendering_quit() {
+        if (s_rendering_impl == nullptr) {
+            return;
+        }
+
+        entt::registry& scene = *s_rendering_impl->scene;
+        s_rendering_impl->changes.disconnect();
+        scene.on_destroy<Transform>().disconnect<&on_render_destroyed>();
+        scene.on_destroy<RenderComponent>().disconnect<&on_render_destroyed>();
+
+        bgfx::destroy(s_rendering_impl->u_vertex_dequant);
+        delete s_rendering_impl;
+        s_rendering_impl = nullptr;
+    }
+
+    RenderingSettings& rendering_settings() {
+        return s_rendering_impl->settings;
+    }
+
+    const RenderingStats& rendering_stats() {
+        return s_rendering_impl->stats;
+    }
+
     void rendering(entt::registry& scene) {
+        assert(&scene == s_rendering_impl->scene && "rendering observes another scene");
+        auto frame_start      = std::chrono::steady_clock::now();
+        RenderingStats& stats = s_rendering_impl->stats;
+        stats                 = RenderingStats();
+        apply_changes(scene);
+
+        const RenderingSettings& settings = s_rendering_impl->settings;
+        bool can_instance                 = settings.instancing && (bgfx::getCaps()->supported & BGFX_CAPS_INSTANCING) != 0;
+
         for (auto&& [entity, trans, camera] : scene.view<const Transform, const Camera>().each()) {
-            glm::mat4 view = trans.view_matrix();
-            glm::mat4 proj = camera.matrix();
+            glm::mat4 view        = trans.view_matrix();
+            glm::mat4 proj        = camera.matrix();
+            float pixels_per_unit = proj[1][1] * Screen::draw_height() * 0.5f;
+            glm::vec3 camera_pos  = trans.position;
+            Frustum frustum       = Frustum::from_matrix(proj * view);
             bgfx::setViewTransform(Gfx::main_view(), glm::value_ptr(view), glm::value_ptr(proj));
             bgfx::setViewRect(Gfx::main_view(), 0, 0, Screen::draw_width(), Screen::draw_height());
+            // the queue position goes in as depth, so bgfx replays draws in queue order
+            // and the uniforms skipped in submit_queue are still those of the previous draw
+            bgfx::setViewMode(Gfx::main_view(), bgfx::ViewMode::DepthAscending);
 
-            auto objects = scene.view<const Transform, const RenderComponent>();
-            objects.each([&](const Transform& trans, const RenderComponent& render) {
-                if (render.model == nullptr || render.shader == nullptr) {
-                    perror("null Model or Shader in RenderComponent\n");
-                    return;
+            s_rendering_impl->queue.clear();
+            s_rendering_impl->packets.clear();
+            auto& batches = s_rendering_impl->batches;
+            for (u32 i = 0; i < batches.size(); ++i) {
+                // whole models outside the frustum are dropped here
+                RenderBatch& batch = batches[i];
+                batch.instances.clear();
+                for (const RenderEntry* entry : batch.entries) {
+                    if (!entry->ready) {
+                        continue;
+                    }
+                    if (settings.frustum_culling && !frustum.intersects(entry->bounds)) {
+                        ++stats.culled_instances;
+                        continue;
+                    }
+                    float distance = distance_to(entry->bounds, camera_pos);
+                    batch.instances.push_back({entry, distance, distance / entry->scale});
                 }
+            }
+
+            // everything in the frustum may occlude, only then is anything tested
+            if (settings.occlusion_culling) {
+                render_occluders(proj * view);
+            }
 
-                for (const auto& mdt : render.model->mdt) {
-                    bgfx::setTransform(glm::value_ptr(mdt.transform));
-                    bgfx::setVertexBuffer(0, mdt.vbh);
-                    bgfx::setIndexBuffer(mdt.ibh);
-                    // todo: move to material
-                    const float gloss = 32;
-                    glm::vec4 diffuse = mdt.diffuse;
-                    diffuse.a = gloss;
-                    bgfx::setUniform(render.uniform, glm::value_ptr(diffuse));
-                    bgfx::setState(BGFX_STATE_WRITE_RGB
-                                   | BGFX_STATE_WRITE_Z
-                                   | BGFX_STATE_DEPTH_TEST_LESS); // don't cull since model is corrupt
-                    bgfx::submit(Gfx::main_view(), render.shader->handle());
+            for (u32 i = 0; i < batches.size(); ++i) {
+                RenderBatch& batch = batches[i];
+                if (settings.occlusion_culling && !batch.instances.empty()) {
+                    cull_occluded_instances(batch);
+                }
+                if (batch.instances.empty()) {
+                    continue;
+                }
+                if (can_instance && batch.entries[0]->instanced_shader != nullptr && batch.instances.size() > 1) {
+                    push_instanced(i, pixels_per_unit);
                 }
-            });
+                else {
+                    push_each(i, frustum, camera_pos, pixels_per_unit);
+                }
+            }
+
+            auto sort_start = std::chrono::steady_clock::now();
+            s_rendering_impl->queue.sort();
+            auto submit_start = std::chrono::steady_clock::now();
+            submit_queue();
+            stats.sort_ms   = std::chrono::duration<float, std::milli>(submit_start - sort_start).count();
+            stats.submit_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - submit_start).count();
 
             // we only support only one camera in scene for now
             break;
         }
+
+        stats.total_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
     }
 } // namespace Systems
@@ -1,7 +1,54 @@
 #pragma once
 
 #include "entt/fwd.hpp"
+#include "core/types.h"
+#include "core/graphic/model.h"
 
 namespace Systems {
+    struct RenderingSettings {
+        bool lods_enabled      = true;
+        float lod_error_pixels = 1.0f; // coarsest level whose error projects to at most this many pixels
+        i32 lod_bias           = 0;    // added to the selected level, negative prefers detail
+        bool frustum_culling   = true;
+        bool instancing        = true; // entities sharing a model and shader, needs RenderComponent::instanced_shader
+        u32 submit_threads     = 1;    // bgfx encoders the sorted queue is split across, capped by Caps::limits.maxEncoders
+        bool occlusion_culling = true; // against a cpu depth buffer of the nearest models' Model::occluders
+        u32 occluder_budget    = 32768; // triangles rasterized per frame
+        u32 occlusion_width    = 256;  // depth buffer resolution, rounded up to whole OcclusionBuffer tiles
+        u32 occlusion_height   = 128;
+    };
+
+    struct RenderingStats {
+        u32 draw_calls               = 0;
+        u64 triangles                = 0;
+        u32 lod_draws[MAX_MESH_LODS] = {};
+        u32 culled_meshes            = 0;
+        u32 culled_instances         = 0; // whole entities outside the frustum
+        float cull_ms                = 0.0f;
+        u32 instanced_draws          = 0;
+        u32 instances                = 0; // drawn through instanced draws
+        u32 updated_entities         = 0; // picked up from observers this frame
+        u32 skipped_uniforms         = 0; // setUniform calls saved by the queue order
+        u32 skipped_states           = 0;
+        float sort_ms                = 0.0f;
+        float submit_ms              = 0.0f; // issuing the sorted queue to bgfx
+        u32 submit_threads           = 0;    // encoders actually used, small queues use fewer
+        u32 occluder_triangles       = 0;    // rasterized into the occlusion buffer
+        u32 occlusion_tests          = 0;    // boxes tested against it, entities and meshes
+        u32 occluded_instances       = 0;
+        u32 occluded_meshes          = 0;
+        float occlusion_raster_ms    = 0.0f; // transforming, binning and rasterizing occluders
+        float occlusion_test_ms      = 0.0f;
+        float total_ms               = 0.0f; // cpu time of the whole system
+    };
+
+    // Transform and RenderComponent of drawn entities are tracked through observers on `scene`,
+    // change them with registry::patch or registry::replace so the renderer sees it
+    bool rendering_init(entt::registry& scene);
+    void rendering_quit();
+
     void rendering(entt::registry& scene);
-}
\ No newline at end of file
+
+    RenderingSettings& rendering_settings();
+    const RenderingStats& rendering_stats();
+}